@@ -1,6 +1,7 @@
 #ifndef LSARITH_H_INCLUDED_
 #define LSARITH_H_INCLUDED_
 
+#include "lscsr.h"
 #include "lsmat.h"
 #include <stdbool.h>
 
@@ -11,6 +12,17 @@ typedef enum lsarith_errno_ {
     LSARITH_E_NOINV,
 } lsarith_errno_t;
 
+typedef struct LSMatLu_ {
+    size_t n;
+    size_t *q;
+    size_t *pinv;
+    LSMatCsr_t *l;
+    LSMatCsr_t *u;
+} LSMatLu_t;
+
+void LSArith_set_threads(size_t n_threads);
+size_t LSArith_threads(void);
+
 lsarith_errno_t LSArith_mat_add(const LSMat_t *restrict a, const LSMat_t *restrict b,
                                 LSMat_t *restrict out);
 lsarith_errno_t LSArith_mat_sub(const LSMat_t *restrict a, const LSMat_t *restrict b,
@@ -19,4 +31,42 @@ lsarith_errno_t LSArith_mat_mul(const LSMat_t *restrict a, const LSMat_t *restri
                                 LSMat_t *restrict out);
 LSMatView_t LSArith_mat_T(LSMat_t *restrict a);
 
+lsarith_errno_t LSArith_mat_scale(LSMat_t *restrict a, double alpha, bool prune);
+lsarith_errno_t LSArith_mat_axpy(LSMat_t *y, double alpha, const LSMat_t *x, bool prune);
+lsarith_errno_t LSArith_mat_add_assign(LSMat_t *a, const LSMat_t *b, bool prune);
+lsarith_errno_t LSArith_mat_sub_assign(LSMat_t *a, const LSMat_t *b, bool prune);
+lsarith_errno_t LSArith_mat_mul_acc(LSMat_t *c, double alpha, const LSMat_t *a, const LSMat_t *b,
+                                    bool prune);
+
+lsarith_errno_t LSArith_view_add(const LSMatView_t a, const LSMatView_t b, LSMat_t *restrict out);
+lsarith_errno_t LSArith_view_sub(const LSMatView_t a, const LSMatView_t b, LSMat_t *restrict out);
+lsarith_errno_t LSArith_view_mul(const LSMatView_t a, const LSMatView_t b, LSMat_t *restrict out);
+lsarith_errno_t LSArith_view_sum(const LSMatView_t *restrict views, const double *restrict coefs,
+                                 size_t n, LSMat_t *restrict out);
+
+lsarith_errno_t LSArith_csr_add(const LSMatCsr_t *restrict a, const LSMatCsr_t *restrict b,
+                                LSMat_t *restrict out);
+lsarith_errno_t LSArith_csr_sub(const LSMatCsr_t *restrict a, const LSMatCsr_t *restrict b,
+                                LSMat_t *restrict out);
+lsarith_errno_t LSArith_csr_mul(const LSMatCsr_t *restrict a, const LSMatCsr_t *restrict b,
+                                LSMat_t *restrict out);
+
+lsarith_errno_t LSArith_mat_vec(const LSMat_t *restrict a, const double *restrict x,
+                                double *restrict y);
+lsarith_errno_t LSArith_mat_densemat(const LSMat_t *restrict a, const double *restrict x,
+                                     size_t n_vecs, double *restrict y);
+lsarith_errno_t LSArith_csr_vec(const LSMatCsr_t *restrict a, const double *restrict x,
+                                double *restrict y);
+lsarith_errno_t LSArith_csr_densemat(const LSMatCsr_t *restrict a, const double *restrict x,
+                                     size_t n_vecs, double *restrict y);
+
+lsarith_errno_t LSArith_lu(const LSMat_t *restrict a, LSMatLu_t *restrict lu);
+lsmat_errno_t LSMatLu_destroy(LSMatLu_t *restrict lu);
+lsarith_errno_t LSArith_lu_solve(const LSMatLu_t *restrict lu, const double *restrict b,
+                                 size_t n_vecs, double *restrict x);
+lsarith_errno_t LSArith_lu_solve_mat(const LSMatLu_t *restrict lu, const LSMat_t *b, LSMat_t *out);
+lsarith_errno_t LSArith_solve(const LSMat_t *a, const LSMat_t *b, LSMat_t *out);
+
+const char *LSArith_simd_isa(void);
+
 #endif /* LSARITH_H_INCLUDED_ */
@@ -0,0 +1,45 @@
+#ifndef LSCACHE_H_INCLUDED_
+#define LSCACHE_H_INCLUDED_
+
+#include "lsmat.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct LSCacheEntry_ {
+    struct LSCacheEntry_ *chain;
+    struct LSCacheEntry_ *newer;
+    struct LSCacheEntry_ *older;
+    uint64_t hash;
+    LSMat_t *mat;
+    size_t bytes;
+    // Ids of the matrices the value was computed from.
+    uint64_t *deps;
+    size_t n_deps;
+    size_t key_len;
+    unsigned char key[];
+} LSCacheEntry_t;
+
+typedef struct LSCache_ {
+    LSCacheEntry_t **buckets;
+    size_t n_buckets;
+    size_t n_entries;
+    LSCacheEntry_t *newest;
+    LSCacheEntry_t *oldest;
+    size_t bytes;
+    size_t limit;
+    size_t hits;
+    size_t misses;
+} LSCache_t;
+
+lsmat_errno_t LSCache_init(LSCache_t *restrict cache, size_t limit);
+lsmat_errno_t LSCache_destroy(LSCache_t *restrict cache);
+LSMat_t *LSCache_get(LSCache_t *restrict cache, const void *restrict key, size_t key_len);
+lsmat_errno_t LSCache_put(LSCache_t *restrict cache, const void *restrict key, size_t key_len,
+                          const uint64_t *restrict deps, size_t n_deps, LSMat_t *restrict mat,
+                          size_t bytes);
+void LSCache_set_limit(LSCache_t *restrict cache, size_t limit);
+void LSCache_clear(LSCache_t *restrict cache);
+void LSCache_drop_id(LSCache_t *restrict cache, uint64_t id);
+
+#endif /* LSCACHE_H_INCLUDED_ */
@@ -0,0 +1,40 @@
+#ifndef LSCONC_H_INCLUDED_
+#define LSCONC_H_INCLUDED_
+
+#include "lsmat.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#define LSMAT_CONC_EPOCHS 3u
+#define LSMAT_CONC_LINE 64u
+
+typedef struct LSMatConcReader_ {
+    atomic_uint_least64_t epoch;
+    char pad[LSMAT_CONC_LINE - sizeof(atomic_uint_least64_t)];
+} LSMatConcReader_t;
+
+typedef struct LSMatConc_ {
+    LSMat_t *mat;
+    size_t n_stripes;
+    mtx_t *row_locks;
+    mtx_t *col_locks;
+    mtx_t lock;
+    LSMatConcReader_t *readers;
+    size_t n_readers;
+    atomic_uint_least64_t epoch;
+    LSMatCell_t *retired[LSMAT_CONC_EPOCHS];
+    size_t n_retired;
+} LSMatConc_t;
+
+lsmat_errno_t LSMatConc_init(LSMatConc_t *restrict conc, LSMat_t *restrict mat, size_t n_stripes,
+                             size_t n_readers);
+lsmat_errno_t LSMatConc_destroy(LSMatConc_t *restrict conc);
+void LSMatConc_enter(LSMatConc_t *restrict conc, size_t reader);
+void LSMatConc_leave(LSMatConc_t *restrict conc, size_t reader);
+double LSMatConc_at(const LSMatConc_t *restrict conc, size_t i_0, size_t i_1);
+lsmat_errno_t LSMatConc_set(LSMatConc_t *restrict conc, size_t i_0, size_t i_1, double v);
+
+#endif /* LSCONC_H_INCLUDED_ */
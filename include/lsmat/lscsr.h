@@ -0,0 +1,29 @@
+#ifndef LSCSR_H_INCLUDED_
+#define LSCSR_H_INCLUDED_
+
+#include "lsmat.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct LSMatCsr_ {
+    size_t shape[LSMAT_AXIS_COUNT_];
+    lsmat_axis_t major;
+    size_t nnz;
+    size_t *ptr;
+    size_t *idx;
+    double *v;
+    void *map;
+    size_t map_len;
+} LSMatCsr_t;
+
+LSMatCsr_t *LSMatCsr_new(size_t shape_0, size_t shape_1, lsmat_axis_t major, size_t nnz);
+lsmat_errno_t LSMatCsr_free(LSMatCsr_t *restrict csr);
+double LSMatCsr_at(const LSMatCsr_t *restrict csr, size_t i_0, size_t i_1);
+LSMatCsr_t *LSMatCsr_transcode(const LSMatCsr_t *restrict csr);
+LSMatCsr_t *LSMat_freeze(const LSMat_t *restrict mat, lsmat_axis_t major);
+LSMat_t *LSMatCsr_thaw(const LSMatCsr_t *restrict csr);
+lsmat_errno_t LSMatCsr_save(const LSMatCsr_t *restrict csr, const char *restrict path);
+LSMatCsr_t *LSMatCsr_load(const char *restrict path);
+
+#endif /* LSCSR_H_INCLUDED_ */
@@ -1,6 +1,7 @@
 #ifndef LSMAT_H_INCLUDED_
 #define LSMAT_H_INCLUDED_
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -8,8 +9,8 @@
 typedef void (*lsmat_alloc_hook_t)(void *);
 typedef void (*lsmat_free_hook_t)(void *);
 
-extern lsmat_alloc_hook_t lsmat_alloc_hook_;
-extern lsmat_free_hook_t lsmat_free_hook_;
+extern _Atomic(lsmat_alloc_hook_t) lsmat_alloc_hook_;
+extern _Atomic(lsmat_free_hook_t) lsmat_free_hook_;
 
 typedef enum lsmat_errno_ {
     LSMAT_OK,
@@ -17,51 +18,156 @@ typedef enum lsmat_errno_ {
     LSMAT_E_DUP,
 } lsmat_errno_t;
 
+typedef enum lsmat_dup_ {
+    LSMAT_DUP_SUM,
+    LSMAT_DUP_REJECT,
+} lsmat_dup_t;
+
 typedef enum lsmat_axis_ {
     LSMAT_AXIS_0 = 0u,
     LSMAT_AXIS_1,
     LSMAT_AXIS_COUNT_,
 } lsmat_axis_t;
 
+#ifdef LSMAT_COMPACT_INDEX
+typedef uint32_t lsmat_idx_t;
+#define LSMAT_IDX_MAX UINT32_MAX
+#else
+typedef size_t lsmat_idx_t;
+#define LSMAT_IDX_MAX SIZE_MAX
+#endif
+
 typedef struct LSMat_AxisConn_ {
-    size_t i;
     struct LSMatCell_ *next;
+#ifndef LSMAT_SINGLY_LINKED
     struct LSMatCell_ *prev;
+#endif
 } LSMat_AxisConn_t;
 
 typedef struct LSMatCell_ {
     LSMat_AxisConn_t axes[LSMAT_AXIS_COUNT_];
+    lsmat_idx_t idx[LSMAT_AXIS_COUNT_];
     double v;
 } LSMatCell_t;
 
 size_t LSMatCell_idx_of(const LSMatCell_t *restrict cell, lsmat_axis_t axis);
+void LSMatCell_set_idx(LSMatCell_t *restrict cell, lsmat_axis_t axis, size_t i);
 LSMatCell_t *LSMatCell_succ_of(const LSMatCell_t *restrict cell, lsmat_axis_t axis);
 LSMatCell_t **LSMatCell_ref_succ_of(LSMatCell_t *restrict cell, lsmat_axis_t axis);
+#ifndef LSMAT_SINGLY_LINKED
 LSMatCell_t *LSMatCell_prec_of(const LSMatCell_t *restrict cell, lsmat_axis_t axis);
 LSMatCell_t **LSMatCell_ref_prec_of(LSMatCell_t *restrict cell, lsmat_axis_t axis);
+#endif
+
+typedef struct LSMatSlab_ {
+    struct LSMatSlab_ *next;
+    size_t cap;
+    size_t used;
+    LSMatCell_t cells[];
+} LSMatSlab_t;
+
+typedef struct LSMatArena_ {
+    LSMatSlab_t *slabs;
+    LSMatCell_t *free_cells;
+    // Written by the owner only; other threads may read it at any time.
+    atomic_size_t n_free;
+} LSMatArena_t;
+
+lsmat_errno_t LSMatArena_init(LSMatArena_t *restrict arena);
+lsmat_errno_t LSMatArena_destroy(LSMatArena_t *restrict arena);
+LSMatCell_t *LSMatArena_alloc(LSMatArena_t *restrict arena);
+void LSMatArena_recycle(LSMatArena_t *restrict arena, LSMatCell_t *restrict cell);
+lsmat_errno_t LSMatArena_adopt(LSMatArena_t *restrict dst, LSMatArena_t *restrict src);
 
 typedef struct LSMatHead_ {
     LSMatCell_t *first_cell;
+    LSMatCell_t *last_cell;
+    LSMatCell_t *cursor;
+    size_t len;
+    struct LSMatSkip_ *index;
+    double *dense;
 } LSMatHead_t;
 
 lsmat_errno_t LSMatHead_init(LSMatHead_t *restrict head);
-lsmat_errno_t LSMatHead_destroy(LSMatHead_t *restrict head, lsmat_axis_t axis);
+lsmat_errno_t LSMatHead_destroy(LSMatHead_t *restrict head, LSMatArena_t *restrict arena,
+                                lsmat_axis_t axis);
 LSMatCell_t *LSMatHead_cell_at(const LSMatHead_t *restrict head, size_t i, lsmat_axis_t axis);
+size_t LSMatHead_index_bytes(const LSMatHead_t *restrict head);
+LSMatCell_t *LSMatHead_seek(LSMatHead_t *restrict head, size_t i, lsmat_axis_t axis);
 lsmat_errno_t LSMatHead_insert(LSMatHead_t *restrict head, LSMatCell_t *restrict cell,
                                lsmat_axis_t axis, LSMatCell_t **restrict out_dup);
+lsmat_errno_t LSMatHead_append(LSMatHead_t *restrict head, LSMatCell_t *restrict cell,
+                               lsmat_axis_t axis);
 lsmat_errno_t LSMatHead_remove(LSMatHead_t *restrict head, LSMatCell_t *restrict cell,
                                lsmat_axis_t axis);
 
 typedef struct LSMat_ {
     size_t shape[LSMAT_AXIS_COUNT_];
     LSMatHead_t *heads[LSMAT_AXIS_COUNT_];
+    LSMatArena_t arena;
+    uint64_t *dense_rows;
+    uint64_t *dense_groups;
+    size_t n_dense_rows;
+    size_t n_dense_words;
+    uint64_t id;
+    uint64_t version;
+    atomic_size_t refs;
 } LSMat_t;
 
 LSMat_t *LSMat_new(size_t len_0, size_t len_1);
 lsmat_errno_t LSMat_free(LSMat_t *restrict mat);
+LSMat_t *LSMat_retain(LSMat_t *restrict mat);
+void LSMat_set_hooks(lsmat_alloc_hook_t alloc_hook, lsmat_free_hook_t free_hook);
+bool LSMat_is_shared(const LSMat_t *restrict mat);
 double LSMat_at(const LSMat_t *restrict mat, size_t i_0, size_t i_1);
 lsmat_errno_t LSMat_set(LSMat_t *restrict mat, size_t i_0, size_t i_1, double v);
 lsmat_errno_t LSMat_zero(LSMat_t *restrict mat);
+lsmat_errno_t LSMat_adapt(LSMat_t *restrict mat);
+lsmat_errno_t LSMat_prune(LSMat_t *restrict mat);
+size_t LSMat_next_dense_row(const LSMat_t *restrict mat, size_t i);
+// idx must be strictly ascending and within the row; otherwise LSMAT_E_GEN.
+lsmat_errno_t LSMat_accumulate_row(LSMat_t *restrict mat, size_t i, double alpha,
+                                   const size_t *restrict idx, const double *restrict v, size_t n,
+                                   bool prune);
+lsmat_errno_t LSMat_build(LSMat_t *restrict mat, const size_t *restrict i_0,
+                          const size_t *restrict i_1, const double *restrict v, size_t n,
+                          lsmat_dup_t dup);
+
+typedef struct LSMatWriter_ {
+    LSMat_t *mat;
+    LSMatArena_t arena;
+    LSMatCell_t **col_first;
+    LSMatCell_t **col_last;
+    size_t *col_len;
+    size_t *row_idx;
+    double *row_v;
+    size_t row_len;
+    size_t *dense_rows;
+    size_t n_dense_rows;
+    size_t cap_dense_rows;
+} LSMatWriter_t;
+
+lsmat_errno_t LSMatWriter_init(LSMatWriter_t *restrict w, LSMat_t *restrict mat);
+lsmat_errno_t LSMatWriter_destroy(LSMatWriter_t *restrict w);
+lsmat_errno_t LSMatWriter_put(LSMatWriter_t *restrict w, size_t j, double v);
+lsmat_errno_t LSMatWriter_end_row(LSMatWriter_t *restrict w, size_t i);
+lsmat_errno_t LSMat_stitch(LSMat_t *restrict mat, const LSMatWriter_t *restrict writers,
+                           size_t n_writers, size_t col_begin, size_t col_end);
+lsmat_errno_t LSMat_adopt(LSMat_t *restrict mat, LSMatWriter_t *restrict writers,
+                          size_t n_writers);
+
+typedef struct LSMatIter_ {
+    const LSMat_t *mat;
+    lsmat_axis_t axis;
+    size_t line;
+    const LSMatCell_t *cell;
+    const double *dense;
+    size_t pos;
+} LSMatIter_t;
+
+void LSMatIter_init(LSMatIter_t *restrict it, const LSMat_t *restrict mat, lsmat_axis_t axis,
+                    size_t line);
+bool LSMatIter_next(LSMatIter_t *restrict it, size_t *restrict out_idx, double *restrict out_v);
 
 typedef struct LSMatView_ {
     lsmat_axis_t axes_mapping[LSMAT_AXIS_COUNT_];
@@ -72,6 +178,8 @@ LSMatView_t LSMatView_from(LSMat_t *restrict mat);
 size_t LSMatView_shape_of(const LSMatView_t view, lsmat_axis_t axis);
 double LSMatView_at(const LSMatView_t view, size_t i_0, size_t i_1);
 lsmat_errno_t LSMatView_set(const LSMatView_t view, size_t i_0, size_t i_1, double v);
+void LSMatIter_init_view(LSMatIter_t *restrict it, const LSMatView_t view, lsmat_axis_t axis,
+                         size_t line);
 LSMat_t *LSMatView_realize(const LSMatView_t view);
 
 #endif /* LSMAT_H_INCLUDED_ */
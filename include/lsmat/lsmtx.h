@@ -0,0 +1,22 @@
+#ifndef LSMTX_H_INCLUDED_
+#define LSMTX_H_INCLUDED_
+
+#include "lsmat.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef void (*lsmtx_progress_t)(void *ctx, size_t done, size_t total);
+
+typedef struct LSMatMtxStats_ {
+    size_t bytes;
+    size_t entries;
+} LSMatMtxStats_t;
+
+LSMat_t *LSMat_read_mtx(const char *restrict path, lsmtx_progress_t progress, void *ctx,
+                        LSMatMtxStats_t *restrict stats);
+lsmat_errno_t LSMat_write_mtx(const LSMat_t *restrict mat, const char *restrict path,
+                              lsmtx_progress_t progress, void *ctx,
+                              LSMatMtxStats_t *restrict stats);
+
+#endif /* LSMTX_H_INCLUDED_ */
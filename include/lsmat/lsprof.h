@@ -0,0 +1,37 @@
+#ifndef LSPROF_H_INCLUDED_
+#define LSPROF_H_INCLUDED_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define LSPROF_BUCKETS 32u
+
+typedef enum lsprof_counter_ {
+    LSPROF_CELLS_TRAVERSED,
+    LSPROF_CELL_ALLOCS,
+    LSPROF_SLAB_ALLOCS,
+    LSPROF_INSERTS,
+    LSPROF_REMOVALS,
+    LSPROF_MERGE_STEPS,
+    LSPROF_COUNTER_COUNT_,
+} lsprof_counter_t;
+
+typedef struct LSProfFn_ {
+    const char *name;
+    uint64_t calls;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t hist[LSPROF_BUCKETS];
+} LSProfFn_t;
+
+typedef void (*lsprof_visit_t)(void *ctx, const LSProfFn_t *fn);
+
+bool LSProf_enabled(void);
+const char *LSProf_counter_name(lsprof_counter_t counter);
+uint64_t LSProf_counter(lsprof_counter_t counter);
+void LSProf_each_fn(lsprof_visit_t visit, void *ctx);
+void LSProf_reset(void);
+uint64_t LSProf_bucket_floor(size_t bucket);
+
+#endif /* LSPROF_H_INCLUDED_ */
@@ -0,0 +1,29 @@
+#ifndef LSRAND_H_INCLUDED_
+#define LSRAND_H_INCLUDED_
+
+#include "lsmat.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef enum lsrand_pattern_ {
+    LSRAND_UNIFORM,
+    LSRAND_BANDED,
+    LSRAND_POWERLAW,
+    LSRAND_PATTERN_COUNT_,
+} lsrand_pattern_t;
+
+typedef struct LSRand_ {
+    uint64_t key;
+    uint64_t counter;
+} LSRand_t;
+
+void LSRand_init(LSRand_t *restrict rng, uint64_t seed, uint64_t stream);
+uint64_t LSRand_at(const LSRand_t *restrict rng, uint64_t counter);
+uint64_t LSRand_next(LSRand_t *restrict rng);
+double LSRand_unit(LSRand_t *restrict rng);
+
+lsmat_errno_t LSMat_fill_random(LSMat_t *restrict mat, double density, uint64_t seed,
+                                lsrand_pattern_t pattern);
+
+#endif /* LSRAND_H_INCLUDED_ */
@@ -0,0 +1,30 @@
+#ifndef LSSTATS_H_INCLUDED_
+#define LSSTATS_H_INCLUDED_
+
+#include "lsmat.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define LSMAT_STATS_BINS 24u
+
+typedef struct LSMatStats_ {
+    size_t shape[LSMAT_AXIS_COUNT_];
+    size_t nnz;
+    size_t n_dense_rows;
+    size_t bytes_struct;
+    size_t bytes_heads;
+    size_t bytes_cells;
+    size_t bytes_slack;
+    size_t bytes_dense;
+    size_t bytes_index;
+    size_t max_len[LSMAT_AXIS_COUNT_];
+    double mean_len[LSMAT_AXIS_COUNT_];
+    size_t hist[LSMAT_AXIS_COUNT_][LSMAT_STATS_BINS];
+} LSMatStats_t;
+
+lsmat_errno_t LSMat_stats(const LSMat_t *restrict mat, LSMatStats_t *restrict out);
+size_t LSMatStats_bin_floor(size_t bin);
+size_t LSMatStats_bytes(const LSMatStats_t *restrict stats);
+
+#endif /* LSSTATS_H_INCLUDED_ */
@@ -0,0 +1,928 @@
+#ifdef __linux__
+#define _DEFAULT_SOURCE
+#endif
+
+#include "lsmat/lsarith.h"
+#include "lsmat/lsconc.h"
+#include "lsmat/lscsr.h"
+#include "lsmat/lsmat.h"
+#include "lsmat/lsrand.h"
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#define get_malloc_size _msize
+#else
+#define get_malloc_size malloc_usable_size
+#endif
+
+#define MAX_LIST 16
+#define N_VECS 8
+#define MAX_POS ((size_t)1 << 16)
+#define CONC_KERNEL "LSMatConc_at"
+#define CONC_BATCH 64
+#define CONC_STRIPES 64
+
+#define ARR_LIT_LEN_(a_) ((sizeof(a_)) / (sizeof(a_[0])))
+
+typedef struct timespec timespec_t;
+
+typedef enum pattern_ {
+    PAT_RANDOM,
+    PAT_BANDED,
+    PAT_POWERLAW,
+    PAT_IDENTITY,
+    PAT_COUNT_,
+} pattern_t;
+
+static const char *const PATTERN_NAMES[PAT_COUNT_] = {
+    [PAT_RANDOM] = "random",
+    [PAT_BANDED] = "banded",
+    [PAT_POWERLAW] = "powerlaw",
+    [PAT_IDENTITY] = "identity",
+};
+
+// What nnz/s is counted against.
+typedef enum work_ {
+    WORK_A,
+    WORK_AB,
+    WORK_POS,
+} work_t;
+
+typedef struct BenchCase_ {
+    size_t n;
+    LSMat_t *a;
+    LSMat_t *b;
+    LSMatCsr_t *csr_a;
+    LSMatCsr_t *csr_b;
+    size_t nnz_a;
+    size_t nnz_b;
+    LSMat_t *out;
+    // Scratch copy for kernels that write to their operand.
+    LSMat_t *work;
+    double *x;
+    double *y;
+    size_t *pos_i;
+    size_t *pos_j;
+    double *pos_v;
+    size_t n_pos;
+    double sink;
+} BenchCase_t;
+
+typedef struct BenchKernel_ {
+    const char *name;
+    // Untimed, around every timed run.
+    bool (*prepare)(BenchCase_t *c);
+    void (*finish)(BenchCase_t *c);
+    bool (*run)(BenchCase_t *c);
+    work_t work;
+    // Subject to the flop limit.
+    bool mul;
+} BenchKernel_t;
+
+typedef struct BenchOpts_ {
+    size_t sizes[MAX_LIST];
+    size_t n_sizes;
+    double densities[MAX_LIST];
+    size_t n_densities;
+    bool patterns[PAT_COUNT_];
+    const char *kernels;
+    double min_time;
+    double max_flops;
+    size_t n_threads;
+    uint64_t seed;
+    const char *out_path;
+    size_t readers[MAX_LIST];
+    size_t n_readers;
+} BenchOpts_t;
+
+/*
+ * Readers look up the case positions in batches, each batch inside one
+ * read-side section, while a single writer keeps setting and clearing them.
+ */
+typedef struct BenchConc_ {
+    LSMatConc_t conc;
+    const BenchCase_t *c;
+    atomic_bool go;
+    atomic_bool stop;
+    atomic_size_t n_ready;
+} BenchConc_t;
+
+typedef struct BenchConcArg_ {
+    BenchConc_t *bc;
+    size_t reader;
+    uint64_t ops;
+    double sink;
+} BenchConcArg_t;
+
+typedef struct BenchCounters_ {
+    int fd_refs;
+    int fd_misses;
+} BenchCounters_t;
+
+static atomic_size_t allocated_size = 0;
+static atomic_size_t peak_size = 0;
+
+static void alloc_hook(void *ptr) {
+    const size_t size = get_malloc_size(ptr);
+    const size_t now = atomic_fetch_add(&allocated_size, size) + size;
+    size_t peak = atomic_load(&peak_size);
+    while (now > peak && !atomic_compare_exchange_weak(&peak_size, &peak, now)) {
+        ;
+    }
+}
+
+static void free_hook(void *ptr) {
+    allocated_size -= get_malloc_size(ptr);
+}
+
+static double timespec_to_sec(timespec_t t) {
+    return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+static double now_sec(void) {
+    timespec_t t;
+    timespec_get(&t, TIME_UTC);
+    return timespec_to_sec(t);
+}
+
+// xorshift64*; reproducible across platforms, unlike rand().
+static uint64_t next_rand(uint64_t *restrict state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+static double next_unit(uint64_t *restrict state) {
+    return (double)(next_rand(state) >> 11) / (double)((uint64_t)1 << 53);
+}
+
+/*
+ * Counters are read around the timed runs only. Kernels, containers and
+ * unprivileged users often cannot open them; the record then holds null.
+ */
+static int counter_open(uint64_t config) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    (void)config;
+    return -1;
+#endif
+}
+
+static void counters_open(BenchCounters_t *restrict ctr) {
+#ifdef __linux__
+    ctr->fd_refs = counter_open(PERF_COUNT_HW_CACHE_REFERENCES);
+    ctr->fd_misses = counter_open(PERF_COUNT_HW_CACHE_MISSES);
+    if (ctr->fd_refs < 0 || ctr->fd_misses < 0) {
+        if (ctr->fd_refs >= 0) {
+            close(ctr->fd_refs);
+        }
+        if (ctr->fd_misses >= 0) {
+            close(ctr->fd_misses);
+        }
+        ctr->fd_refs = -1;
+        ctr->fd_misses = -1;
+    }
+#else
+    ctr->fd_refs = -1;
+    ctr->fd_misses = -1;
+#endif
+}
+
+static void counters_close(BenchCounters_t *restrict ctr) {
+#ifdef __linux__
+    if (ctr->fd_refs >= 0) {
+        close(ctr->fd_refs);
+        close(ctr->fd_misses);
+    }
+#endif
+    ctr->fd_refs = -1;
+    ctr->fd_misses = -1;
+}
+
+static void counters_toggle(const BenchCounters_t *restrict ctr, bool on) {
+#ifdef __linux__
+    if (ctr->fd_refs >= 0) {
+        const unsigned long req = on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE;
+        ioctl(ctr->fd_refs, req, 0);
+        ioctl(ctr->fd_misses, req, 0);
+    }
+#else
+    (void)ctr;
+    (void)on;
+#endif
+}
+
+static void counters_reset(const BenchCounters_t *restrict ctr) {
+#ifdef __linux__
+    if (ctr->fd_refs >= 0) {
+        ioctl(ctr->fd_refs, PERF_EVENT_IOC_RESET, 0);
+        ioctl(ctr->fd_misses, PERF_EVENT_IOC_RESET, 0);
+    }
+#else
+    (void)ctr;
+#endif
+}
+
+static bool counters_read(const BenchCounters_t *restrict ctr, uint64_t *restrict refs,
+                          uint64_t *restrict misses) {
+#ifdef __linux__
+    return ctr->fd_refs >= 0 && read(ctr->fd_refs, refs, sizeof(*refs)) == sizeof(*refs) &&
+           read(ctr->fd_misses, misses, sizeof(*misses)) == sizeof(*misses);
+#else
+    (void)ctr;
+    (void)refs;
+    (void)misses;
+    return false;
+#endif
+}
+
+static size_t nnz_of(const LSMat_t *restrict mat) {
+    size_t nnz = 0;
+    for (size_t i = 0; i < mat->shape[LSMAT_AXIS_0]; i++) {
+        nnz += mat->heads[LSMAT_AXIS_0][i].len;
+    }
+    return nnz;
+}
+
+/*
+ * Square matrices of the given pattern, holding about density * n * n
+ * entries as laid out by LSMat_fill_random. Identity ignores density.
+ */
+static LSMat_t *gen_matrix(pattern_t pattern, size_t n, double density, uint64_t seed) {
+    static const lsrand_pattern_t RAND_PATTERNS[PAT_COUNT_] = {
+        [PAT_RANDOM] = LSRAND_UNIFORM,
+        [PAT_BANDED] = LSRAND_BANDED,
+        [PAT_POWERLAW] = LSRAND_POWERLAW,
+    };
+    LSMat_t *mat = LSMat_new(n, n);
+    if (mat == NULL) {
+        return NULL;
+    }
+    lsmat_errno_t err = LSMAT_OK;
+    if (pattern == PAT_IDENTITY) {
+        for (size_t i = 0; err == LSMAT_OK && i < n; i++) {
+            err = LSMat_set(mat, i, i, 1.);
+        }
+    } else {
+        err = LSMat_fill_random(mat, density, seed, RAND_PATTERNS[pattern]);
+    }
+    if (err != LSMAT_OK) {
+        LSMat_free(mat);
+        return NULL;
+    }
+    return mat;
+}
+
+static bool prepare_copy(BenchCase_t *c) {
+    c->work = LSMatView_realize(LSMatView_from(c->a));
+    return c->work != NULL;
+}
+
+static void finish_free(BenchCase_t *c) {
+    if (c->work != NULL) {
+        LSMat_free(c->work);
+        c->work = NULL;
+    }
+}
+
+static bool run_set(BenchCase_t *c) {
+    for (size_t k = 0; k < c->n_pos; k++) {
+        if (LSMat_set(c->work, c->pos_i[k], c->pos_j[k], c->pos_v[k]) != LSMAT_OK) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool run_at(BenchCase_t *c) {
+    double acc = 0.;
+    for (size_t k = 0; k < c->n_pos; k++) {
+        acc += LSMat_at(c->a, c->pos_i[k], c->pos_j[k]);
+    }
+    c->sink += acc;
+    return true;
+}
+
+static bool run_zero(BenchCase_t *c) {
+    return LSMat_zero(c->work) == LSMAT_OK;
+}
+
+static bool run_realize(BenchCase_t *c) {
+    c->work = LSMatView_realize(LSMatView_from(c->a));
+    return c->work != NULL;
+}
+
+static bool run_realize_T(BenchCase_t *c) {
+    c->work = LSMatView_realize(LSArith_mat_T(c->a));
+    return c->work != NULL;
+}
+
+static bool run_mat_add(BenchCase_t *c) {
+    return LSArith_mat_add(c->a, c->b, c->out) == LSARITH_OK;
+}
+
+static bool run_mat_sub(BenchCase_t *c) {
+    return LSArith_mat_sub(c->a, c->b, c->out) == LSARITH_OK;
+}
+
+static bool run_mat_mul(BenchCase_t *c) {
+    return LSArith_mat_mul(c->a, c->b, c->out) == LSARITH_OK;
+}
+
+static bool run_mat_T(BenchCase_t *c) {
+    const LSMatView_t t = LSArith_mat_T(c->a);
+    c->sink += (double)LSMatView_shape_of(t, LSMAT_AXIS_0);
+    return true;
+}
+
+static bool run_mat_scale(BenchCase_t *c) {
+    return LSArith_mat_scale(c->work, 2., false) == LSARITH_OK;
+}
+
+static bool run_mat_axpy(BenchCase_t *c) {
+    return LSArith_mat_axpy(c->work, 0.5, c->b, false) == LSARITH_OK;
+}
+
+static bool run_mat_add_assign(BenchCase_t *c) {
+    return LSArith_mat_add_assign(c->work, c->b, false) == LSARITH_OK;
+}
+
+static bool run_mat_sub_assign(BenchCase_t *c) {
+    return LSArith_mat_sub_assign(c->work, c->b, false) == LSARITH_OK;
+}
+
+static bool run_mat_mul_acc(BenchCase_t *c) {
+    return LSArith_mat_mul_acc(c->work, 1., c->a, c->b, false) == LSARITH_OK;
+}
+
+static bool run_view_add(BenchCase_t *c) {
+    return LSArith_view_add(LSMatView_from(c->a), LSArith_mat_T(c->b), c->out) == LSARITH_OK;
+}
+
+static bool run_view_sub(BenchCase_t *c) {
+    return LSArith_view_sub(LSMatView_from(c->a), LSArith_mat_T(c->b), c->out) == LSARITH_OK;
+}
+
+static bool run_view_mul(BenchCase_t *c) {
+    return LSArith_view_mul(LSMatView_from(c->a), LSArith_mat_T(c->b), c->out) == LSARITH_OK;
+}
+
+static bool run_view_sum(BenchCase_t *c) {
+    const LSMatView_t views[] = {LSMatView_from(c->a), LSMatView_from(c->b), LSArith_mat_T(c->a)};
+    const double coefs[] = {1., -2., 0.5};
+    return LSArith_view_sum(views, coefs, ARR_LIT_LEN_(views), c->out) == LSARITH_OK;
+}
+
+static bool run_csr_add(BenchCase_t *c) {
+    return LSArith_csr_add(c->csr_a, c->csr_b, c->out) == LSARITH_OK;
+}
+
+static bool run_csr_sub(BenchCase_t *c) {
+    return LSArith_csr_sub(c->csr_a, c->csr_b, c->out) == LSARITH_OK;
+}
+
+static bool run_csr_mul(BenchCase_t *c) {
+    return LSArith_csr_mul(c->csr_a, c->csr_b, c->out) == LSARITH_OK;
+}
+
+static bool run_mat_vec(BenchCase_t *c) {
+    return LSArith_mat_vec(c->a, c->x, c->y) == LSARITH_OK;
+}
+
+static bool run_mat_densemat(BenchCase_t *c) {
+    return LSArith_mat_densemat(c->a, c->x, N_VECS, c->y) == LSARITH_OK;
+}
+
+static bool run_csr_vec(BenchCase_t *c) {
+    return LSArith_csr_vec(c->csr_a, c->x, c->y) == LSARITH_OK;
+}
+
+static bool run_csr_densemat(BenchCase_t *c) {
+    return LSArith_csr_densemat(c->csr_a, c->x, N_VECS, c->y) == LSARITH_OK;
+}
+
+static const BenchKernel_t KERNELS[] = {
+    {.name = "LSMat_set", .prepare = prepare_copy, .finish = finish_free, .run = run_set,
+     .work = WORK_POS},
+    {.name = "LSMat_at", .run = run_at, .work = WORK_POS},
+    {.name = "LSMat_zero", .prepare = prepare_copy, .finish = finish_free, .run = run_zero,
+     .work = WORK_A},
+    {.name = "LSMatView_realize", .finish = finish_free, .run = run_realize, .work = WORK_A},
+    {.name = "LSMatView_realize_T", .finish = finish_free, .run = run_realize_T, .work = WORK_A},
+    {.name = "LSArith_mat_add", .run = run_mat_add, .work = WORK_AB},
+    {.name = "LSArith_mat_sub", .run = run_mat_sub, .work = WORK_AB},
+    {.name = "LSArith_mat_mul", .run = run_mat_mul, .work = WORK_AB, .mul = true},
+    {.name = "LSArith_mat_T", .run = run_mat_T, .work = WORK_A},
+    {.name = "LSArith_mat_scale", .prepare = prepare_copy, .finish = finish_free,
+     .run = run_mat_scale, .work = WORK_A},
+    {.name = "LSArith_mat_axpy", .prepare = prepare_copy, .finish = finish_free,
+     .run = run_mat_axpy, .work = WORK_AB},
+    {.name = "LSArith_mat_add_assign", .prepare = prepare_copy, .finish = finish_free,
+     .run = run_mat_add_assign, .work = WORK_AB},
+    {.name = "LSArith_mat_sub_assign", .prepare = prepare_copy, .finish = finish_free,
+     .run = run_mat_sub_assign, .work = WORK_AB},
+    {.name = "LSArith_mat_mul_acc", .prepare = prepare_copy, .finish = finish_free,
+     .run = run_mat_mul_acc, .work = WORK_AB, .mul = true},
+    {.name = "LSArith_view_add", .run = run_view_add, .work = WORK_AB},
+    {.name = "LSArith_view_sub", .run = run_view_sub, .work = WORK_AB},
+    {.name = "LSArith_view_mul", .run = run_view_mul, .work = WORK_AB, .mul = true},
+    {.name = "LSArith_view_sum", .run = run_view_sum, .work = WORK_AB},
+    {.name = "LSArith_csr_add", .run = run_csr_add, .work = WORK_AB},
+    {.name = "LSArith_csr_sub", .run = run_csr_sub, .work = WORK_AB},
+    {.name = "LSArith_csr_mul", .run = run_csr_mul, .work = WORK_AB, .mul = true},
+    {.name = "LSArith_mat_vec", .run = run_mat_vec, .work = WORK_A},
+    {.name = "LSArith_mat_densemat", .run = run_mat_densemat, .work = WORK_A},
+    {.name = "LSArith_csr_vec", .run = run_csr_vec, .work = WORK_A},
+    {.name = "LSArith_csr_densemat", .run = run_csr_densemat, .work = WORK_A},
+};
+
+static void case_destroy(BenchCase_t *restrict c) {
+    if (c->a != NULL) {
+        LSMat_free(c->a);
+    }
+    if (c->b != NULL) {
+        LSMat_free(c->b);
+    }
+    if (c->out != NULL) {
+        LSMat_free(c->out);
+    }
+    LSMatCsr_free(c->csr_a);
+    LSMatCsr_free(c->csr_b);
+    free(c->x);
+    free(c->y);
+    free(c->pos_i);
+    free(c->pos_j);
+    free(c->pos_v);
+    memset(c, 0, sizeof(BenchCase_t));
+}
+
+static bool case_init(BenchCase_t *restrict c, pattern_t pattern, size_t n, double density,
+                      uint64_t seed) {
+    memset(c, 0, sizeof(BenchCase_t));
+    c->n = n;
+    c->a = gen_matrix(pattern, n, density, seed);
+    c->b = gen_matrix(pattern, n, density, seed * 31 + 7);
+    c->out = LSMat_new(n, n);
+    if (c->a == NULL || c->b == NULL || c->out == NULL) {
+        case_destroy(c);
+        return false;
+    }
+    c->csr_a = LSMat_freeze(c->a, LSMAT_AXIS_0);
+    c->csr_b = LSMat_freeze(c->b, LSMAT_AXIS_0);
+    c->nnz_a = nnz_of(c->a);
+    c->nnz_b = nnz_of(c->b);
+    c->x = malloc(n * N_VECS * sizeof(double));
+    c->y = malloc(n * N_VECS * sizeof(double));
+    c->n_pos = c->nnz_a < MAX_POS ? (c->nnz_a > 0 ? c->nnz_a : 1) : MAX_POS;
+    c->pos_i = malloc(c->n_pos * sizeof(size_t));
+    c->pos_j = malloc(c->n_pos * sizeof(size_t));
+    c->pos_v = malloc(c->n_pos * sizeof(double));
+    if (c->csr_a == NULL || c->csr_b == NULL || c->x == NULL || c->y == NULL ||
+        c->pos_i == NULL || c->pos_j == NULL || c->pos_v == NULL) {
+        case_destroy(c);
+        return false;
+    }
+    uint64_t state = seed ^ 0x9e3779b97f4a7c15ull;
+    for (size_t k = 0; k < n * N_VECS; k++) {
+        c->x[k] = next_unit(&state);
+    }
+    for (size_t k = 0; k < c->n_pos; k++) {
+        c->pos_i[k] = next_rand(&state) % n;
+        c->pos_j[k] = next_rand(&state) % n;
+        c->pos_v[k] = next_unit(&state) + 0.5;
+    }
+    return true;
+}
+
+static bool kernel_selected(const char *restrict list, const char *restrict name) {
+    if (list == NULL) {
+        return true;
+    }
+    const size_t len = strlen(name);
+    for (const char *p = list; p != NULL; p = strchr(p, ',')) {
+        p += *p == ',';
+        if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void put_u64_or_null(FILE *restrict f, bool has, uint64_t x) {
+    if (has) {
+        fprintf(f, "%llu", (unsigned long long)x);
+    } else {
+        fputs("null", f);
+    }
+}
+
+/*
+ * Time one kernel on one case until min_time has been spent in timed runs,
+ * and print its JSON record. Returns false if the kernel failed.
+ */
+static bool bench_kernel(FILE *restrict f, const BenchOpts_t *restrict opts,
+                         const BenchKernel_t *restrict k, BenchCase_t *restrict c,
+                         pattern_t pattern, double density, bool *restrict first) {
+    const double flops = (double)c->nnz_a * (double)c->nnz_b / (double)c->n;
+    if (k->mul && flops > opts->max_flops) {
+        return true;
+    }
+    BenchCounters_t ctr;
+    counters_open(&ctr);
+    counters_reset(&ctr);
+    size_t peak = 0;
+    double spent = 0.;
+    size_t reps = 0;
+    bool ok = true;
+    while (ok && (reps == 0 || spent < opts->min_time)) {
+        if (k->prepare != NULL && !k->prepare(c)) {
+            ok = false;
+            break;
+        }
+        // Peak bytes are the run's own, over what prepare left allocated.
+        const size_t base = atomic_load(&allocated_size);
+        atomic_store(&peak_size, base);
+        counters_toggle(&ctr, true);
+        const double t0 = now_sec();
+        ok = k->run(c);
+        const double t1 = now_sec();
+        counters_toggle(&ctr, false);
+        spent += t1 - t0;
+        peak = atomic_load(&peak_size) - base > peak ? atomic_load(&peak_size) - base : peak;
+        reps++;
+        if (k->finish != NULL) {
+            k->finish(c);
+        }
+    }
+    uint64_t refs = 0;
+    uint64_t misses = 0;
+    const bool has_ctr = counters_read(&ctr, &refs, &misses);
+    counters_close(&ctr);
+    if (!ok) {
+        fprintf(stderr, "lsmat_bench: %s failed on %s n=%zu density=%g\n", k->name,
+                PATTERN_NAMES[pattern], c->n, density);
+        return false;
+    }
+    const size_t ops = k->work == WORK_POS ? c->n_pos : 1;
+    const size_t work = k->work == WORK_POS ? c->n_pos
+                        : k->work == WORK_AB ? c->nnz_a + c->nnz_b
+                                             : c->nnz_a;
+    const double ns_per_op = spent * 1e9 / (double)reps / (double)ops;
+    const double nnz_per_sec = spent > 0. ? (double)work * (double)reps / spent : 0.;
+    fprintf(f,
+            "%s\n    {\"kernel\":\"%s\",\"pattern\":\"%s\",\"n\":%zu,\"density\":%g,"
+            "\"nnz\":%zu,\"reps\":%zu,\"ops_per_rep\":%zu,\"ns_per_op\":%.3f,"
+            "\"nnz_per_sec\":%.6g,\"peak_bytes\":%zu,\"cache_refs\":",
+            *first ? "" : ",", k->name, PATTERN_NAMES[pattern], c->n, density, c->nnz_a, reps,
+            ops, ns_per_op, nnz_per_sec, peak);
+    put_u64_or_null(f, has_ctr, refs / reps);
+    fputs(",\"cache_misses\":", f);
+    put_u64_or_null(f, has_ctr, misses / reps);
+    fputc('}', f);
+    fflush(f);
+    *first = false;
+    return true;
+}
+
+static void conc_wait_go(BenchConc_t *restrict bc) {
+    atomic_fetch_add(&bc->n_ready, 1);
+    while (!atomic_load(&bc->go)) {
+        thrd_yield();
+    }
+}
+
+static int conc_reader(void *arg) {
+    BenchConcArg_t *const a = arg;
+    BenchConc_t *const bc = a->bc;
+    const BenchCase_t *const c = bc->c;
+    size_t k = a->reader * (c->n_pos / 8 + 1) % c->n_pos;
+    conc_wait_go(bc);
+    while (!atomic_load_explicit(&bc->stop, memory_order_relaxed)) {
+        LSMatConc_enter(&bc->conc, a->reader);
+        for (size_t m = 0; m < CONC_BATCH; m++) {
+            a->sink += LSMatConc_at(&bc->conc, c->pos_i[k], c->pos_j[k]);
+            k = k + 1 < c->n_pos ? k + 1 : 0;
+        }
+        LSMatConc_leave(&bc->conc, a->reader);
+        a->ops += CONC_BATCH;
+    }
+    return 0;
+}
+
+static int conc_writer(void *arg) {
+    BenchConcArg_t *const a = arg;
+    BenchConc_t *const bc = a->bc;
+    const BenchCase_t *const c = bc->c;
+    size_t k = 0;
+    conc_wait_go(bc);
+    while (!atomic_load_explicit(&bc->stop, memory_order_relaxed)) {
+        // Every other pass clears what the one before set, so cells keep
+        // being retired and reclaimed.
+        const double v = a->ops / c->n_pos % 2 == 0 ? c->pos_v[k] : 0.;
+        if (LSMatConc_set(&bc->conc, c->pos_i[k], c->pos_j[k], v) != LSMAT_OK) {
+            return 1;
+        }
+        k = k + 1 < c->n_pos ? k + 1 : 0;
+        a->ops++;
+    }
+    return 0;
+}
+
+/*
+ * Run n_readers lookup threads against one writer for min_time seconds on a
+ * copy of the left operand, and print the JSON record.
+ */
+static bool bench_conc(FILE *restrict f, const BenchOpts_t *restrict opts,
+                       const BenchCase_t *restrict c, pattern_t pattern, double density,
+                       size_t n_readers, bool *restrict first) {
+    BenchConc_t bc = {.c = c};
+    atomic_init(&bc.go, false);
+    atomic_init(&bc.stop, false);
+    atomic_init(&bc.n_ready, 0);
+    LSMat_t *const mat = LSMatView_realize(LSMatView_from(c->a));
+    BenchConcArg_t *const args = calloc(n_readers + 1, sizeof(BenchConcArg_t));
+    thrd_t *const threads = calloc(n_readers + 1, sizeof(thrd_t));
+    if (mat == NULL || args == NULL || threads == NULL ||
+        LSMatConc_init(&bc.conc, mat, CONC_STRIPES, n_readers) != LSMAT_OK) {
+        if (mat != NULL) {
+            LSMat_free(mat);
+        }
+        free(args);
+        free(threads);
+        return false;
+    }
+    size_t n_started = 0;
+    bool ok = true;
+    for (; ok && n_started <= n_readers; n_started++) {
+        args[n_started] = (BenchConcArg_t){.bc = &bc, .reader = n_started};
+        ok = thrd_create(threads + n_started, n_started < n_readers ? conc_reader : conc_writer,
+                         args + n_started) == thrd_success;
+    }
+    n_started -= !ok;
+    while (ok && atomic_load(&bc.n_ready) < n_started) {
+        thrd_yield();
+    }
+    const double start = now_sec();
+    atomic_store(&bc.go, true);
+    if (ok) {
+        timespec_t nap = {
+            .tv_sec = (time_t)opts->min_time,
+            .tv_nsec = (long)((opts->min_time - (double)(time_t)opts->min_time) * 1e9),
+        };
+        thrd_sleep(&nap, NULL);
+    }
+    atomic_store(&bc.stop, true);
+    for (size_t t = 0; t < n_started; t++) {
+        int res = 0;
+        thrd_join(threads[t], &res);
+        ok = ok && res == 0;
+    }
+    const double spent = now_sec() - start;
+    LSMatConc_destroy(&bc.conc);
+    LSMat_free(mat);
+    if (!ok) {
+        free(args);
+        free(threads);
+        fprintf(stderr, "lsmat_bench: %s failed on %s n=%zu density=%g\n", CONC_KERNEL,
+                PATTERN_NAMES[pattern], c->n, density);
+        return false;
+    }
+    uint64_t lookups = 0;
+    for (size_t t = 0; t < n_readers; t++) {
+        lookups += args[t].ops;
+    }
+    const uint64_t writes = args[n_readers].ops;
+    fprintf(f,
+            "%s\n    {\"kernel\":\"%s\",\"pattern\":\"%s\",\"n\":%zu,\"density\":%g,"
+            "\"nnz\":%zu,\"readers\":%zu,\"ns_per_op\":%.3f,\"lookups_per_sec\":%.6g,"
+            "\"writes_per_sec\":%.6g}",
+            *first ? "" : ",", CONC_KERNEL, PATTERN_NAMES[pattern], c->n, density, c->nnz_a,
+            n_readers, lookups > 0 ? spent * 1e9 * (double)n_readers / (double)lookups : 0.,
+            (double)lookups / spent, (double)writes / spent);
+    fflush(f);
+    *first = false;
+    free(args);
+    free(threads);
+    return true;
+}
+
+static size_t parse_list(const char *restrict s, double *restrict out, size_t cap) {
+    size_t n = 0;
+    char *end = NULL;
+    while (n < cap && *s != '\0') {
+        out[n] = strtod(s, &end);
+        if (end == s || out[n] <= 0.) {
+            return 0;
+        }
+        n++;
+        s = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0') {
+            return 0;
+        }
+    }
+    return n;
+}
+
+static void usage(const char *restrict argv0) {
+    printf("Usage: %s [options]\n", argv0);
+    puts("  -n SIZES      comma-separated matrix sizes (default 256,1024,4096)");
+    puts("  -d DENSITIES  comma-separated densities (default 0.001,0.01,0.05)");
+    puts("  -p PATTERNS   any of random,banded,powerlaw,identity (default all)");
+    puts("  -k KERNELS    comma-separated kernel names (default all)");
+    puts("  -t SECONDS    minimum timed seconds per sample (default 0.05)");
+    puts("  -f FLOPS      skip products estimated above FLOPS (default 1e9)");
+    puts("  -j THREADS    worker threads (default 1)");
+    puts("  -s SEED       generator seed (default 1)");
+    puts("  -o FILE       write JSON to FILE instead of standard output");
+    puts("  -c READERS    comma-separated reader counts for " CONC_KERNEL " (default none)");
+    puts("  -l            list kernels and exit");
+}
+
+static bool parse_opts(int argc, char **argv, BenchOpts_t *restrict opts) {
+    *opts = (BenchOpts_t){
+        .sizes = {256, 1024, 4096},
+        .n_sizes = 3,
+        .densities = {0.001, 0.01, 0.05},
+        .n_densities = 3,
+        .patterns = {true, true, true, true},
+        .min_time = 0.05,
+        .max_flops = 1e9,
+        .n_threads = 1,
+        .seed = 1,
+    };
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-l") == 0) {
+            for (size_t k = 0; k < ARR_LIT_LEN_(KERNELS); k++) {
+                puts(KERNELS[k].name);
+            }
+            puts(CONC_KERNEL);
+            exit(0);
+        }
+        if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 >= argc) {
+            return false;
+        }
+        const char *const val = argv[++i];
+        double list[MAX_LIST];
+        switch (argv[i - 1][1]) {
+        case 'n':
+            opts->n_sizes = parse_list(val, list, MAX_LIST);
+            for (size_t k = 0; k < opts->n_sizes; k++) {
+                opts->sizes[k] = (size_t)list[k];
+            }
+            if (opts->n_sizes == 0) {
+                return false;
+            }
+            break;
+        case 'd':
+            opts->n_densities = parse_list(val, opts->densities, MAX_LIST);
+            if (opts->n_densities == 0) {
+                return false;
+            }
+            break;
+        case 'p':
+            for (size_t p = 0; p < PAT_COUNT_; p++) {
+                opts->patterns[p] = kernel_selected(val, PATTERN_NAMES[p]);
+            }
+            break;
+        case 'k':
+            opts->kernels = val;
+            break;
+        case 't':
+            opts->min_time = strtod(val, NULL);
+            break;
+        case 'f':
+            opts->max_flops = strtod(val, NULL);
+            break;
+        case 'j':
+            opts->n_threads = strtoul(val, NULL, 10);
+            if (opts->n_threads == 0) {
+                return false;
+            }
+            break;
+        case 's':
+            opts->seed = strtoull(val, NULL, 10);
+            break;
+        case 'o':
+            opts->out_path = val;
+            break;
+        case 'c':
+            opts->n_readers = parse_list(val, list, MAX_LIST);
+            for (size_t k = 0; k < opts->n_readers; k++) {
+                opts->readers[k] = (size_t)list[k];
+            }
+            if (opts->n_readers == 0) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    BenchOpts_t opts;
+    if (!parse_opts(argc, argv, &opts)) {
+        usage(argv[0]);
+        return 1;
+    }
+    FILE *f = stdout;
+    if (opts.out_path != NULL) {
+        f = fopen(opts.out_path, "w");
+        if (f == NULL) {
+            fprintf(stderr, "lsmat_bench: cannot open '%s'\n", opts.out_path);
+            return 1;
+        }
+    }
+    LSMat_set_hooks(alloc_hook, free_hook);
+    LSArith_set_threads(opts.n_threads);
+
+    // Build flags change the numbers, so they travel with them.
+    fprintf(f,
+            "{\n  \"simd\":\"%s\",\"threads\":%zu,\"min_time\":%g,\"seed\":%llu,"
+            "\"compact_index\":%s,\"singly_linked\":%s,\n  \"results\":[",
+            LSArith_simd_isa(), opts.n_threads, opts.min_time, (unsigned long long)opts.seed,
+#ifdef LSMAT_COMPACT_INDEX
+            "true",
+#else
+            "false",
+#endif
+#ifdef LSMAT_SINGLY_LINKED
+            "true"
+#else
+            "false"
+#endif
+    );
+    bool first = true;
+    int status = 0;
+    for (size_t p = 0; p < PAT_COUNT_; p++) {
+        if (!opts.patterns[p]) {
+            continue;
+        }
+        for (size_t s = 0; s < opts.n_sizes; s++) {
+            // Identity matrices look the same at every density.
+            const size_t n_densities = p == PAT_IDENTITY ? 1 : opts.n_densities;
+            for (size_t d = 0; d < n_densities; d++) {
+                const size_t n = opts.sizes[s];
+                const double density = p == PAT_IDENTITY ? 1. / (double)n : opts.densities[d];
+                BenchCase_t c;
+                if (!case_init(&c, (pattern_t)p, n, density, opts.seed + s * 1000 + d)) {
+                    fprintf(stderr, "lsmat_bench: cannot generate %s n=%zu density=%g\n",
+                            PATTERN_NAMES[p], n, density);
+                    status = 1;
+                    continue;
+                }
+                for (size_t k = 0; k < ARR_LIT_LEN_(KERNELS); k++) {
+                    if (kernel_selected(opts.kernels, KERNELS[k].name) &&
+                        !bench_kernel(f, &opts, KERNELS + k, &c, (pattern_t)p, density, &first)) {
+                        status = 1;
+                    }
+                }
+                for (size_t r = 0; r < opts.n_readers; r++) {
+                    if (kernel_selected(opts.kernels, CONC_KERNEL) &&
+                        !bench_conc(f, &opts, &c, (pattern_t)p, density, opts.readers[r],
+                                    &first)) {
+                        status = 1;
+                    }
+                }
+                case_destroy(&c);
+            }
+        }
+    }
+    fputs("\n  ]\n}\n", f);
+    if (f != stdout) {
+        fclose(f);
+    }
+    LSArith_set_threads(1);
+    LSMat_set_hooks(NULL, NULL);
+    return status;
+}
@@ -0,0 +1,1104 @@
+#include "expr.h"
+#include "lsmat/lsarith.h"
+#include "lsmat/lscache.h"
+#include "lsmat/lsmat.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LEN_TOKEN 64
+
+/*
+ * Expressions are compiled into a DAG of four kinds of nodes: operands,
+ * k-way sums, multiplication chains and solves. Scalar factors ride on the edges, so
+ * that A*B and 2*A*B share one product. Transposes are pushed down to the
+ * operands, where they become views, and equal subtrees are merged as the
+ * nodes are built.
+ */
+typedef enum ExprKind_ {
+    EXPR_LEAF,
+    EXPR_SUM,
+    EXPR_MUL,
+    EXPR_SOLVE,
+} ExprKind_t;
+
+typedef struct ExprNode_ ExprNode_t;
+
+// A scaled reference to a node; a NULL node stands for a bare scalar.
+typedef struct ExprRef_ {
+    ExprNode_t *node;
+    double coef;
+} ExprRef_t;
+
+struct ExprNode_ {
+    ExprKind_t kind;
+    size_t shape[LSMAT_AXIS_COUNT_];
+    LSMat_t *mat;
+    bool transposed;
+    ExprRef_t *terms;
+    ExprNode_t **factors;
+    size_t n;
+    // Evaluation state
+    size_t uses;
+    bool done;
+    LSMatView_t view;
+    LSMat_t *value;
+    size_t bytes;
+};
+
+struct Expr_ {
+    const char *pos;
+    expr_lookup_t lookup;
+    void *ctx;
+    ExprNode_t **nodes;
+    size_t n_nodes;
+    size_t cap_nodes;
+    ExprRef_t root;
+    LSCache_t *cache;
+    expr_meter_t meter;
+    expr_errno_t err;
+    char msg[EXPR_MSG_LEN];
+};
+
+static bool expr_fail(Expr_t *restrict e, expr_errno_t err, const char *restrict fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(e->msg, sizeof(e->msg), fmt, args);
+    va_end(args);
+    e->err = err;
+    return false;
+}
+
+static void expr_node_free(ExprNode_t *node) {
+    if (node->value != NULL) {
+        LSMat_free(node->value);
+    }
+    free(node->terms);
+    free(node->factors);
+    free(node);
+}
+
+static bool expr_node_equals(const ExprNode_t *restrict a, const ExprNode_t *restrict b) {
+    if (a->kind != b->kind || a->n != b->n || a->shape[LSMAT_AXIS_0] != b->shape[LSMAT_AXIS_0] ||
+        a->shape[LSMAT_AXIS_1] != b->shape[LSMAT_AXIS_1]) {
+        return false;
+    }
+    switch (a->kind) {
+    case EXPR_LEAF:
+        return a->mat == b->mat && a->transposed == b->transposed;
+    case EXPR_SUM:
+        for (size_t k = 0; k < a->n; k++) {
+            if (a->terms[k].node != b->terms[k].node || a->terms[k].coef != b->terms[k].coef) {
+                return false;
+            }
+        }
+        return true;
+    case EXPR_MUL:
+    case EXPR_SOLVE:
+        return memcmp(a->factors, b->factors, a->n * sizeof(ExprNode_t *)) == 0;
+    }
+    return false;
+}
+
+/*
+ * Return the node equal to proto, creating it if there is none yet. The
+ * arrays of proto are taken over or freed either way.
+ */
+static ExprNode_t *expr_intern(Expr_t *restrict e, ExprNode_t proto) {
+    for (size_t k = 0; k < e->n_nodes; k++) {
+        if (expr_node_equals(e->nodes[k], &proto)) {
+            free(proto.terms);
+            free(proto.factors);
+            return e->nodes[k];
+        }
+    }
+    if (e->n_nodes == e->cap_nodes) {
+        const size_t cap = e->cap_nodes == 0 ? 16 : e->cap_nodes * 2;
+        ExprNode_t **const nodes = realloc(e->nodes, cap * sizeof(ExprNode_t *));
+        if (nodes == NULL) {
+            free(proto.terms);
+            free(proto.factors);
+            return NULL;
+        }
+        e->nodes = nodes;
+        e->cap_nodes = cap;
+    }
+    ExprNode_t *const node = malloc(sizeof(ExprNode_t));
+    if (node == NULL) {
+        free(proto.terms);
+        free(proto.factors);
+        return NULL;
+    }
+    *node = proto;
+    e->nodes[e->n_nodes++] = node;
+    return node;
+}
+
+static bool expr_intern_into(Expr_t *restrict e, ExprNode_t proto, ExprNode_t **restrict out) {
+    *out = expr_intern(e, proto);
+    if (*out == NULL) {
+        return expr_fail(e, EXPR_E_ARITH, "Out of memory");
+    }
+    return true;
+}
+
+static bool expr_make_leaf(Expr_t *restrict e, LSMat_t *restrict mat, bool transposed,
+                           ExprNode_t **restrict out) {
+    ExprNode_t proto = {.kind = EXPR_LEAF, .mat = mat, .transposed = transposed};
+    proto.shape[LSMAT_AXIS_0] = mat->shape[transposed ? LSMAT_AXIS_1 : LSMAT_AXIS_0];
+    proto.shape[LSMAT_AXIS_1] = mat->shape[transposed ? LSMAT_AXIS_0 : LSMAT_AXIS_1];
+    return expr_intern_into(e, proto, out);
+}
+
+static bool expr_transpose_node(Expr_t *restrict e, ExprNode_t *node, ExprNode_t **restrict out) {
+    if (node->kind == EXPR_LEAF) {
+        return expr_make_leaf(e, node->mat, !node->transposed, out);
+    }
+    if (node->kind == EXPR_SOLVE) {
+        // (A \ B).T would be a division from the right, which there is none of.
+        return expr_fail(e, EXPR_E_SYNTAX, "Cannot transpose a solve; assign it first");
+    }
+    ExprNode_t proto = {.kind = node->kind, .n = node->n};
+    proto.shape[LSMAT_AXIS_0] = node->shape[LSMAT_AXIS_1];
+    proto.shape[LSMAT_AXIS_1] = node->shape[LSMAT_AXIS_0];
+    if (node->kind == EXPR_SUM) {
+        // (A + B).T = A.T + B.T
+        proto.terms = malloc((node->n > 0 ? node->n : 1) * sizeof(ExprRef_t));
+        if (proto.terms == NULL) {
+            return expr_fail(e, EXPR_E_ARITH, "Out of memory");
+        }
+        for (size_t k = 0; k < node->n; k++) {
+            proto.terms[k].coef = node->terms[k].coef;
+            if (!expr_transpose_node(e, node->terms[k].node, &proto.terms[k].node)) {
+                free(proto.terms);
+                return false;
+            }
+        }
+    } else {
+        // (A * B).T = B.T * A.T
+        proto.factors = malloc(node->n * sizeof(ExprNode_t *));
+        if (proto.factors == NULL) {
+            return expr_fail(e, EXPR_E_ARITH, "Out of memory");
+        }
+        for (size_t k = 0; k < node->n; k++) {
+            if (!expr_transpose_node(e, node->factors[node->n - 1 - k], proto.factors + k)) {
+                free(proto.factors);
+                return false;
+            }
+        }
+    }
+    return expr_intern_into(e, proto, out);
+}
+
+static bool expr_add_term(ExprRef_t *restrict terms, size_t *restrict n, ExprRef_t term) {
+    for (size_t k = 0; k < *n; k++) {
+        if (terms[k].node == term.node) {
+            terms[k].coef += term.coef;
+            return true;
+        }
+    }
+    terms[(*n)++] = term;
+    return true;
+}
+
+static size_t expr_n_terms(ExprRef_t r) {
+    return r.node->kind == EXPR_SUM ? r.node->n : 1;
+}
+
+static void expr_add_terms_of(ExprRef_t *restrict terms, size_t *restrict n, ExprRef_t r) {
+    if (r.node->kind != EXPR_SUM) {
+        expr_add_term(terms, n, r);
+        return;
+    }
+    for (size_t k = 0; k < r.node->n; k++) {
+        const ExprRef_t t = {.node = r.node->terms[k].node, .coef = r.coef * r.node->terms[k].coef};
+        expr_add_term(terms, n, t);
+    }
+}
+
+static bool expr_make_sum(Expr_t *restrict e, ExprRef_t a, ExprRef_t b, char op,
+                          ExprRef_t *restrict out) {
+    if (a.node == NULL || b.node == NULL) {
+        return expr_fail(e, EXPR_E_SYNTAX, "Cannot '%c' a scalar and a matrix", op);
+    }
+    if (a.node->shape[LSMAT_AXIS_0] != b.node->shape[LSMAT_AXIS_0] ||
+        a.node->shape[LSMAT_AXIS_1] != b.node->shape[LSMAT_AXIS_1]) {
+        return expr_fail(e, EXPR_E_SHAPE, "Inconsistent shapes for '%c': (%zu,%zu) and (%zu,%zu)",
+                         op, a.node->shape[LSMAT_AXIS_0], a.node->shape[LSMAT_AXIS_1],
+                         b.node->shape[LSMAT_AXIS_0], b.node->shape[LSMAT_AXIS_1]);
+    }
+    if (op == '-') {
+        b.coef = -b.coef;
+    }
+    ExprNode_t proto = {.kind = EXPR_SUM};
+    proto.shape[LSMAT_AXIS_0] = a.node->shape[LSMAT_AXIS_0];
+    proto.shape[LSMAT_AXIS_1] = a.node->shape[LSMAT_AXIS_1];
+    proto.terms = malloc((expr_n_terms(a) + expr_n_terms(b)) * sizeof(ExprRef_t));
+    if (proto.terms == NULL) {
+        return expr_fail(e, EXPR_E_ARITH, "Out of memory");
+    }
+    expr_add_terms_of(proto.terms, &proto.n, a);
+    expr_add_terms_of(proto.terms, &proto.n, b);
+    // Terms that cancel out are dropped, and a single term needs no sum.
+    size_t n = 0;
+    for (size_t k = 0; k < proto.n; k++) {
+        if (proto.terms[k].coef != 0.) {
+            proto.terms[n++] = proto.terms[k];
+        }
+    }
+    proto.n = n;
+    if (n == 1) {
+        *out = proto.terms[0];
+        free(proto.terms);
+        return true;
+    }
+    out->coef = 1.;
+    return expr_intern_into(e, proto, &out->node);
+}
+
+static bool expr_make_mul(Expr_t *restrict e, ExprRef_t a, ExprRef_t b, ExprRef_t *restrict out) {
+    out->coef = a.coef * b.coef;
+    if (a.node == NULL || b.node == NULL) {
+        out->node = a.node != NULL ? a.node : b.node;
+        return true;
+    }
+    if (a.node->shape[LSMAT_AXIS_1] != b.node->shape[LSMAT_AXIS_0]) {
+        return expr_fail(e, EXPR_E_SHAPE, "Inconsistent shapes for '*': (%zu,%zu) and (%zu,%zu)",
+                         a.node->shape[LSMAT_AXIS_0], a.node->shape[LSMAT_AXIS_1],
+                         b.node->shape[LSMAT_AXIS_0], b.node->shape[LSMAT_AXIS_1]);
+    }
+    const size_t n_a = a.node->kind == EXPR_MUL ? a.node->n : 1;
+    const size_t n_b = b.node->kind == EXPR_MUL ? b.node->n : 1;
+    ExprNode_t proto = {.kind = EXPR_MUL, .n = n_a + n_b};
+    proto.shape[LSMAT_AXIS_0] = a.node->shape[LSMAT_AXIS_0];
+    proto.shape[LSMAT_AXIS_1] = b.node->shape[LSMAT_AXIS_1];
+    proto.factors = malloc(proto.n * sizeof(ExprNode_t *));
+    if (proto.factors == NULL) {
+        return expr_fail(e, EXPR_E_ARITH, "Out of memory");
+    }
+    // Chains are kept flat, so that the order of evaluation is free to pick.
+    if (a.node->kind == EXPR_MUL) {
+        memcpy(proto.factors, a.node->factors, n_a * sizeof(ExprNode_t *));
+    } else {
+        proto.factors[0] = a.node;
+    }
+    if (b.node->kind == EXPR_MUL) {
+        memcpy(proto.factors + n_a, b.node->factors, n_b * sizeof(ExprNode_t *));
+    } else {
+        proto.factors[n_a] = b.node;
+    }
+    return expr_intern_into(e, proto, &out->node);
+}
+
+// A \ B solves A X = B; scalars on either side only scale the result.
+static bool expr_make_solve(Expr_t *restrict e, ExprRef_t a, ExprRef_t b,
+                            ExprRef_t *restrict out) {
+    if (b.node == NULL) {
+        return expr_fail(e, EXPR_E_SYNTAX, "Cannot '\\' a matrix and a scalar");
+    }
+    if (a.coef == 0.) {
+        return expr_fail(e, EXPR_E_NOINV, "Singular left side for '\\'");
+    }
+    out->coef = b.coef / a.coef;
+    if (a.node == NULL) {
+        out->node = b.node;
+        return true;
+    }
+    if (a.node->shape[LSMAT_AXIS_0] != a.node->shape[LSMAT_AXIS_1] ||
+        a.node->shape[LSMAT_AXIS_0] != b.node->shape[LSMAT_AXIS_0]) {
+        return expr_fail(e, EXPR_E_SHAPE, "Inconsistent shapes for '\\': (%zu,%zu) and (%zu,%zu)",
+                         a.node->shape[LSMAT_AXIS_0], a.node->shape[LSMAT_AXIS_1],
+                         b.node->shape[LSMAT_AXIS_0], b.node->shape[LSMAT_AXIS_1]);
+    }
+    ExprNode_t proto = {.kind = EXPR_SOLVE, .n = 2};
+    proto.shape[LSMAT_AXIS_0] = a.node->shape[LSMAT_AXIS_1];
+    proto.shape[LSMAT_AXIS_1] = b.node->shape[LSMAT_AXIS_1];
+    proto.factors = malloc(2 * sizeof(ExprNode_t *));
+    if (proto.factors == NULL) {
+        return expr_fail(e, EXPR_E_ARITH, "Out of memory");
+    }
+    proto.factors[0] = a.node;
+    proto.factors[1] = b.node;
+    return expr_intern_into(e, proto, &out->node);
+}
+
+static void expr_skip_space(Expr_t *restrict e) {
+    while (isspace((unsigned char)*e->pos)) {
+        e->pos++;
+    }
+}
+
+static bool expr_parse_sum(Expr_t *restrict e, ExprRef_t *restrict out);
+
+static bool expr_parse_primary(Expr_t *restrict e, ExprRef_t *restrict out) {
+    expr_skip_space(e);
+    if (*e->pos == '(') {
+        e->pos++;
+        if (!expr_parse_sum(e, out)) {
+            return false;
+        }
+        expr_skip_space(e);
+        if (*e->pos != ')') {
+            return expr_fail(e, EXPR_E_SYNTAX, "Invalid syntax; missing ')'");
+        }
+        e->pos++;
+        return true;
+    }
+    const char *const start = e->pos;
+    size_t len = 0;
+    bool all_digits = true;
+    while (isdigit((unsigned char)start[len]) || isupper((unsigned char)start[len])) {
+        all_digits = all_digits && isdigit((unsigned char)start[len]);
+        len++;
+    }
+    if (len == 0 && *start != '.') {
+        if (*start == '\0') {
+            return expr_fail(e, EXPR_E_SYNTAX, "Invalid syntax; missing operand");
+        }
+        return expr_fail(e, EXPR_E_SYNTAX, "Invalid syntax; unexpected '%c'", *start);
+    }
+    char token[MAX_LEN_TOKEN];
+    snprintf(token, sizeof(token), "%.*s", (int)len, start);
+    LSMat_t *const mat = len > 0 && len < MAX_LEN_TOKEN ? e->lookup(token, e->ctx) : NULL;
+    if (mat != NULL) {
+        e->pos += len;
+        out->coef = 1.;
+        return expr_make_leaf(e, mat, false, &out->node);
+    }
+    if (all_digits) {
+        // Identifiers may start with digits, so plain numbers are scalars
+        // only when no matrix goes by that name.
+        char *end = NULL;
+        out->node = NULL;
+        out->coef = strtod(start, &end);
+        if (end != start) {
+            e->pos = end;
+            return true;
+        }
+    }
+    return expr_fail(e, EXPR_E_UNDEF, "Undefined identifier: '%s'", token);
+}
+
+static bool expr_parse_postfix(Expr_t *restrict e, ExprRef_t *restrict out) {
+    if (!expr_parse_primary(e, out)) {
+        return false;
+    }
+    while (e->pos[0] == '.' && e->pos[1] == 'T') {
+        e->pos += 2;
+        if (out->node != NULL && !expr_transpose_node(e, out->node, &out->node)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool expr_parse_unary(Expr_t *restrict e, ExprRef_t *restrict out) {
+    expr_skip_space(e);
+    if (*e->pos == '-' || *e->pos == '+') {
+        const bool neg = *e->pos == '-';
+        e->pos++;
+        if (!expr_parse_unary(e, out)) {
+            return false;
+        }
+        if (neg) {
+            out->coef = -out->coef;
+        }
+        return true;
+    }
+    return expr_parse_postfix(e, out);
+}
+
+static bool expr_parse_product(Expr_t *restrict e, ExprRef_t *restrict out) {
+    if (!expr_parse_unary(e, out)) {
+        return false;
+    }
+    for (;;) {
+        expr_skip_space(e);
+        const char op = *e->pos;
+        if (op != '*' && op != '\\') {
+            return true;
+        }
+        e->pos++;
+        ExprRef_t rhs;
+        if (!expr_parse_unary(e, &rhs)) {
+            return false;
+        }
+        // Left to right, so A \ B * C is (A \ B) * C.
+        if (!(op == '*' ? expr_make_mul(e, *out, rhs, out) : expr_make_solve(e, *out, rhs, out))) {
+            return false;
+        }
+    }
+}
+
+static bool expr_parse_sum(Expr_t *restrict e, ExprRef_t *restrict out) {
+    if (!expr_parse_product(e, out)) {
+        return false;
+    }
+    for (;;) {
+        expr_skip_space(e);
+        const char op = *e->pos;
+        if (op != '+' && op != '-') {
+            return true;
+        }
+        e->pos++;
+        ExprRef_t rhs;
+        if (!expr_parse_product(e, &rhs) || !expr_make_sum(e, *out, rhs, op, out)) {
+            return false;
+        }
+    }
+}
+
+expr_errno_t expr_compile(const char *src, expr_lookup_t lookup, void *ctx, Expr_t **out) {
+    *out = calloc(1, sizeof(Expr_t));
+    Expr_t *const e = *out;
+    if (e == NULL) {
+        return EXPR_E_ARITH;
+    }
+    e->pos = src;
+    e->lookup = lookup;
+    e->ctx = ctx;
+    if (!expr_parse_sum(e, &e->root)) {
+        return e->err;
+    }
+    expr_skip_space(e);
+    if (*e->pos != '\0') {
+        expr_fail(e, EXPR_E_SYNTAX, "Invalid syntax; unexpected '%c'", *e->pos);
+        return e->err;
+    }
+    if (e->root.node == NULL) {
+        expr_fail(e, EXPR_E_SYNTAX, "Invalid syntax; the result is a scalar");
+        return e->err;
+    }
+    return EXPR_OK;
+}
+
+void expr_use_cache(Expr_t *expr, LSCache_t *cache, expr_meter_t meter) {
+    expr->cache = cache;
+    expr->meter = meter;
+}
+
+static void expr_count_uses(ExprNode_t *node) {
+    if (node->uses++ > 0) {
+        return;
+    }
+    if (node->kind == EXPR_SUM) {
+        for (size_t k = 0; k < node->n; k++) {
+            expr_count_uses(node->terms[k].node);
+        }
+    } else {
+        for (size_t k = 0; k < node->n; k++) {
+            expr_count_uses(node->factors[k]);
+        }
+    }
+}
+
+// Drop one use of a node, freeing its temporary once nobody needs it.
+static void expr_release(ExprNode_t *node) {
+    if (--node->uses == 0 && node->value != NULL) {
+        LSMat_free(node->value);
+        node->value = NULL;
+    }
+}
+
+static void expr_release_children(ExprNode_t *node) {
+    if (node->kind == EXPR_SUM) {
+        for (size_t k = 0; k < node->n; k++) {
+            expr_release(node->terms[k].node);
+        }
+    } else {
+        for (size_t k = 0; k < node->n; k++) {
+            expr_release(node->factors[k]);
+        }
+    }
+}
+
+/*
+ * Cache keys spell out a subtree with every operand pinned to its id and
+ * version, so an entry can never be served for a matrix that has changed
+ * since.
+ */
+typedef struct ExprKey_ {
+    unsigned char *buf;
+    size_t len;
+    size_t cap;
+    // Operand ids, so entries can be dropped along with their operands.
+    uint64_t *deps;
+    size_t n_deps;
+    size_t cap_deps;
+    bool ok;
+} ExprKey_t;
+
+static void expr_key_put(ExprKey_t *restrict k, const void *restrict p, size_t n) {
+    if (!k->ok) {
+        return;
+    }
+    if (k->len + n > k->cap) {
+        const size_t cap = 2 * (k->len + n) > 64 ? 2 * (k->len + n) : 64;
+        unsigned char *const buf = realloc(k->buf, cap);
+        if (buf == NULL) {
+            k->ok = false;
+            return;
+        }
+        k->buf = buf;
+        k->cap = cap;
+    }
+    memcpy(k->buf + k->len, p, n);
+    k->len += n;
+}
+
+static void expr_key_dep(ExprKey_t *restrict k, uint64_t id) {
+    for (size_t d = 0; d < k->n_deps; d++) {
+        if (k->deps[d] == id) {
+            return;
+        }
+    }
+    if (k->n_deps == k->cap_deps) {
+        const size_t cap = k->cap_deps > 0 ? 2 * k->cap_deps : 4;
+        uint64_t *const deps = realloc(k->deps, cap * sizeof(uint64_t));
+        if (deps == NULL) {
+            k->ok = false;
+            return;
+        }
+        k->deps = deps;
+        k->cap_deps = cap;
+    }
+    k->deps[k->n_deps++] = id;
+}
+
+static void expr_key_node(ExprKey_t *restrict k, const ExprNode_t *restrict node);
+
+static void expr_key_chain(ExprKey_t *restrict k, const ExprNode_t *restrict node, size_t i,
+                           size_t j) {
+    const unsigned char tag = EXPR_MUL;
+    const size_t n = j - i + 1;
+    expr_key_put(k, &tag, sizeof(tag));
+    expr_key_put(k, &n, sizeof(n));
+    for (size_t f = i; f <= j; f++) {
+        expr_key_node(k, node->factors[f]);
+    }
+}
+
+static void expr_key_node(ExprKey_t *restrict k, const ExprNode_t *restrict node) {
+    const unsigned char tag = node->kind;
+    switch (node->kind) {
+    case EXPR_LEAF: {
+        const unsigned char transposed = node->transposed;
+        expr_key_put(k, &tag, sizeof(tag));
+        expr_key_put(k, &node->mat->id, sizeof(node->mat->id));
+        expr_key_put(k, &node->mat->version, sizeof(node->mat->version));
+        expr_key_put(k, &transposed, sizeof(transposed));
+        expr_key_dep(k, node->mat->id);
+        break;
+    }
+    case EXPR_SUM:
+        expr_key_put(k, &tag, sizeof(tag));
+        expr_key_put(k, &node->n, sizeof(node->n));
+        for (size_t t = 0; t < node->n; t++) {
+            expr_key_put(k, &node->terms[t].coef, sizeof(double));
+            expr_key_node(k, node->terms[t].node);
+        }
+        break;
+    case EXPR_MUL:
+        expr_key_chain(k, node, 0, node->n - 1);
+        break;
+    case EXPR_SOLVE:
+        expr_key_put(k, &tag, sizeof(tag));
+        expr_key_node(k, node->factors[0]);
+        expr_key_node(k, node->factors[1]);
+        break;
+    }
+}
+
+static void expr_key_reset(ExprKey_t *restrict k) {
+    k->len = 0;
+    k->n_deps = 0;
+    k->ok = true;
+}
+
+static void expr_key_destroy(ExprKey_t *restrict k) {
+    free(k->buf);
+    free(k->deps);
+}
+
+static LSMat_t *expr_cache_get(Expr_t *restrict e, const ExprKey_t *restrict k) {
+    return e->cache != NULL && k->ok ? LSCache_get(e->cache, k->buf, k->len) : NULL;
+}
+
+static void expr_cache_put(Expr_t *restrict e, const ExprKey_t *restrict k, LSMat_t *restrict mat,
+                           size_t bytes) {
+    if (e->cache != NULL && k->ok) {
+        LSCache_put(e->cache, k->buf, k->len, k->deps, k->n_deps, mat, bytes);
+    }
+}
+
+// Bytes allocated so far, as seen by the caller's allocation hooks.
+static size_t expr_meter(const Expr_t *restrict e) {
+    return e->meter != NULL ? e->meter() : 0;
+}
+
+static size_t expr_charge(size_t before, size_t after) {
+    return after > before ? after - before : 0;
+}
+
+static size_t expr_nnz_of(const LSMat_t *restrict mat) {
+    size_t nnz = 0;
+    for (size_t i = 0; i < mat->shape[LSMAT_AXIS_0]; i++) {
+        nnz += mat->heads[LSMAT_AXIS_0][i].len;
+    }
+    return nnz;
+}
+
+/*
+ * Estimates for the product of an m-by-k matrix with nnz_a entries and a
+ * k-by-n one with nnz_b entries, assuming the entries are spread uniformly:
+ * each entry of the left side meets nnz_b / k entries on the right, and an
+ * output entry stays zero only if all of its k terms are.
+ */
+static double expr_mul_flops(double nnz_a, double nnz_b, size_t k) {
+    return k > 0 ? nnz_a * nnz_b / (double)k : 0.;
+}
+
+static double expr_mul_nnz(double nnz_a, double nnz_b, size_t m, size_t k, size_t n) {
+    if (m == 0 || k == 0 || n == 0) {
+        return 0.;
+    }
+    const double p = (nnz_a / ((double)m * (double)k)) * (nnz_b / ((double)k * (double)n));
+    const double cells = (double)m * (double)n;
+    return p >= 1. ? cells : cells * -expm1((double)k * log1p(-p));
+}
+
+typedef struct ExprChain_ {
+    const ExprNode_t *node;
+    size_t n;
+    LSMatView_t *views;
+    size_t *dims;
+    double *nnz;
+    double *cost;
+    size_t *split;
+    LSMat_t **cached;
+} ExprChain_t;
+
+#define CHAIN_AT_(c_, i_, j_) ((i_) * (c_)->n + (j_))
+
+/*
+ * Classic matrix-chain ordering, with the estimated work in place of flops.
+ * Sub-chains already in the cache cost nothing, so the order bends towards
+ * reusing them.
+ */
+static void expr_chain_order(ExprChain_t *restrict c) {
+    for (size_t len = 2; len <= c->n; len++) {
+        for (size_t i = 0; i + len <= c->n; i++) {
+            const size_t j = i + len - 1;
+            LSMat_t *const hit = c->cached[CHAIN_AT_(c, i, j)];
+            if (hit != NULL) {
+                c->cost[CHAIN_AT_(c, i, j)] = 0.;
+                c->nnz[CHAIN_AT_(c, i, j)] = (double)expr_nnz_of(hit);
+                c->split[CHAIN_AT_(c, i, j)] = i;
+                continue;
+            }
+            double best = INFINITY;
+            for (size_t s = i; s < j; s++) {
+                const double nnz_l = c->nnz[CHAIN_AT_(c, i, s)];
+                const double nnz_r = c->nnz[CHAIN_AT_(c, s + 1, j)];
+                const double nnz_o =
+                    expr_mul_nnz(nnz_l, nnz_r, c->dims[i], c->dims[s + 1], c->dims[j + 1]);
+                const double cost = c->cost[CHAIN_AT_(c, i, s)] + c->cost[CHAIN_AT_(c, s + 1, j)] +
+                                    expr_mul_flops(nnz_l, nnz_r, c->dims[s + 1]) + nnz_o;
+                if (cost < best) {
+                    best = cost;
+                    c->cost[CHAIN_AT_(c, i, j)] = cost;
+                    c->nnz[CHAIN_AT_(c, i, j)] = nnz_o;
+                    c->split[CHAIN_AT_(c, i, j)] = s;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Multiply out factors i to j. A single factor is returned as is; products
+ * come back as temporaries, which the caller holds a reference to.
+ */
+static bool expr_chain_eval(Expr_t *restrict e, const ExprChain_t *restrict c, size_t i,
+                            size_t j, LSMatView_t *restrict out_view, LSMat_t **restrict out_tmp) {
+    *out_tmp = NULL;
+    if (i == j) {
+        *out_view = c->views[i];
+        return true;
+    }
+    LSMat_t *const hit = c->cached[CHAIN_AT_(c, i, j)];
+    if (hit != NULL) {
+        *out_tmp = LSMat_retain(hit);
+        *out_view = LSMatView_from(hit);
+        return true;
+    }
+    const size_t s = c->split[CHAIN_AT_(c, i, j)];
+    LSMatView_t lhs;
+    LSMatView_t rhs;
+    LSMat_t *tmp_l = NULL;
+    LSMat_t *tmp_r = NULL;
+    if (!expr_chain_eval(e, c, i, s, &lhs, &tmp_l)) {
+        return false;
+    }
+    if (!expr_chain_eval(e, c, s + 1, j, &rhs, &tmp_r)) {
+        LSMat_free(tmp_l);
+        return false;
+    }
+    const size_t before = expr_meter(e);
+    LSMat_t *const prod = LSMat_new(c->dims[i], c->dims[j + 1]);
+    const bool ok = prod != NULL && LSArith_view_mul(lhs, rhs, prod) == LSARITH_OK;
+    const size_t bytes = expr_charge(before, expr_meter(e));
+    if (tmp_l != NULL) {
+        LSMat_free(tmp_l);
+    }
+    if (tmp_r != NULL) {
+        LSMat_free(tmp_r);
+    }
+    if (!ok) {
+        if (prod != NULL) {
+            LSMat_free(prod);
+        }
+        return expr_fail(e, EXPR_E_ARITH, "General arithmetic error");
+    }
+    ExprKey_t k = {.ok = e->cache != NULL};
+    expr_key_chain(&k, c->node, i, j);
+    expr_cache_put(e, &k, prod, bytes);
+    expr_key_destroy(&k);
+    *out_view = LSMatView_from(prod);
+    *out_tmp = prod;
+    return true;
+}
+
+static bool expr_eval_node(Expr_t *restrict e, ExprNode_t *restrict node);
+
+static void expr_chain_destroy(ExprChain_t *restrict c) {
+    if (c->cached != NULL) {
+        for (size_t k = 0; k < c->n * c->n; k++) {
+            if (c->cached[k] != NULL) {
+                LSMat_free(c->cached[k]);
+            }
+        }
+    }
+    free(c->views);
+    free(c->dims);
+    free(c->nnz);
+    free(c->cost);
+    free(c->split);
+    free(c->cached);
+}
+
+// Evaluate the factors of a chain and work out the order to multiply them in.
+static bool expr_chain_init(Expr_t *restrict e, ExprNode_t *restrict node,
+                            ExprChain_t *restrict c) {
+    const size_t n = node->n;
+    c->node = node;
+    c->n = n;
+    c->views = malloc(n * sizeof(LSMatView_t));
+    c->dims = malloc((n + 1) * sizeof(size_t));
+    c->nnz = calloc(n * n, sizeof(double));
+    c->cost = calloc(n * n, sizeof(double));
+    c->split = calloc(n * n, sizeof(size_t));
+    c->cached = calloc(n * n, sizeof(LSMat_t *));
+    if (c->views == NULL || c->dims == NULL || c->nnz == NULL || c->cost == NULL ||
+        c->split == NULL || c->cached == NULL) {
+        expr_chain_destroy(c);
+        return expr_fail(e, EXPR_E_ARITH, "Out of memory");
+    }
+    for (size_t k = 0; k < n; k++) {
+        ExprNode_t *const f = node->factors[k];
+        if (!expr_eval_node(e, f)) {
+            expr_chain_destroy(c);
+            return false;
+        }
+        c->views[k] = f->view;
+        c->dims[k] = f->shape[LSMAT_AXIS_0];
+        c->nnz[CHAIN_AT_(c, k, k)] = (double)expr_nnz_of(f->view.mat);
+    }
+    c->dims[n] = node->shape[LSMAT_AXIS_1];
+    // Entries are pinned here, as later products may push them out.
+    ExprKey_t k = {.ok = true};
+    for (size_t i = 0; e->cache != NULL && i < n; i++) {
+        for (size_t j = i + 1; j < n; j++) {
+            expr_key_reset(&k);
+            expr_key_chain(&k, node, i, j);
+            c->cached[CHAIN_AT_(c, i, j)] = LSMat_retain(expr_cache_get(e, &k));
+        }
+    }
+    expr_key_destroy(&k);
+    expr_chain_order(c);
+    return true;
+}
+
+static bool expr_eval_sum(Expr_t *restrict e, ExprNode_t *restrict node) {
+    const size_t n = node->n > 0 ? node->n : 1;
+    LSMatView_t *const views = malloc(n * sizeof(LSMatView_t));
+    double *const coefs = malloc(n * sizeof(double));
+    bool ok = views != NULL && coefs != NULL;
+    for (size_t k = 0; ok && k < node->n; k++) {
+        ok = expr_eval_node(e, node->terms[k].node);
+        if (ok) {
+            views[k] = node->terms[k].node->view;
+            coefs[k] = node->terms[k].coef;
+        }
+    }
+    const size_t before = expr_meter(e);
+    if (ok) {
+        node->value = LSMat_new(node->shape[LSMAT_AXIS_0], node->shape[LSMAT_AXIS_1]);
+        // All terms are merged in one pass, without partial sums.
+        ok = node->value != NULL &&
+             (node->n == 0 || LSArith_view_sum(views, coefs, node->n, node->value) == LSARITH_OK);
+    }
+    node->bytes = expr_charge(before, expr_meter(e));
+    free(views);
+    free(coefs);
+    if (!ok) {
+        return e->err != EXPR_OK ? false : expr_fail(e, EXPR_E_ARITH, "General arithmetic error");
+    }
+    return true;
+}
+
+static bool expr_view_is_plain(const LSMatView_t view) {
+    return view.axes_mapping[LSMAT_AXIS_0] == LSMAT_AXIS_0;
+}
+
+// The solver reads plain matrices; transposed operands are copied out first.
+static LSMat_t *expr_plain_of(const ExprNode_t *restrict node, LSMat_t **restrict tmp) {
+    *tmp = NULL;
+    if (expr_view_is_plain(node->view)) {
+        return node->view.mat;
+    }
+    *tmp = LSMatView_realize(node->view);
+    return *tmp;
+}
+
+static bool expr_eval_solve(Expr_t *restrict e, ExprNode_t *restrict node) {
+    if (!expr_eval_node(e, node->factors[0]) || !expr_eval_node(e, node->factors[1])) {
+        return false;
+    }
+    LSMat_t *tmp_a = NULL;
+    LSMat_t *tmp_b = NULL;
+    LSMat_t *const a = expr_plain_of(node->factors[0], &tmp_a);
+    LSMat_t *const b = expr_plain_of(node->factors[1], &tmp_b);
+    const size_t before = expr_meter(e);
+    node->value = LSMat_new(node->shape[LSMAT_AXIS_0], node->shape[LSMAT_AXIS_1]);
+    lsarith_errno_t err = LSARITH_E_GEN;
+    if (a != NULL && b != NULL && node->value != NULL) {
+        err = LSArith_solve(a, b, node->value);
+    }
+    node->bytes = expr_charge(before, expr_meter(e));
+    if (tmp_a != NULL) {
+        LSMat_free(tmp_a);
+    }
+    if (tmp_b != NULL) {
+        LSMat_free(tmp_b);
+    }
+    if (err == LSARITH_E_NOINV) {
+        return expr_fail(e, EXPR_E_NOINV, "Singular matrix on the left of '\\'");
+    }
+    if (err != LSARITH_OK) {
+        return expr_fail(e, EXPR_E_ARITH, "General arithmetic error");
+    }
+    return true;
+}
+
+static bool expr_eval_node(Expr_t *restrict e, ExprNode_t *restrict node) {
+    if (node->done) {
+        return true;
+    }
+    if (node->kind == EXPR_LEAF) {
+        node->view = node->transposed ? LSArith_mat_T(node->mat) : LSMatView_from(node->mat);
+        node->done = true;
+        return true;
+    }
+    ExprKey_t k = {.ok = e->cache != NULL};
+    expr_key_node(&k, node);
+    LSMat_t *const hit = expr_cache_get(e, &k);
+    if (hit != NULL) {
+        node->value = LSMat_retain(hit);
+    } else if (node->kind == EXPR_SUM) {
+        if (!expr_eval_sum(e, node)) {
+            expr_key_destroy(&k);
+            return false;
+        }
+        expr_cache_put(e, &k, node->value, node->bytes);
+    } else if (node->kind == EXPR_SOLVE) {
+        if (!expr_eval_solve(e, node)) {
+            expr_key_destroy(&k);
+            return false;
+        }
+        expr_cache_put(e, &k, node->value, node->bytes);
+    } else {
+        // Products put themselves, and every sub-chain, into the cache.
+        ExprChain_t chain;
+        if (!expr_chain_init(e, node, &chain)) {
+            expr_key_destroy(&k);
+            return false;
+        }
+        LSMatView_t view;
+        const bool ok = expr_chain_eval(e, &chain, 0, node->n - 1, &view, &node->value);
+        expr_chain_destroy(&chain);
+        if (!ok) {
+            expr_key_destroy(&k);
+            return false;
+        }
+    }
+    expr_key_destroy(&k);
+    expr_release_children(node);
+    node->view = LSMatView_from(node->value);
+    node->done = true;
+    return true;
+}
+
+expr_errno_t expr_eval(Expr_t *expr, LSMat_t **out) {
+    *out = NULL;
+    ExprNode_t *const root = expr->root.node;
+    const double coef = expr->root.coef;
+    if (root->kind == EXPR_LEAF && !root->transposed && coef == 1.) {
+        // Holders of a shared matrix copy it before writing.
+        *out = LSMat_retain(root->mat);
+        return EXPR_OK;
+    }
+    // Results that are not a node of their own are cached under the root.
+    const bool root_key = root->kind == EXPR_LEAF || coef != 1.;
+    ExprKey_t k = {.ok = root_key && expr->cache != NULL};
+    if (k.ok) {
+        const unsigned char tag = 'R';
+        expr_key_put(&k, &tag, sizeof(tag));
+        expr_key_put(&k, &coef, sizeof(coef));
+        expr_key_node(&k, root);
+        LSMat_t *const hit = expr_cache_get(expr, &k);
+        if (hit != NULL) {
+            expr_key_destroy(&k);
+            *out = LSMat_retain(hit);
+            return EXPR_OK;
+        }
+    }
+    expr_count_uses(root);
+    if (!expr_eval_node(expr, root)) {
+        expr_key_destroy(&k);
+        return expr->err;
+    }
+    LSMat_t *result = root->value;
+    root->value = NULL;
+    const size_t before = expr_meter(expr);
+    bool fresh = false;
+    if (result == NULL) {
+        // A bare operand, which the caller gets a copy of.
+        result = LSMatView_realize(root->view);
+        fresh = true;
+    } else if (coef != 1. && LSMat_is_shared(result)) {
+        LSMat_t *const copy = LSMatView_realize(LSMatView_from(result));
+        LSMat_free(result);
+        result = copy;
+        fresh = true;
+    }
+    if (result == NULL ||
+        (coef != 1. && LSArith_mat_scale(result, coef, true) != LSARITH_OK)) {
+        if (result != NULL) {
+            LSMat_free(result);
+        }
+        expr_key_destroy(&k);
+        expr_fail(expr, EXPR_E_ARITH, "General arithmetic error");
+        return expr->err;
+    }
+    if (fresh) {
+        expr_cache_put(expr, &k, result, expr_charge(before, expr_meter(expr)));
+    }
+    expr_key_destroy(&k);
+    *out = result;
+    return EXPR_OK;
+}
+
+expr_errno_t expr_eval_into(Expr_t *expr, LSMat_t *dest, double alpha) {
+    ExprNode_t *const root = expr->root.node;
+    if (root->shape[LSMAT_AXIS_0] != dest->shape[LSMAT_AXIS_0] ||
+        root->shape[LSMAT_AXIS_1] != dest->shape[LSMAT_AXIS_1]) {
+        expr_fail(expr, EXPR_E_SHAPE, "Inconsistent shapes for assignment: (%zu,%zu) and (%zu,%zu)",
+                  dest->shape[LSMAT_AXIS_0], dest->shape[LSMAT_AXIS_1], root->shape[LSMAT_AXIS_0],
+                  root->shape[LSMAT_AXIS_1]);
+        return expr->err;
+    }
+    alpha *= expr->root.coef;
+    expr_count_uses(root);
+    lsarith_errno_t err = LSARITH_OK;
+    if (root->kind == EXPR_MUL) {
+        // The last product goes straight into the destination.
+        ExprChain_t chain;
+        if (!expr_chain_init(expr, root, &chain)) {
+            return expr->err;
+        }
+        const size_t s = chain.split[CHAIN_AT_(&chain, 0, root->n - 1)];
+        LSMatView_t lhs;
+        LSMatView_t rhs;
+        LSMat_t *tmp_l = NULL;
+        LSMat_t *tmp_r = NULL;
+        LSMat_t *const hit = chain.cached[CHAIN_AT_(&chain, 0, root->n - 1)];
+        bool ok = true;
+        if (hit != NULL) {
+            err = LSArith_mat_axpy(dest, alpha, hit, true);
+        } else {
+            ok = expr_chain_eval(expr, &chain, 0, s, &lhs, &tmp_l) &&
+                 expr_chain_eval(expr, &chain, s + 1, root->n - 1, &rhs, &tmp_r);
+        }
+        if (hit == NULL && ok && expr_view_is_plain(lhs) && expr_view_is_plain(rhs) &&
+            lhs.mat != dest && rhs.mat != dest) {
+            err = LSArith_mat_mul_acc(dest, alpha, lhs.mat, rhs.mat, true);
+        } else if (hit == NULL && ok) {
+            LSMat_t *const prod = LSMat_new(dest->shape[LSMAT_AXIS_0], dest->shape[LSMAT_AXIS_1]);
+            err = prod != NULL ? LSArith_view_mul(lhs, rhs, prod) : LSARITH_E_GEN;
+            if (err == LSARITH_OK) {
+                err = LSArith_mat_axpy(dest, alpha, prod, true);
+            }
+            if (prod != NULL) {
+                LSMat_free(prod);
+            }
+        }
+        expr_chain_destroy(&chain);
+        if (tmp_l != NULL) {
+            LSMat_free(tmp_l);
+        }
+        if (tmp_r != NULL) {
+            LSMat_free(tmp_r);
+        }
+        if (!ok) {
+            return expr->err;
+        }
+    } else {
+        if (!expr_eval_node(expr, root)) {
+            return expr->err;
+        }
+        if (expr_view_is_plain(root->view)) {
+            err = LSArith_mat_axpy(dest, alpha, root->view.mat, true);
+        } else {
+            LSMat_t *const tmp = LSMatView_realize(root->view);
+            err = tmp != NULL ? LSArith_mat_axpy(dest, alpha, tmp, true) : LSARITH_E_GEN;
+            if (tmp != NULL) {
+                LSMat_free(tmp);
+            }
+        }
+    }
+    if (err != LSARITH_OK) {
+        expr_fail(expr, EXPR_E_ARITH, "General arithmetic error");
+        return expr->err;
+    }
+    return EXPR_OK;
+}
+
+const char *expr_message(const Expr_t *expr) {
+    return expr->msg;
+}
+
+void expr_free(Expr_t *expr) {
+    if (expr == NULL) {
+        return;
+    }
+    for (size_t k = 0; k < expr->n_nodes; k++) {
+        expr_node_free(expr->nodes[k]);
+    }
+    free(expr->nodes);
+    free(expr);
+}
@@ -0,0 +1,31 @@
+#ifndef EXPR_H_INCLUDED_
+#define EXPR_H_INCLUDED_
+
+#include "lsmat/lscache.h"
+#include "lsmat/lsmat.h"
+#include <stddef.h>
+
+#define EXPR_MSG_LEN 128
+
+typedef enum expr_errno_ {
+    EXPR_OK,
+    EXPR_E_SYNTAX,
+    EXPR_E_UNDEF,
+    EXPR_E_SHAPE,
+    EXPR_E_ARITH,
+    EXPR_E_NOINV,
+} expr_errno_t;
+
+typedef LSMat_t *(*expr_lookup_t)(const char *name, void *ctx);
+typedef size_t (*expr_meter_t)(void);
+
+typedef struct Expr_ Expr_t;
+
+expr_errno_t expr_compile(const char *src, expr_lookup_t lookup, void *ctx, Expr_t **out);
+void expr_use_cache(Expr_t *expr, LSCache_t *cache, expr_meter_t meter);
+expr_errno_t expr_eval(Expr_t *expr, LSMat_t **out);
+expr_errno_t expr_eval_into(Expr_t *expr, LSMat_t *dest, double alpha);
+const char *expr_message(const Expr_t *expr);
+void expr_free(Expr_t *expr);
+
+#endif /* EXPR_H_INCLUDED_ */
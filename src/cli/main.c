@@ -1,9 +1,18 @@
+#include "expr.h"
 #include "lsmat/lsarith.h"
+#include "lsmat/lscache.h"
+#include "lsmat/lscsr.h"
 #include "lsmat/lsmat.h"
+#include "lsmat/lsmtx.h"
+#include "lsmat/lsprof.h"
+#include "lsmat/lsrand.h"
+#include "lsmat/lsstats.h"
+#include <inttypes.h>
 #include <malloc.h>
 #include <readline/history.h>
 #include <readline/readline.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,13 +20,19 @@
 #include <time.h>
 
 #ifdef _WIN32
+#include <io.h>
 #define get_malloc_size _msize
+#define isatty _isatty
+#define STDIN_FILENO 0
 #else
+#include <unistd.h>
 #define get_malloc_size malloc_usable_size
 #endif
 
-#define N_MATS 512
+#define MIN_BUCKETS 64u
 #define MAX_LEN_IDENT 16
+#define CACHE_DEFAULT_LIMIT ((size_t)64 << 20)
+#define BATCH_BUF_SIZE ((size_t)1 << 20)
 #define S_UPR_ALPHANUMERIC "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
 #define S_OPS "+-*."
 
@@ -36,9 +51,9 @@ static int timespec_sub(timespec_t x, timespec_t y, timespec_t *restrict result)
         y.tv_nsec -= 1000000000 * nsec;
         y.tv_sec += nsec;
     }
-    if (x.tv_nsec - y.tv_nsec > 100000000) {
-        int nsec = (x.tv_nsec - y.tv_nsec) / 100000000;
-        y.tv_nsec += 100000000 * nsec;
+    if (x.tv_nsec - y.tv_nsec > 1000000000) {
+        int nsec = (x.tv_nsec - y.tv_nsec) / 1000000000;
+        y.tv_nsec += 1000000000 * nsec;
         y.tv_sec -= nsec;
     }
 
@@ -51,7 +66,8 @@ static int timespec_sub(timespec_t x, timespec_t y, timespec_t *restrict result)
     return x.tv_sec < y.tv_sec;
 }
 
-static size_t allocated_size = 0;
+// The library may allocate from worker threads.
+static atomic_size_t allocated_size = 0;
 
 static void alloc_hook(void *ptr) {
     allocated_size += get_malloc_size(ptr);
@@ -61,6 +77,10 @@ static void free_hook(void *ptr) {
     allocated_size -= get_malloc_size(ptr);
 }
 
+static size_t alloc_meter(void) {
+    return allocated_size;
+}
+
 typedef enum cmd_errno_ {
     CONT_OK,
     CONT_ERR,
@@ -69,6 +89,12 @@ typedef enum cmd_errno_ {
 
 typedef cmd_errno_t (*cmd_handler_t)(void);
 
+typedef enum record_fmt_ {
+    RECORD_NONE,
+    RECORD_JSON,
+    RECORD_CSV,
+} record_fmt_t;
+
 typedef struct CmdHandlerPair_ {
     const char *const cmd;
     const cmd_handler_t handler;
@@ -79,12 +105,24 @@ static cmd_errno_t cmd_handler_new(void);
 static cmd_errno_t cmd_handler_fillrand(void);
 static cmd_errno_t cmd_handler_fillident(void);
 static cmd_errno_t cmd_handler_set(void);
+static cmd_errno_t cmd_handler_del(void);
 static cmd_errno_t cmd_handler_eval(void);
+static cmd_errno_t cmd_handler_axpy(void);
+static cmd_errno_t cmd_handler_scale(void);
 static cmd_errno_t cmd_handler_shapeof(void);
 static cmd_errno_t cmd_handler_disp(void);
 static cmd_errno_t cmd_handler_dispnzt(void);
 static cmd_errno_t cmd_handler_dbg_nodes(void);
 static cmd_errno_t cmd_handler_dbg_mem(void);
+static cmd_errno_t cmd_handler_threads(void);
+static cmd_errno_t cmd_handler_spmv(void);
+static cmd_errno_t cmd_handler_cache(void);
+static cmd_errno_t cmd_handler_stats(void);
+static cmd_errno_t cmd_handler_prof(void);
+static cmd_errno_t cmd_handler_save(void);
+static cmd_errno_t cmd_handler_load(void);
+static cmd_errno_t cmd_handler_import(void);
+static cmd_errno_t cmd_handler_export(void);
 static cmd_errno_t cmd_handler_quit(void);
 static cmd_errno_t cmd_handler_help(void);
 static cmd_errno_t cmd_handler_license(void);
@@ -92,45 +130,244 @@ static cmd_errno_t cmd_handler_null(void);
 
 static const CmdHandlerPair_t CMDS[] = {
     {.cmd = "new", .handler = cmd_handler_new, .help_str = "new <ID> <DIM0> <DIM1>"},
-    {.cmd = "fillrand", .handler = cmd_handler_fillrand, .help_str = "fillrand <ID>"},
+    {.cmd = "fillrand",
+     .handler = cmd_handler_fillrand,
+     .help_str = "fillrand <ID> [DENSITY] [SEED] [PATTERN]"},
     {.cmd = "fillident", .handler = cmd_handler_fillident, .help_str = "fillident <ID>"},
     {.cmd = "set", .handler = cmd_handler_set, .help_str = "set <ID> <I0> <I1> <VAL>"},
-    {.cmd = "eval", .handler = cmd_handler_eval, .help_str = "eval <DEST>=<EXPR>"},
+    {.cmd = "del", .handler = cmd_handler_del, .help_str = "del <ID>"},
+    {.cmd = "eval", .handler = cmd_handler_eval, .help_str = "eval <DEST>[+-]=<EXPR>"},
+    {.cmd = "axpy", .handler = cmd_handler_axpy, .help_str = "axpy <Y> <ALPHA> <X>"},
+    {.cmd = "scale", .handler = cmd_handler_scale, .help_str = "scale <ID> <ALPHA>"},
     {.cmd = "shapeof", .handler = cmd_handler_shapeof, .help_str = "shapeof <ID>"},
     {.cmd = "disp", .handler = cmd_handler_disp, .help_str = "disp <ID> <PREC>"},
     {.cmd = "dispnzt", .handler = cmd_handler_dispnzt, .help_str = "dispnzt <ID> <PREC>"},
     {.cmd = "dbg_nodes", .handler = cmd_handler_dbg_nodes, .help_str = "dbg_nodes <ID>"},
     {.cmd = "dbg_mem", .handler = cmd_handler_dbg_mem, .help_str = "dbg_mem"},
+    {.cmd = "threads", .handler = cmd_handler_threads, .help_str = "threads [N]"},
+    {.cmd = "spmv", .handler = cmd_handler_spmv, .help_str = "spmv <ID> <NVECS> <REPS>"},
+    {.cmd = "cache", .handler = cmd_handler_cache, .help_str = "cache [BYTES|clear]"},
+    {.cmd = "stats", .handler = cmd_handler_stats, .help_str = "stats <ID>"},
+    {.cmd = "prof", .handler = cmd_handler_prof, .help_str = "prof"},
+    {.cmd = "save", .handler = cmd_handler_save, .help_str = "save <ID> <FILE>"},
+    {.cmd = "load", .handler = cmd_handler_load, .help_str = "load <ID> <FILE>"},
+    {.cmd = "import", .handler = cmd_handler_import, .help_str = "import <ID> <FILE>"},
+    {.cmd = "export", .handler = cmd_handler_export, .help_str = "export <ID> <FILE>"},
     {.cmd = "quit", .handler = cmd_handler_quit, .help_str = "quit"},
     {.cmd = "help", .handler = cmd_handler_help, .help_str = "help"},
     {.cmd = "license", .handler = cmd_handler_license, .help_str = "license"},
     {.cmd = NULL, .handler = cmd_handler_null, .help_str = NULL},
 };
 
-static char mat_idents[MAX_LEN_IDENT][N_MATS] = {0};
-static LSMat_t *mats[N_MATS] = {0};
+typedef struct MatEntry_ {
+    char ident[MAX_LEN_IDENT];
+    uint64_t hash;
+    // Next entry in the bucket; for deleted entries, the next free one.
+    size_t chain;
+    LSMat_t *mat;
+    // Loaded files stay mapped, with mat left NULL, until linked storage is needed.
+    LSMatCsr_t *mapped;
+} MatEntry_t;
+
+// Identifiers hash into chains of entry indices. Deleted entries are reused.
+static MatEntry_t *mat_entries = NULL;
+static size_t n_entries = 0;
+static size_t cap_entries = 0;
+static size_t free_entry = SIZE_MAX;
+static size_t *mat_buckets = NULL;
+static size_t n_buckets = 0;
 static size_t n_mats = 0;
+static LSCache_t result_cache;
+// Matrix the running command created or wrote to, reported in batch records.
+static size_t result_idx = SIZE_MAX;
+static bool batch_mode = false;
+static record_fmt_t record_fmt = RECORD_NONE;
+static FILE *record_out = NULL;
+static size_t line_no = 0;
+static size_t n_failed = 0;
+
+// FNV-1a, as the result cache uses.
+static uint64_t hash_ident(const char *restrict ident) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (const char *p = ident; *p != '\0'; p++) {
+        h ^= (unsigned char)*p;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
 
 static bool find_ident(const char *restrict ident, size_t *restrict out) {
     size_t idx_mat = SIZE_MAX;
-    bool found = false;
-    for (size_t i = 0; i < n_mats; i++) {
-        if (strcmp(mat_idents[i], ident) == 0) {
-            idx_mat = i;
-            found = true;
-            break;
+    if (n_buckets > 0) {
+        const uint64_t h = hash_ident(ident);
+        idx_mat = mat_buckets[h & (n_buckets - 1)];
+        while (idx_mat != SIZE_MAX && (mat_entries[idx_mat].hash != h ||
+                                       strcmp(mat_entries[idx_mat].ident, ident) != 0)) {
+            idx_mat = mat_entries[idx_mat].chain;
         }
     }
     if (out != NULL) {
         *out = idx_mat;
     }
-    return found;
+    return idx_mat != SIZE_MAX;
+}
+
+// Linked storage for a matrix, thawing it out of its file on first use.
+static LSMat_t *mat_of(size_t idx_mat) {
+    MatEntry_t *const e = mat_entries + idx_mat;
+    if (e->mat == NULL) {
+        e->mat = LSMatCsr_thaw(e->mapped);
+        if (e->mat == NULL) {
+            printf("ERROR: Damaged matrix data in '%s'\n", e->ident);
+            return NULL;
+        }
+        LSMatCsr_free(e->mapped);
+        e->mapped = NULL;
+    }
+    return e->mat;
 }
 
-static void push_ident_and_mat(const char *restrict ident, LSMat_t *restrict mat) {
-    strcpy(mat_idents[n_mats], ident);
-    mats[n_mats] = mat;
+/*
+ * Matrices may be shared with the result cache or other identifiers; take a
+ * private copy before writing to one.
+ */
+static LSMat_t *mat_for_write(size_t idx_mat) {
+    result_idx = idx_mat;
+    LSMat_t *const mat = mat_of(idx_mat);
+    if (mat == NULL || !LSMat_is_shared(mat)) {
+        return mat;
+    }
+    LSMat_t *const copy = LSMatView_realize(LSMatView_from(mat));
+    if (copy == NULL) {
+        puts("ERROR: Matrix copy failed");
+        return NULL;
+    }
+    LSMat_free(mat);
+    mat_entries[idx_mat].mat = copy;
+    return copy;
+}
+
+static size_t nnz_of(size_t idx_mat) {
+    const MatEntry_t *const e = mat_entries + idx_mat;
+    if (e->mapped != NULL) {
+        return e->mapped->nnz;
+    }
+    size_t nnz = 0;
+    for (size_t i = 0; i < e->mat->shape[LSMAT_AXIS_0]; i++) {
+        nnz += e->mat->heads[LSMAT_AXIS_0][i].len;
+    }
+    return nnz;
+}
+
+static bool grow_buckets(void) {
+    const size_t n = n_buckets > 0 ? 2 * n_buckets : MIN_BUCKETS;
+    size_t *const buckets = malloc(n * sizeof(size_t));
+    if (buckets == NULL) {
+        return false;
+    }
+    for (size_t b = 0; b < n; b++) {
+        buckets[b] = SIZE_MAX;
+    }
+    for (size_t i = 0; i < n_entries; i++) {
+        MatEntry_t *const e = mat_entries + i;
+        if (e->ident[0] != '\0') {
+            e->chain = buckets[e->hash & (n - 1)];
+            buckets[e->hash & (n - 1)] = i;
+        }
+    }
+    free(mat_buckets);
+    mat_buckets = buckets;
+    n_buckets = n;
+    return true;
+}
+
+/*
+ * Register a matrix, in linked storage or mapped from a file, under a name
+ * validate_new_ident has accepted. The registry takes over both; they are
+ * freed if it cannot.
+ */
+static bool push_ident_and_mat(const char *restrict ident, LSMat_t *restrict mat,
+                               LSMatCsr_t *restrict csr) {
+    bool ok = n_mats < n_buckets || grow_buckets();
+    size_t idx_mat = free_entry;
+    if (ok && idx_mat == SIZE_MAX && n_entries == cap_entries) {
+        const size_t cap = cap_entries > 0 ? 2 * cap_entries : MIN_BUCKETS;
+        MatEntry_t *const entries = realloc(mat_entries, cap * sizeof(MatEntry_t));
+        ok = entries != NULL;
+        if (ok) {
+            mat_entries = entries;
+            cap_entries = cap;
+        }
+    }
+    if (!ok) {
+        puts("ERROR: Out of memory for identifiers");
+        if (mat != NULL) {
+            LSMat_free(mat);
+        }
+        LSMatCsr_free(csr);
+        return false;
+    }
+    if (idx_mat != SIZE_MAX) {
+        free_entry = mat_entries[idx_mat].chain;
+    } else {
+        idx_mat = n_entries++;
+    }
+    MatEntry_t *const e = mat_entries + idx_mat;
+    strcpy(e->ident, ident);
+    e->hash = hash_ident(ident);
+    e->mat = mat;
+    e->mapped = csr;
+    e->chain = mat_buckets[e->hash & (n_buckets - 1)];
+    mat_buckets[e->hash & (n_buckets - 1)] = idx_mat;
     n_mats++;
+    result_idx = idx_mat;
+    return true;
+}
+
+static void del_ident(size_t idx_mat) {
+    MatEntry_t *const e = mat_entries + idx_mat;
+    size_t *slot = mat_buckets + (e->hash & (n_buckets - 1));
+    while (*slot != idx_mat) {
+        slot = &mat_entries[*slot].chain;
+    }
+    *slot = e->chain;
+    if (e->mat != NULL) {
+        // Cached results built from the matrix hold memory no lookup can reach again.
+        LSCache_drop_id(&result_cache, e->mat->id);
+        LSMat_free(e->mat);
+    }
+    if (e->mapped != NULL) {
+        LSMatCsr_free(e->mapped);
+    }
+    memset(e, 0, sizeof(MatEntry_t));
+    e->chain = free_entry;
+    free_entry = idx_mat;
+    n_mats--;
+    if (result_idx == idx_mat) {
+        result_idx = SIZE_MAX;
+    }
+}
+
+static bool validate_new_ident(const char *restrict name) {
+    bool found = find_ident(name, NULL);
+    if (found) {
+        printf("ERROR: Identifier already defined: '%s'\n", name);
+        return false;
+    }
+    unsigned long name_len = strlen(name);
+    if (name_len == 0) {
+        puts("ERROR: Missing identifier");
+        return false;
+    }
+    if (name_len > MAX_LEN_IDENT - 1) {
+        printf("ERROR: Identifier too long (%d max)\n", MAX_LEN_IDENT);
+        return false;
+    }
+    if (strspn(name, S_UPR_ALPHANUMERIC) != name_len) {
+        puts("ERROR: Invalid identifier; allowed chars: '" S_UPR_ALPHANUMERIC "'");
+        return false;
+    }
+    return true;
 }
 
 static char *new_fmt_into(const char *restrict fmt, ...) {
@@ -157,18 +394,7 @@ static cmd_errno_t cmd_handler_new(void) {
     const long dim0 = strtol(s_dim0, NULL, 10);
     const long dim1 = strtol(s_dim1, NULL, 10);
 
-    bool found = find_ident(name, NULL);
-    if (found) {
-        printf("ERROR: Identifier already defined: '%s'\n", name);
-        return CONT_ERR;
-    }
-    unsigned long name_len = strlen(name);
-    if (name_len > MAX_LEN_IDENT - 1) {
-        printf("ERROR: Identifier too long (%d max)\n", MAX_LEN_IDENT);
-        return CONT_ERR;
-    }
-    if (strspn(name, S_UPR_ALPHANUMERIC) != name_len) {
-        puts("ERROR: Invalid identifier; allowed chars: '" S_UPR_ALPHANUMERIC "'");
+    if (!validate_new_ident(name)) {
         return CONT_ERR;
     }
 
@@ -182,12 +408,20 @@ static cmd_errno_t cmd_handler_new(void) {
         puts("FATAL: Matrix creation failed");
         return QUIT;
     }
-    push_ident_and_mat(name, m);
-    return CONT_OK;
+    return push_ident_and_mat(name, m, NULL) ? CONT_OK : CONT_ERR;
 }
 
+static const char *const PATTERN_NAMES[LSRAND_PATTERN_COUNT_] = {
+    [LSRAND_UNIFORM] = "uniform",
+    [LSRAND_BANDED] = "banded",
+    [LSRAND_POWERLAW] = "powerlaw",
+};
+
 static cmd_errno_t cmd_handler_fillrand(void) {
     const char *name = strtok(NULL, " ");
+    const char *s_density = strtok(NULL, " ");
+    const char *s_seed = strtok(NULL, " ");
+    const char *s_pattern = strtok(NULL, " ");
     if (!name) {
         puts("ERROR: Missing arguments; type help to learn more");
         return CONT_ERR;
@@ -198,16 +432,45 @@ static cmd_errno_t cmd_handler_fillrand(void) {
         printf("ERROR: Undefined identifier '%s'\n", name);
         return CONT_ERR;
     }
-    LSMat_t *mat = mats[idx_mat];
-    srand(time(NULL));
-    for (size_t i = 0; i < mat->shape[LSMAT_AXIS_0]; i++) {
-        for (size_t j = 0; j < mat->shape[LSMAT_AXIS_1]; j++) {
-            if (LSMat_set(mat, i, j, (double)rand() / (double)RAND_MAX) != LSMAT_OK) {
-                puts("FATAL: Matrix element set failed");
-                return QUIT;
-            }
+    double density = 1.;
+    if (s_density != NULL) {
+        char *end = NULL;
+        density = strtod(s_density, &end);
+        if (end == s_density || *end != '\0' || !(density >= 0. && density <= 1.)) {
+            puts("ERROR: Invalid DENSITY; number in [0, 1] wanted");
+            return CONT_ERR;
+        }
+    }
+    uint64_t seed = (uint64_t)time(NULL);
+    if (s_seed != NULL) {
+        char *end = NULL;
+        seed = strtoull(s_seed, &end, 10);
+        if (end == s_seed || *end != '\0') {
+            puts("ERROR: Invalid SEED; non-negative integer wanted");
+            return CONT_ERR;
+        }
+    }
+    lsrand_pattern_t pattern = LSRAND_UNIFORM;
+    if (s_pattern != NULL) {
+        while (pattern < LSRAND_PATTERN_COUNT_ && strcmp(s_pattern, PATTERN_NAMES[pattern]) != 0) {
+            pattern++;
+        }
+        if (pattern == LSRAND_PATTERN_COUNT_) {
+            puts("ERROR: Invalid PATTERN; uniform, banded or powerlaw wanted");
+            return CONT_ERR;
         }
     }
+    LSMat_t *mat = mat_for_write(idx_mat);
+    if (mat == NULL) {
+        return CONT_ERR;
+    }
+    if (LSMat_fill_random(mat, density, seed, pattern) != LSMAT_OK) {
+        puts("FATAL: Matrix fill failed");
+        return QUIT;
+    }
+    if (s_seed == NULL) {
+        printf("INFO: Seed %" PRIu64 "\n", seed);
+    }
     return CONT_OK;
 }
 
@@ -223,20 +486,33 @@ static cmd_errno_t cmd_handler_fillident(void) {
         printf("ERROR: Undefined identifier '%s'\n", name);
         return CONT_ERR;
     }
-    LSMat_t *mat = mats[idx_mat];
+    LSMat_t *mat = mat_for_write(idx_mat);
+    if (mat == NULL) {
+        return CONT_ERR;
+    }
     if (mat->shape[LSMAT_AXIS_0] != mat->shape[LSMAT_AXIS_1]) {
         puts("ERROR: Not a square matrix");
         return CONT_ERR;
     }
-    if (LSMat_zero(mat) != LSMAT_OK) {
-        puts("FATAL: Matrix zeroing failed");
+    const size_t n = mat->shape[LSMAT_AXIS_0];
+    size_t *idx = calloc(n, sizeof(size_t));
+    double *v = calloc(n, sizeof(double));
+    if (!idx || !v) {
+        free(idx);
+        free(v);
+        puts("FATAL: Triplet allocation failed");
         return QUIT;
     }
-    for (size_t i = 0; i < mat->shape[LSMAT_AXIS_0]; i++) {
-        if (LSMat_set(mat, i, i, 1.0) != LSMAT_OK) {
-            puts("FATAL: Matrix element set failed");
-            return QUIT;
-        }
+    for (size_t i = 0; i < n; i++) {
+        idx[i] = i;
+        v[i] = 1.0;
+    }
+    lsmat_errno_t err = LSMat_build(mat, idx, idx, v, n, LSMAT_DUP_REJECT);
+    free(idx);
+    free(v);
+    if (err != LSMAT_OK) {
+        puts("FATAL: Matrix build failed");
+        return QUIT;
     }
     return CONT_OK;
 }
@@ -259,7 +535,11 @@ static cmd_errno_t cmd_handler_set(void) {
         printf("ERROR: Undefined identifier '%s'\n", name);
         return CONT_ERR;
     }
-    lsmat_errno_t err = LSMat_set(mats[idx_mat], i0, i1, val);
+    LSMat_t *mat = mat_for_write(idx_mat);
+    if (mat == NULL) {
+        return CONT_ERR;
+    }
+    lsmat_errno_t err = LSMat_set(mat, i0, i1, val);
     if (err != LSMAT_OK) {
         puts("ERROR: Failed to set value");
         return CONT_ERR;
@@ -267,127 +547,156 @@ static cmd_errno_t cmd_handler_set(void) {
     return CONT_OK;
 }
 
-static cmd_errno_t cmd_handler_eval(void) {
-    const char *dest_name = strtok(NULL, "=");
-    char *expr = strtok(NULL, "=");
-    if (!dest_name || !expr) {
+static cmd_errno_t cmd_handler_del(void) {
+    const char *name = strtok(NULL, " ");
+    if (!name) {
         puts("ERROR: Missing arguments; type help to learn more");
         return CONT_ERR;
     }
-
-    bool found = find_ident(dest_name, NULL);
-    if (found) {
-        printf("ERROR: Identifier already defined: '%s'\n", dest_name);
+    size_t idx_mat = SIZE_MAX;
+    if (!find_ident(name, &idx_mat)) {
+        printf("ERROR: Undefined identifier '%s'\n", name);
         return CONT_ERR;
     }
-    // Check if the second part contains .T
-    if (strstr(expr, ".T")) {
-        char *arg1 = strtok(expr, ".T");
-        if (!arg1) {
-            puts("ERROR: Invalid syntax; missing unary operand");
-            return CONT_ERR;
-        }
-        size_t idx_arg1 = SIZE_MAX;
-        bool found = find_ident(arg1, &idx_arg1);
-        if (!found) {
-            printf("ERROR: Undefined identifier: '%s'\n", arg1);
-            return CONT_ERR;
-        }
-        LSMat_t *m = LSMatView_realize(LSArith_mat_T(mats[idx_arg1]));
-        push_ident_and_mat(dest_name, m);
-    } else {
-        const char *op = strpbrk(expr, "+-*");
-        if (!op) {
-            puts("ERROR: Invalid syntax; missing operator");
-            return CONT_ERR;
-        }
-        const char ch_op = op[0];
+    del_ident(idx_mat);
+    return CONT_OK;
+}
 
-        char *arg1 = strtok(expr, "+-*");
-        if (!arg1) {
-            puts("ERROR: Invalid syntax; missing 1st binary operand");
-            return CONT_ERR;
-        }
-        size_t idx_arg1 = SIZE_MAX;
-        bool found = find_ident(arg1, &idx_arg1);
-        if (!found) {
-            printf("ERROR: Undefined identifier: '%s'\n", arg1);
-            return CONT_ERR;
-        }
-        LSMat_t *mat_arg1 = mats[idx_arg1];
+static LSMat_t *expr_lookup_ident(const char *name, void *ctx) {
+    (void)ctx;
+    size_t idx_mat = SIZE_MAX;
+    return find_ident(name, &idx_mat) ? mat_of(idx_mat) : NULL;
+}
 
-        char *arg2 = strtok(NULL, "+-*");
-        if (!arg2) {
-            puts("ERROR: Invalid syntax; missing 2nd binary operand");
-            return CONT_ERR;
-        }
-        size_t idx_arg2 = SIZE_MAX;
-        found = find_ident(arg2, &idx_arg2);
-        if (!found) {
-            printf("ERROR: Undefined identifier: '%s'\n", arg2);
+static char *trim_in_place(char *restrict s) {
+    while (*s == ' ') {
+        s++;
+    }
+    size_t len = strlen(s);
+    while (len > 0 && s[len - 1] == ' ') {
+        s[--len] = '\0';
+    }
+    return s;
+}
+
+static cmd_errno_t cmd_handler_eval(void) {
+    char *rest = strtok(NULL, "");
+    char *eq = rest != NULL ? strchr(rest, '=') : NULL;
+    if (!eq) {
+        puts("ERROR: Missing arguments; type help to learn more");
+        return CONT_ERR;
+    }
+    *eq = '\0';
+    char *dest_name = trim_in_place(rest);
+    const char *src = trim_in_place(eq + 1);
+
+    // DEST+=EXPR and DEST-=EXPR accumulate into an existing matrix.
+    double alpha = 0.;
+    const size_t dest_len = strlen(dest_name);
+    if (dest_len > 0 && (dest_name[dest_len - 1] == '+' || dest_name[dest_len - 1] == '-')) {
+        alpha = dest_name[dest_len - 1] == '+' ? 1. : -1.;
+        dest_name[dest_len - 1] = '\0';
+        dest_name = trim_in_place(dest_name);
+    }
+    size_t idx_dest = SIZE_MAX;
+    if (alpha != 0.) {
+        if (!find_ident(dest_name, &idx_dest)) {
+            printf("ERROR: Undefined identifier '%s'\n", dest_name);
             return CONT_ERR;
         }
-        LSMat_t *mat_arg2 = mats[idx_arg2];
-
-        switch (ch_op) {
-        case '+': {
-            LSMat_t *m = LSMat_new(mat_arg1->shape[LSMAT_AXIS_0], mat_arg1->shape[LSMAT_AXIS_1]);
-            lsarith_errno_t err = LSArith_mat_add(mat_arg1, mat_arg2, m);
-            switch (err) {
-            case LSARITH_OK:
-                push_ident_and_mat(dest_name, m);
-                break;
-            case LSARITH_E_SHAPE:
-                printf("ERROR: Inconsistent shapes for '%c': (%zu,%zu) and (%zu,%zu)\n", ch_op,
-                       mat_arg1->shape[LSMAT_AXIS_0], mat_arg1->shape[LSMAT_AXIS_1],
-                       mat_arg2->shape[LSMAT_AXIS_0], mat_arg2->shape[LSMAT_AXIS_1]);
-                return CONT_ERR;
-            default:
-                puts("FATAL: General arithmetic error");
-                return QUIT;
-            }
-            break;
-        }
-        case '-': {
-            LSMat_t *m = LSMat_new(mat_arg1->shape[LSMAT_AXIS_0], mat_arg1->shape[LSMAT_AXIS_1]);
-            lsarith_errno_t err = LSArith_mat_sub(mat_arg1, mat_arg2, m);
-            switch (err) {
-            case LSARITH_OK:
-                push_ident_and_mat(dest_name, m);
-                break;
-            case LSARITH_E_SHAPE:
-                printf("ERROR: Inconsistent shapes for '%c': (%zu,%zu) and (%zu,%zu)\n", ch_op,
-                       mat_arg1->shape[LSMAT_AXIS_0], mat_arg1->shape[LSMAT_AXIS_1],
-                       mat_arg2->shape[LSMAT_AXIS_0], mat_arg2->shape[LSMAT_AXIS_1]);
-                return CONT_ERR;
-            default:
-                puts("FATAL: General arithmetic error");
-                return QUIT;
-            }
-            break;
-        }
-        case '*': {
-            LSMat_t *m = LSMat_new(mat_arg1->shape[LSMAT_AXIS_0], mat_arg2->shape[LSMAT_AXIS_1]);
-            lsarith_errno_t err = LSArith_mat_mul(mat_arg1, mat_arg2, m);
-            switch (err) {
-            case LSARITH_OK:
-                push_ident_and_mat(dest_name, m);
-                break;
-            case LSARITH_E_SHAPE:
-                printf("ERROR: Inconsistent shapes for '%c': (%zu,%zu) and (%zu,%zu)\n", ch_op,
-                       mat_arg1->shape[LSMAT_AXIS_0], mat_arg1->shape[LSMAT_AXIS_1],
-                       mat_arg2->shape[LSMAT_AXIS_0], mat_arg2->shape[LSMAT_AXIS_1]);
-                return CONT_ERR;
-            default:
-                puts("FATAL: General arithmetic error");
-                return QUIT;
-            }
-            break;
-        }
-        default:
-            printf("FATAL: Unreachable: '%c'\n", ch_op);
+        if (mat_for_write(idx_dest) == NULL) {
+            puts("FATAL: Matrix copy failed");
             return QUIT;
         }
+    } else if (!validate_new_ident(dest_name)) {
+        return CONT_ERR;
+    }
+    if (*src == '\0') {
+        puts("ERROR: Invalid syntax; missing expression");
+        return CONT_ERR;
+    }
+
+    Expr_t *expr = NULL;
+    expr_errno_t err = expr_compile(src, expr_lookup_ident, NULL, &expr);
+    LSMat_t *m = NULL;
+    if (err == EXPR_OK) {
+        expr_use_cache(expr, &result_cache, alloc_meter);
+        err = alpha != 0. ? expr_eval_into(expr, mat_entries[idx_dest].mat, alpha)
+                          : expr_eval(expr, &m);
+    }
+    switch (err) {
+    case EXPR_OK:
+        expr_free(expr);
+        return m == NULL || push_ident_and_mat(dest_name, m, NULL) ? CONT_OK : CONT_ERR;
+    case EXPR_E_ARITH:
+        expr_free(expr);
+        puts("FATAL: General arithmetic error");
+        return QUIT;
+    default:
+        printf("ERROR: %s\n", expr_message(expr));
+        expr_free(expr);
+        return CONT_ERR;
+    }
+}
+
+static cmd_errno_t cmd_handler_axpy(void) {
+    const char *name_y = strtok(NULL, " ");
+    const char *s_alpha = strtok(NULL, " ");
+    const char *name_x = strtok(NULL, " ");
+    if (!name_y || !s_alpha || !name_x) {
+        puts("ERROR: Missing arguments; type help to learn more");
+        return CONT_ERR;
+    }
+    const double alpha = strtod(s_alpha, NULL);
+    size_t idx_y = SIZE_MAX;
+    size_t idx_x = SIZE_MAX;
+    if (!find_ident(name_y, &idx_y)) {
+        printf("ERROR: Undefined identifier '%s'\n", name_y);
+        return CONT_ERR;
+    }
+    if (!find_ident(name_x, &idx_x)) {
+        printf("ERROR: Undefined identifier '%s'\n", name_x);
+        return CONT_ERR;
+    }
+    LSMat_t *mat_y = mat_for_write(idx_y);
+    const LSMat_t *mat_x = mat_of(idx_x);
+    if (mat_y == NULL || mat_x == NULL) {
+        return CONT_ERR;
+    }
+    switch (LSArith_mat_axpy(mat_y, alpha, mat_x, true)) {
+    case LSARITH_OK:
+        return CONT_OK;
+    case LSARITH_E_SHAPE:
+        printf("ERROR: Inconsistent shapes for axpy: (%zu,%zu) and (%zu,%zu)\n",
+               mat_y->shape[LSMAT_AXIS_0], mat_y->shape[LSMAT_AXIS_1],
+               mat_x->shape[LSMAT_AXIS_0], mat_x->shape[LSMAT_AXIS_1]);
+        return CONT_ERR;
+    default:
+        puts("FATAL: General arithmetic error");
+        return QUIT;
+    }
+}
+
+static cmd_errno_t cmd_handler_scale(void) {
+    const char *name = strtok(NULL, " ");
+    const char *s_alpha = strtok(NULL, " ");
+    if (!name || !s_alpha) {
+        puts("ERROR: Missing arguments; type help to learn more");
+        return CONT_ERR;
+    }
+    const double alpha = strtod(s_alpha, NULL);
+    size_t idx_mat = SIZE_MAX;
+    if (!find_ident(name, &idx_mat)) {
+        printf("ERROR: Undefined identifier '%s'\n", name);
+        return CONT_ERR;
+    }
+    LSMat_t *mat = mat_for_write(idx_mat);
+    if (mat == NULL) {
+        return CONT_ERR;
+    }
+    if (LSArith_mat_scale(mat, alpha, true) != LSARITH_OK) {
+        puts("FATAL: General arithmetic error");
+        return QUIT;
     }
     return CONT_OK;
 }
@@ -404,8 +713,9 @@ static cmd_errno_t cmd_handler_shapeof(void) {
         printf("ERROR: Undefined identifier '%s'\n", name);
         return CONT_ERR;
     }
-    const LSMat_t *mat = mats[idx_mat];
-    printf("(%zu,%zu)\n", mat->shape[LSMAT_AXIS_0], mat->shape[LSMAT_AXIS_1]);
+    const MatEntry_t *const e = mat_entries + idx_mat;
+    const size_t *shape = e->mat != NULL ? e->mat->shape : e->mapped->shape;
+    printf("(%zu,%zu)\n", shape[LSMAT_AXIS_0], shape[LSMAT_AXIS_1]);
     return CONT_OK;
 }
 
@@ -428,10 +738,12 @@ static cmd_errno_t cmd_handler_disp(void) {
         return CONT_ERR;
     }
     char *fmt_buf = new_fmt_into("%%.%ldf ", prec);
-    const LSMat_t *mat = mats[idx_mat];
-    for (size_t i = 0; i < mat->shape[LSMAT_AXIS_0]; i++) {
-        for (size_t j = 0; j < mat->shape[LSMAT_AXIS_1]; j++) {
-            printf(fmt_buf, LSMat_at(mat, i, j));
+    const LSMat_t *mat = mat_entries[idx_mat].mat;
+    const LSMatCsr_t *csr = mat_entries[idx_mat].mapped;
+    const size_t *shape = mat != NULL ? mat->shape : csr->shape;
+    for (size_t i = 0; i < shape[LSMAT_AXIS_0]; i++) {
+        for (size_t j = 0; j < shape[LSMAT_AXIS_1]; j++) {
+            printf(fmt_buf, mat != NULL ? LSMat_at(mat, i, j) : LSMatCsr_at(csr, i, j));
         }
         putchar('\n');
     }
@@ -458,13 +770,24 @@ static cmd_errno_t cmd_handler_dispnzt(void) {
         return CONT_ERR;
     }
     char *fmt_buf = new_fmt_into("(%%zu,%%zu): %%.%ldf\n", prec);
-    const LSMat_t *mat = mats[idx_mat];
+    const LSMatCsr_t *csr = mat_entries[idx_mat].mapped;
+    if (csr != NULL) {
+        for (size_t i = 0; i < csr->shape[LSMAT_AXIS_0]; i++) {
+            for (size_t k = csr->ptr[i]; k < csr->ptr[i + 1]; k++) {
+                printf(fmt_buf, i, csr->idx[k], csr->v[k]);
+            }
+        }
+        free(fmt_buf);
+        return CONT_OK;
+    }
+    const LSMat_t *mat = mat_entries[idx_mat].mat;
     for (size_t i = 0; i < mat->shape[LSMAT_AXIS_0]; i++) {
-        LSMatHead_t h = mat->heads[LSMAT_AXIS_0][i];
-        LSMatCell_t *p = h.first_cell;
-        while (p != NULL) {
-            printf(fmt_buf, p->axes[LSMAT_AXIS_0].i, p->axes[LSMAT_AXIS_1].i, p->v);
-            p = p->axes[LSMAT_AXIS_0].next;
+        LSMatIter_t it;
+        LSMatIter_init(&it, mat, LSMAT_AXIS_0, i);
+        size_t j = 0;
+        double v = 0.;
+        while (LSMatIter_next(&it, &j, &v)) {
+            printf(fmt_buf, i, j, v);
         }
     }
     free(fmt_buf);
@@ -484,13 +807,19 @@ static cmd_errno_t cmd_handler_dbg_nodes(void) {
         return CONT_ERR;
     }
     size_t n = 0;
-    const LSMat_t *mat = mats[idx_mat];
+    const LSMat_t *mat = mat_of(idx_mat);
+    if (mat == NULL) {
+        return CONT_ERR;
+    }
     for (size_t i = 0; i < mat->shape[LSMAT_AXIS_0]; i++) {
-        LSMatHead_t h = mat->heads[LSMAT_AXIS_0][i];
-        LSMatCell_t *p = h.first_cell;
+        const LSMatHead_t *h = mat->heads[LSMAT_AXIS_0] + i;
+        if (h->dense != NULL) {
+            continue;
+        }
+        const LSMatCell_t *p = h->first_cell;
         while (p != NULL) {
             n++;
-            p = p->axes[LSMAT_AXIS_0].next;
+            p = LSMatCell_succ_of(p, LSMAT_AXIS_1);
         }
     }
     printf("%zu\n", n);
@@ -498,7 +827,320 @@ static cmd_errno_t cmd_handler_dbg_nodes(void) {
 }
 
 static cmd_errno_t cmd_handler_dbg_mem(void) {
-    printf("Allocated: %zuB\n", allocated_size);
+    printf("Allocated: %zuB\n", atomic_load(&allocated_size));
+    return CONT_OK;
+}
+
+static cmd_errno_t cmd_handler_threads(void) {
+    const char *s_n = strtok(NULL, " ");
+    if (!s_n) {
+        printf("%zu\n", LSArith_threads());
+        return CONT_OK;
+    }
+    const long n = strtol(s_n, NULL, 10);
+    if (n <= 0) {
+        puts("ERROR: Invalid N; positive integer wanted");
+        return CONT_ERR;
+    }
+    LSArith_set_threads(n);
+    return CONT_OK;
+}
+
+static double timespec_to_sec(timespec_t t) {
+    return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+static cmd_errno_t cmd_handler_spmv(void) {
+    const char *name = strtok(NULL, " ");
+    const char *s_n_vecs = strtok(NULL, " ");
+    const char *s_reps = strtok(NULL, " ");
+    if (!name || !s_n_vecs || !s_reps) {
+        puts("ERROR: Missing arguments; type help to learn more");
+        return CONT_ERR;
+    }
+    const long n_vecs = strtol(s_n_vecs, NULL, 10);
+    const long reps = strtol(s_reps, NULL, 10);
+    if (n_vecs <= 0 || reps <= 0) {
+        puts("ERROR: Invalid NVECS or REPS; positive integer wanted");
+        return CONT_ERR;
+    }
+    size_t idx_mat = SIZE_MAX;
+    bool found = find_ident(name, &idx_mat);
+    if (!found) {
+        printf("ERROR: Undefined identifier '%s'\n", name);
+        return CONT_ERR;
+    }
+    const LSMat_t *mat = mat_of(idx_mat);
+    if (mat == NULL) {
+        return CONT_ERR;
+    }
+    size_t nnz = 0;
+    for (size_t i = 0; i < mat->shape[LSMAT_AXIS_0]; i++) {
+        nnz += mat->heads[LSMAT_AXIS_0][i].len;
+    }
+    double *x = calloc(mat->shape[LSMAT_AXIS_1] * n_vecs, sizeof(double));
+    double *y = calloc(mat->shape[LSMAT_AXIS_0] * n_vecs, sizeof(double));
+    LSMatCsr_t *csr = LSMat_freeze(mat, LSMAT_AXIS_0);
+    if (!x || !y || !csr) {
+        free(x);
+        free(y);
+        LSMatCsr_free(csr);
+        puts("FATAL: Operand allocation failed");
+        return QUIT;
+    }
+    for (size_t k = 0; k < mat->shape[LSMAT_AXIS_1] * n_vecs; k++) {
+        x[k] = 1.0;
+    }
+    const double flops = 2.0 * (double)nnz * (double)n_vecs * (double)reps;
+    timespec_t start;
+    timespec_t end;
+    timespec_t diff;
+    printf("ISA: %s\n", LSArith_simd_isa());
+    timespec_get(&start, TIME_UTC);
+    for (long r = 0; r < reps; r++) {
+        LSArith_mat_densemat(mat, x, n_vecs, y);
+    }
+    timespec_get(&end, TIME_UTC);
+    timespec_sub(end, start, &diff);
+    printf("Linked: %.3f GFLOP/s\n", flops / timespec_to_sec(diff) / 1e9);
+    timespec_get(&start, TIME_UTC);
+    for (long r = 0; r < reps; r++) {
+        LSArith_csr_densemat(csr, x, n_vecs, y);
+    }
+    timespec_get(&end, TIME_UTC);
+    timespec_sub(end, start, &diff);
+    printf("CSR: %.3f GFLOP/s\n", flops / timespec_to_sec(diff) / 1e9);
+    free(x);
+    free(y);
+    LSMatCsr_free(csr);
+    return CONT_OK;
+}
+
+static cmd_errno_t cmd_handler_cache(void) {
+    const char *s_arg = strtok(NULL, " ");
+    if (s_arg != NULL && strcmp(s_arg, "clear") == 0) {
+        LSCache_clear(&result_cache);
+    } else if (s_arg != NULL) {
+        char *end = NULL;
+        const unsigned long long limit = strtoull(s_arg, &end, 10);
+        if (end == s_arg || *end != '\0') {
+            puts("ERROR: Invalid BYTES; non-negative integer wanted");
+            return CONT_ERR;
+        }
+        LSCache_set_limit(&result_cache, (size_t)limit);
+    }
+    printf("INFO: Cache: %zu entries, %zu of %zu bytes; %zu hits, %zu misses\n",
+           result_cache.n_entries, result_cache.bytes, result_cache.limit, result_cache.hits,
+           result_cache.misses);
+    return CONT_OK;
+}
+
+static void print_hist(const char *restrict what, const size_t *restrict hist) {
+    printf("INFO: %s lengths:", what);
+    for (size_t b = 0; b < LSMAT_STATS_BINS; b++) {
+        if (hist[b] == 0) {
+            continue;
+        }
+        const size_t lo = LSMatStats_bin_floor(b);
+        if (b + 1 == LSMAT_STATS_BINS) {
+            printf(" [%zu+] %zu", lo, hist[b]);
+        } else if (lo + 1 >= LSMatStats_bin_floor(b + 1)) {
+            printf(" [%zu] %zu", lo, hist[b]);
+        } else {
+            printf(" [%zu-%zu] %zu", lo, LSMatStats_bin_floor(b + 1) - 1, hist[b]);
+        }
+    }
+    putchar('\n');
+}
+
+static cmd_errno_t cmd_handler_stats(void) {
+    const char *name = strtok(NULL, " ");
+    if (!name) {
+        puts("ERROR: Missing arguments; type help to learn more");
+        return CONT_ERR;
+    }
+    size_t idx_mat = SIZE_MAX;
+    if (!find_ident(name, &idx_mat)) {
+        printf("ERROR: Undefined identifier '%s'\n", name);
+        return CONT_ERR;
+    }
+    const LSMat_t *const mat = mat_of(idx_mat);
+    if (mat == NULL) {
+        return CONT_ERR;
+    }
+    LSMatStats_t st;
+    if (LSMat_stats(mat, &st) != LSMAT_OK) {
+        puts("ERROR: Failed to collect statistics");
+        return CONT_ERR;
+    }
+    printf("INFO: Shape (%zu,%zu), %zu non-zeros, %zu dense rows\n", st.shape[LSMAT_AXIS_0],
+           st.shape[LSMAT_AXIS_1], st.nnz, st.n_dense_rows);
+    printf("INFO: Bytes: %zu total; %zu struct, %zu heads, %zu cells, %zu slack, %zu dense, "
+           "%zu index\n",
+           LSMatStats_bytes(&st), st.bytes_struct, st.bytes_heads, st.bytes_cells, st.bytes_slack,
+           st.bytes_dense, st.bytes_index);
+    printf("INFO: Rows: max %zu, mean %.2f; columns: max %zu, mean %.2f\n",
+           st.max_len[LSMAT_AXIS_0], st.mean_len[LSMAT_AXIS_0], st.max_len[LSMAT_AXIS_1],
+           st.mean_len[LSMAT_AXIS_1]);
+    print_hist("Row", st.hist[LSMAT_AXIS_0]);
+    print_hist("Column", st.hist[LSMAT_AXIS_1]);
+    return CONT_OK;
+}
+
+static void print_prof_fn(void *ctx, const LSProfFn_t *fn) {
+    (void)ctx;
+    if (fn->calls == 0) {
+        return;
+    }
+    printf("INFO: %s: %" PRIu64 " calls, %.3f ms total, mean %" PRIu64 " ns, max %" PRIu64
+           " ns;",
+           fn->name, fn->calls, (double)fn->total_ns / 1e6, fn->total_ns / fn->calls, fn->max_ns);
+    for (size_t b = 0; b < LSPROF_BUCKETS; b++) {
+        if (fn->hist[b] == 0) {
+            continue;
+        }
+        if (b + 1 == LSPROF_BUCKETS) {
+            printf(" [%" PRIu64 "+] %" PRIu64, LSProf_bucket_floor(b), fn->hist[b]);
+        } else {
+            printf(" [%" PRIu64 "-%" PRIu64 "] %" PRIu64, LSProf_bucket_floor(b),
+                   LSProf_bucket_floor(b + 1) - 1, fn->hist[b]);
+        }
+    }
+    putchar('\n');
+}
+
+static cmd_errno_t cmd_handler_prof(void) {
+    if (!LSProf_enabled()) {
+        puts("ERROR: Profiling is not built in; rebuild with the prof option");
+        return CONT_ERR;
+    }
+    printf("INFO: Counters:");
+    for (lsprof_counter_t c = 0; c < LSPROF_COUNTER_COUNT_; c++) {
+        printf(" %s %" PRIu64, LSProf_counter_name(c), LSProf_counter(c));
+    }
+    putchar('\n');
+    LSProf_each_fn(print_prof_fn, NULL);
+    LSProf_reset();
+    return CONT_OK;
+}
+
+static cmd_errno_t cmd_handler_save(void) {
+    const char *name = strtok(NULL, " ");
+    const char *path = strtok(NULL, " ");
+    if (!name || !path) {
+        puts("ERROR: Missing arguments; type help to learn more");
+        return CONT_ERR;
+    }
+    size_t idx_mat = SIZE_MAX;
+    if (!find_ident(name, &idx_mat)) {
+        printf("ERROR: Undefined identifier '%s'\n", name);
+        return CONT_ERR;
+    }
+    LSMatCsr_t *csr = mat_entries[idx_mat].mapped;
+    if (csr == NULL) {
+        csr = LSMat_freeze(mat_entries[idx_mat].mat, LSMAT_AXIS_0);
+        if (csr == NULL) {
+            puts("FATAL: Matrix freeze failed");
+            return QUIT;
+        }
+    }
+    const lsmat_errno_t err = LSMatCsr_save(csr, path);
+    if (csr != mat_entries[idx_mat].mapped) {
+        LSMatCsr_free(csr);
+    }
+    if (err != LSMAT_OK) {
+        printf("ERROR: Failed to write '%s'\n", path);
+        return CONT_ERR;
+    }
+    return CONT_OK;
+}
+
+static cmd_errno_t cmd_handler_load(void) {
+    const char *name = strtok(NULL, " ");
+    const char *path = strtok(NULL, " ");
+    if (!name || !path) {
+        puts("ERROR: Missing arguments; type help to learn more");
+        return CONT_ERR;
+    }
+    if (!validate_new_ident(name)) {
+        return CONT_ERR;
+    }
+    LSMatCsr_t *csr = LSMatCsr_load(path);
+    if (csr == NULL) {
+        printf("ERROR: Failed to load '%s'; missing or not a matrix file\n", path);
+        return CONT_ERR;
+    }
+    return push_ident_and_mat(name, NULL, csr) ? CONT_OK : CONT_ERR;
+}
+
+static void report_progress(void *ctx, size_t done, size_t total) {
+    (void)ctx;
+    printf("INFO: %3d%%\r", total > 0 ? (int)(100. * (double)done / (double)total) : 100);
+    fflush(stdout);
+}
+
+// Progress lines only make sense on a terminal.
+static lsmtx_progress_t progress_of(void) {
+    return batch_mode ? NULL : report_progress;
+}
+
+static void report_throughput(const LSMatMtxStats_t *restrict stats, timespec_t start) {
+    timespec_t end;
+    timespec_t diff;
+    timespec_get(&end, TIME_UTC);
+    timespec_sub(end, start, &diff);
+    const double sec = timespec_to_sec(diff);
+    const double mb = (double)stats->bytes / 1e6;
+    printf("INFO: %.1f MB in %.3fs (%.1f MB/s, %.2f Mentries/s)\n", mb, sec, mb / sec,
+           (double)stats->entries / 1e6 / sec);
+}
+
+static cmd_errno_t cmd_handler_import(void) {
+    const char *name = strtok(NULL, " ");
+    const char *path = strtok(NULL, " ");
+    if (!name || !path) {
+        puts("ERROR: Missing arguments; type help to learn more");
+        return CONT_ERR;
+    }
+    if (!validate_new_ident(name)) {
+        return CONT_ERR;
+    }
+    timespec_t start;
+    timespec_get(&start, TIME_UTC);
+    LSMatMtxStats_t stats;
+    LSMat_t *const mat = LSMat_read_mtx(path, progress_of(), NULL, &stats);
+    if (mat == NULL) {
+        printf("ERROR: Failed to import '%s'; missing or malformed Matrix Market file\n", path);
+        return CONT_ERR;
+    }
+    report_throughput(&stats, start);
+    return push_ident_and_mat(name, mat, NULL) ? CONT_OK : CONT_ERR;
+}
+
+static cmd_errno_t cmd_handler_export(void) {
+    const char *name = strtok(NULL, " ");
+    const char *path = strtok(NULL, " ");
+    if (!name || !path) {
+        puts("ERROR: Missing arguments; type help to learn more");
+        return CONT_ERR;
+    }
+    size_t idx_mat = SIZE_MAX;
+    if (!find_ident(name, &idx_mat)) {
+        printf("ERROR: Undefined identifier '%s'\n", name);
+        return CONT_ERR;
+    }
+    const LSMat_t *const mat = mat_of(idx_mat);
+    if (mat == NULL) {
+        return CONT_ERR;
+    }
+    timespec_t start;
+    timespec_get(&start, TIME_UTC);
+    LSMatMtxStats_t stats;
+    if (LSMat_write_mtx(mat, path, progress_of(), NULL, &stats) != LSMAT_OK) {
+        printf("ERROR: Failed to write '%s'\n", path);
+        return CONT_ERR;
+    }
+    report_throughput(&stats, start);
     return CONT_OK;
 }
 
@@ -565,46 +1207,235 @@ static char *readline_gets(const char *restrict prompt) {
     return line_read;
 }
 
-static cmd_errno_t main_loop(void) {
+// Lines of any length, from a script read through a large buffer.
+static char *batch_gets(FILE *restrict script) {
+    static char *line = NULL;
+    static size_t cap = 0;
+    size_t len = 0;
+    for (;;) {
+        if (cap - len < 2) {
+            const size_t cap_new = cap > 0 ? cap * 2 : 256;
+            char *const t = realloc(line, cap_new);
+            if (t == NULL) {
+                return NULL;
+            }
+            line = t;
+            cap = cap_new;
+        }
+        if (fgets(line + len, (int)(cap - len), script) == NULL) {
+            return len > 0 ? line : NULL;
+        }
+        len += strlen(line + len);
+        if (line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+            return line;
+        }
+    }
+}
+
+static void put_record_str(const char *restrict str) {
+    if (record_fmt == RECORD_JSON) {
+        fputc('"', record_out);
+        for (const char *p = str; *p != '\0'; p++) {
+            if (*p == '"' || *p == '\\') {
+                fprintf(record_out, "\\%c", *p);
+            } else if ((unsigned char)*p < 0x20) {
+                fprintf(record_out, "\\u%04x", (unsigned)*p);
+            } else {
+                fputc(*p, record_out);
+            }
+        }
+        fputc('"', record_out);
+    } else {
+        fputc('"', record_out);
+        for (const char *p = str; *p != '\0'; p++) {
+            if (*p == '"') {
+                fputc('"', record_out);
+            }
+            fputc(*p, record_out);
+        }
+        fputc('"', record_out);
+    }
+}
+
+static void put_record(const char *restrict line, cmd_errno_t e, timespec_t diff,
+                       long long alloc_delta) {
+    static const char *const STATUS[] = {
+        [CONT_OK] = "ok",
+        [CONT_ERR] = "error",
+        [QUIT] = "quit",
+    };
+    const double sec = timespec_to_sec(diff);
+    // Deleted entries hold neither.
+    const bool has_nnz = result_idx < n_entries && (mat_entries[result_idx].mat != NULL ||
+                                                    mat_entries[result_idx].mapped != NULL);
+    if (record_fmt == RECORD_JSON) {
+        fprintf(record_out, "{\"line\":%zu,\"cmd\":", line_no);
+        put_record_str(line);
+        fprintf(record_out, ",\"status\":\"%s\",\"seconds\":%.9f,\"alloc_delta\":%lld,\"nnz\":",
+                STATUS[e], sec, alloc_delta);
+        if (has_nnz) {
+            fprintf(record_out, "%zu}\n", nnz_of(result_idx));
+        } else {
+            fputs("null}\n", record_out);
+        }
+    } else {
+        fprintf(record_out, "%zu,", line_no);
+        put_record_str(line);
+        fprintf(record_out, ",%s,%.9f,%lld,", STATUS[e], sec, alloc_delta);
+        if (has_nnz) {
+            fprintf(record_out, "%zu\n", nnz_of(result_idx));
+        } else {
+            fputc('\n', record_out);
+        }
+    }
+}
+
+/*
+ * Run one command from the terminal, or from script when given. Returns QUIT
+ * at the end of input.
+ */
+static cmd_errno_t main_loop(FILE *restrict script) {
     timespec_t start;
     timespec_t end;
     timespec_t diff;
-    char *buf_input = readline_gets("lsmat_cli > ");
-
-    if (strlen(buf_input) == 0) {
-        return CONT_OK;
+    char *buf_input = script != NULL ? batch_gets(script) : readline_gets("lsmat_cli > ");
+    if (buf_input == NULL) {
+        return QUIT;
     }
+    line_no++;
+    buf_input[strcspn(buf_input, "\r")] = '\0';
 
+    // Records quote the whole line, which strtok is about to cut up.
+    char *line = NULL;
+    if (record_fmt != RECORD_NONE) {
+        line = malloc(strlen(buf_input) + 1);
+        if (line == NULL) {
+            puts("FATAL: Out of memory");
+            return QUIT;
+        }
+        strcpy(line, buf_input);
+    }
     const char *cmd_str = strtok(buf_input, " ");
+    if (cmd_str == NULL || *cmd_str == '#') {
+        free(line);
+        return CONT_OK;
+    }
     cmd_errno_t e = QUIT;
+    cmd_handler_t handler = cmd_handler_null;
+    result_idx = SIZE_MAX;
+    const size_t alloc_before = allocated_size;
     for (size_t i = 0; i < ARR_LIT_LEN_(CMDS); i++) {
         if (CMDS[i].cmd == NULL || strcmp(CMDS[i].cmd, cmd_str) == 0) {
+            handler = CMDS[i].handler;
             timespec_get(&start, TIME_UTC);
-            e = CMDS[i].handler();
+            e = handler();
             timespec_get(&end, TIME_UTC);
             break;
         }
     }
+    timespec_sub(end, start, &diff);
+    // Fatal errors quit too.
+    if (e == CONT_ERR || (e == QUIT && handler != cmd_handler_quit)) {
+        n_failed++;
+    }
 
-    if (e == CONT_OK) {
-        timespec_sub(end, start, &diff);
+    if (line != NULL) {
+        put_record(line, e, diff, (long long)allocated_size - (long long)alloc_before);
+        free(line);
+    } else if (e == CONT_OK) {
         printf("OK\t%lld.%09llds\n", (long long)diff.tv_sec, (long long)diff.tv_nsec);
     }
 
     return e;
 }
 
-int main(void) {
-    lsmat_alloc_hook_ = alloc_hook;
-    lsmat_free_hook_ = free_hook;
-    while (main_loop() != QUIT) {
+static void usage(const char *restrict argv0) {
+    printf("Usage: %s [-f SCRIPT] [-r json|csv] [-o FILE]\n", argv0);
+    puts("  -f SCRIPT  run commands from SCRIPT instead of the terminal");
+    puts("  -r FORMAT  print one json or csv record per command instead of OK lines");
+    puts("  -o FILE    write records to FILE instead of standard output");
+    puts("Standard input that is not a terminal is run as a script.");
+}
+
+int main(int argc, char **argv) {
+    const char *script_path = NULL;
+    const char *record_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "-f") == 0 && has_value) {
+            script_path = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0 && has_value) {
+            i++;
+            if (strcmp(argv[i], "json") == 0) {
+                record_fmt = RECORD_JSON;
+            } else if (strcmp(argv[i], "csv") == 0) {
+                record_fmt = RECORD_CSV;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-o") == 0 && has_value) {
+            record_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    FILE *script = NULL;
+    if (script_path != NULL) {
+        script = fopen(script_path, "r");
+        if (script == NULL) {
+            printf("FATAL: Cannot open script '%s'\n", script_path);
+            return 1;
+        }
+    } else if (!isatty(STDIN_FILENO)) {
+        script = stdin;
+    }
+    if (script != NULL) {
+        batch_mode = true;
+        setvbuf(script, NULL, _IOFBF, BATCH_BUF_SIZE);
+    }
+    record_out = stdout;
+    if (record_path != NULL) {
+        record_out = fopen(record_path, "w");
+        if (record_out == NULL) {
+            printf("FATAL: Cannot open record file '%s'\n", record_path);
+            return 1;
+        }
+    }
+    if (record_fmt == RECORD_CSV) {
+        fputs("line,cmd,status,seconds,alloc_delta,nnz\n", record_out);
+    }
+
+    LSMat_set_hooks(alloc_hook, free_hook);
+    if (LSCache_init(&result_cache, CACHE_DEFAULT_LIMIT) != LSMAT_OK) {
+        puts("FATAL: Cache creation failed");
+        return 1;
+    }
+    while (main_loop(script) != QUIT) {
         ;
     }
     puts("INFO: Cleaning up and quitting");
-    for (size_t i = 0; i < n_mats; i++) {
-        LSMat_free(mats[i]);
+    LSArith_set_threads(1);
+    LSCache_destroy(&result_cache);
+    for (size_t i = 0; i < n_entries; i++) {
+        if (mat_entries[i].mat != NULL) {
+            LSMat_free(mat_entries[i].mat);
+        }
+        if (mat_entries[i].mapped != NULL) {
+            LSMatCsr_free(mat_entries[i].mapped);
+        }
+    }
+    free(mat_entries);
+    free(mat_buckets);
+    LSMat_set_hooks(NULL, NULL);
+    if (script != NULL && script != stdin) {
+        fclose(script);
+    }
+    if (record_out != stdout) {
+        fclose(record_out);
     }
-    lsmat_alloc_hook_ = NULL;
-    lsmat_free_hook_ = NULL;
-    return 0;
+    // Scripts report failed commands through the exit status.
+    return batch_mode && n_failed > 0 ? 1 : 0;
 }
@@ -1,135 +1,933 @@
 #include "lsmat/lsarith.h"
+#include "lsmat/lscsr.h"
 #include "lsmat/lsmat.h"
+#include "lsprobe.h"
+#include "lssimd.h"
+#include "lsthreads.h"
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
-static lsarith_errno_t LSArith_mat_is_same_shape_2_(const LSMat_t *const restrict a,
-                                                    const LSMat_t *const restrict b) {
-    if (a == NULL || b == NULL) {
+static size_t n_threads_ = 1;
+
+typedef enum LSArithOp_ {
+    LSARITH_OP_ADD_,
+    LSARITH_OP_SUB_,
+    LSARITH_OP_MUL_,
+    LSARITH_OP_SUM_,
+} LSArithOp_t;
+
+static lsarith_errno_t LSArith_view_binary_(const LSMatView_t a, const LSMatView_t b,
+                                            LSMat_t *restrict out, LSArithOp_t op);
+
+void LSArith_set_threads(size_t n_threads) {
+    n_threads_ = n_threads > 0 ? n_threads : 1;
+    if (n_threads_ == 1) {
+        LSThreads_shutdown();
+    }
+}
+
+size_t LSArith_threads(void) {
+    return n_threads_;
+}
+
+static lsarith_errno_t LSArith_view_is_same_shape_3_(const LSMatView_t a, const LSMatView_t b,
+                                                     const LSMat_t *const restrict c) {
+    if (a.mat == NULL || b.mat == NULL || c == NULL) {
         return LSARITH_E_GEN;
     }
     for (size_t i = 0; i < LSMAT_AXIS_COUNT_; i++) {
-        if (a->shape[i] != b->shape[i]) {
+        if (LSMatView_shape_of(a, i) != LSMatView_shape_of(b, i) ||
+            LSMatView_shape_of(b, i) != c->shape[i]) {
             return LSARITH_E_SHAPE;
         }
     }
     return LSARITH_OK;
 }
 
-static lsarith_errno_t LSArith_mat_is_same_shape_3_(const LSMat_t *const restrict a,
-                                                    const LSMat_t *const restrict b,
-                                                    const LSMat_t *const restrict c) {
-    return LSArith_mat_is_same_shape_2_(a, b) == LSARITH_OK &&
-                   LSArith_mat_is_same_shape_2_(b, c) == LSARITH_OK
-               ? LSARITH_OK
-               : LSARITH_E_SHAPE;
+static LSMatView_t LSArith_view_of_(const LSMat_t *restrict mat) {
+    // Views are only read from here, so dropping the qualifier is harmless.
+    return LSMatView_from((LSMat_t *)mat);
 }
 
-static lsarith_errno_t LSArith_mat_addsub_(const LSMat_t *restrict a, const LSMat_t *restrict b,
-                                           LSMat_t *restrict out, bool sub) {
-    if (LSArith_mat_is_same_shape_3_(a, b, out) != LSARITH_OK) {
-        return LSARITH_E_SHAPE;
+static lsarith_errno_t LSArith_view_addsub_(const LSMatView_t a, const LSMatView_t b,
+                                            LSMat_t *restrict out, bool sub) {
+    const lsarith_errno_t err = LSArith_view_is_same_shape_3_(a, b, out);
+    if (err != LSARITH_OK) {
+        return err;
     }
-    LSMat_zero(out);
-    for (size_t i = 0; i < a->shape[LSMAT_AXIS_0]; i++) {
-        LSMatCell_t *pa = a->heads[LSMAT_AXIS_0][i].first_cell;
-        LSMatCell_t *pb = b->heads[LSMAT_AXIS_0][i].first_cell;
-        while (pa != NULL || pb != NULL) {
-            bool advance_pa = false;
-            bool advance_pb = false;
-            if (pa != NULL && pb != NULL) {
-                const size_t ja = LSMatCell_idx_of(pa, LSMAT_AXIS_1);
-                const size_t jb = LSMatCell_idx_of(pb, LSMAT_AXIS_1);
-                if (ja < jb) {
-                    LSMat_set(out, i, ja, pa->v);
-                    advance_pa = true;
-                } else if (ja > jb) {
-                    LSMat_set(out, i, jb, sub ? -pb->v : pb->v);
-                    advance_pb = true;
-                } else {
-                    LSMat_set(out, i, ja, sub ? pa->v - pb->v : pa->v + pb->v);
-                    advance_pa = advance_pb = true;
-                }
-            } else if (pa == NULL) {
-                LSMat_set(out, i, LSMatCell_idx_of(pb, LSMAT_AXIS_1), sub ? -pb->v : pb->v);
-                advance_pb = true;
-            } else {
-                LSMat_set(out, i, LSMatCell_idx_of(pa, LSMAT_AXIS_1), pa->v);
-                advance_pa = true;
+    return LSArith_view_binary_(a, b, out, sub ? LSARITH_OP_SUB_ : LSARITH_OP_ADD_);
+}
+
+lsarith_errno_t LSArith_mat_add(const LSMat_t *restrict a, const LSMat_t *restrict b,
+                                LSMat_t *restrict out) {
+    LSPROF_FN_();
+    return LSArith_view_addsub_(LSArith_view_of_(a), LSArith_view_of_(b), out, false);
+}
+
+lsarith_errno_t LSArith_mat_sub(const LSMat_t *restrict a, const LSMat_t *restrict b,
+                                LSMat_t *restrict out) {
+    LSPROF_FN_();
+    return LSArith_view_addsub_(LSArith_view_of_(a), LSArith_view_of_(b), out, true);
+}
+
+lsarith_errno_t LSArith_view_add(const LSMatView_t a, const LSMatView_t b, LSMat_t *restrict out) {
+    LSPROF_FN_();
+    return LSArith_view_addsub_(a, b, out, false);
+}
+
+lsarith_errno_t LSArith_view_sub(const LSMatView_t a, const LSMatView_t b, LSMat_t *restrict out) {
+    LSPROF_FN_();
+    return LSArith_view_addsub_(a, b, out, true);
+}
+
+/*
+ * Sparse accumulator for one output row: a dense scratch row, plus the list
+ * of columns touched so far. Stamps tell live slots from stale ones, so the
+ * scratch never has to be cleared between rows.
+ */
+typedef struct LSArithSpa_ {
+    size_t len;
+    size_t gen;
+    double *acc;
+    size_t *stamp;
+    size_t *occupied;
+    size_t n_occupied;
+} LSArithSpa_t;
+
+static bool LSArithSpa_init_(LSArithSpa_t *restrict spa, size_t len) {
+    spa->len = len;
+    spa->gen = 0;
+    spa->acc = malloc((len > 0 ? len : 1) * sizeof(double));
+    spa->stamp = calloc(len > 0 ? len : 1, sizeof(size_t));
+    spa->occupied = malloc((len > 0 ? len : 1) * sizeof(size_t));
+    spa->n_occupied = 0;
+    return spa->acc != NULL && spa->stamp != NULL && spa->occupied != NULL;
+}
+
+static void LSArithSpa_destroy_(LSArithSpa_t *restrict spa) {
+    free(spa->acc);
+    free(spa->stamp);
+    free(spa->occupied);
+}
+
+static void LSArithSpa_reset_(LSArithSpa_t *restrict spa) {
+    spa->gen++;
+    spa->n_occupied = 0;
+}
+
+static void LSArithSpa_scatter_(LSArithSpa_t *restrict spa, size_t j, double v) {
+    if (spa->stamp[j] != spa->gen) {
+        spa->stamp[j] = spa->gen;
+        spa->acc[j] = v;
+        spa->occupied[spa->n_occupied++] = j;
+    } else {
+        spa->acc[j] += v;
+    }
+}
+
+static int LSArith_cmp_size_(const void *lhs, const void *rhs) {
+    const size_t l = *(const size_t *)lhs;
+    const size_t r = *(const size_t *)rhs;
+    return (l > r) - (l < r);
+}
+
+/*
+ * Put the touched columns in ascending order. A nearly full row is cheaper
+ * to collect by sweeping the stamps than by sorting.
+ */
+static void LSArithSpa_sort_(LSArithSpa_t *restrict spa) {
+    if (spa->n_occupied > spa->len / 16) {
+        size_t n = 0;
+        for (size_t j = 0; j < spa->len; j++) {
+            if (spa->stamp[j] == spa->gen) {
+                spa->occupied[n++] = j;
             }
-            if (advance_pa) {
-                pa = LSMatCell_succ_of(pa, LSMAT_AXIS_1);
+        }
+    } else {
+        qsort(spa->occupied, spa->n_occupied, sizeof(size_t), LSArith_cmp_size_);
+    }
+}
+
+/*
+ * State shared by the workers of a row-wise kernel. Each chunk of output rows
+ * is appended to a writer of its own; the column lists are stitched together
+ * from those afterwards, one range of columns per task. A serial run is the
+ * same with a single chunk, and stays linear in the size of its operands.
+ */
+typedef struct LSArithPar_ {
+    LSMatView_t a;
+    LSMatView_t b;
+    const LSMatView_t *views;
+    const double *coefs;
+    size_t n_views;
+    LSMat_t *out;
+    LSArithOp_t op;
+    LSMatWriter_t *writers;
+    size_t *row_split;
+    size_t n_chunks;
+    atomic_bool failed;
+} LSArithPar_t;
+
+static size_t LSArith_view_line_len_(const LSMatView_t view, size_t i) {
+    return view.mat->heads[view.axes_mapping[LSMAT_AXIS_0]][i].len;
+}
+
+static bool LSArith_par_addsub_row_(LSArithPar_t *restrict par, LSMatWriter_t *restrict w,
+                                    size_t i) {
+    const bool sub = par->op == LSARITH_OP_SUB_;
+    LSMatIter_t it_a;
+    LSMatIter_t it_b;
+    LSMatIter_init_view(&it_a, par->a, LSMAT_AXIS_0, i);
+    LSMatIter_init_view(&it_b, par->b, LSMAT_AXIS_0, i);
+    size_t ja = 0;
+    size_t jb = 0;
+    double va = 0.;
+    double vb = 0.;
+    bool has_a = LSMatIter_next(&it_a, &ja, &va);
+    bool has_b = LSMatIter_next(&it_b, &jb, &vb);
+    size_t steps = 0;
+    while (has_a || has_b) {
+        lsmat_errno_t err;
+        steps++;
+        if (has_a && (!has_b || ja < jb)) {
+            err = LSMatWriter_put(w, ja, va);
+            has_a = LSMatIter_next(&it_a, &ja, &va);
+        } else if (!has_a || jb < ja) {
+            err = LSMatWriter_put(w, jb, sub ? -vb : vb);
+            has_b = LSMatIter_next(&it_b, &jb, &vb);
+        } else {
+            err = LSMatWriter_put(w, ja, sub ? va - vb : va + vb);
+            has_a = LSMatIter_next(&it_a, &ja, &va);
+            has_b = LSMatIter_next(&it_b, &jb, &vb);
+        }
+        if (err != LSMAT_OK) {
+            return false;
+        }
+    }
+    LSPROF_ADD_(LSPROF_MERGE_STEPS, steps);
+    return LSMatWriter_end_row(w, i) == LSMAT_OK;
+}
+
+static bool LSArith_par_mul_row_(LSArithPar_t *restrict par, LSArithSpa_t *restrict spa,
+                                 LSMatWriter_t *restrict w, size_t i) {
+    LSArithSpa_reset_(spa);
+    // Gustavson: row i of the product is the sum of the rows k of B, each
+    // scaled by A[i, k].
+    LSMatIter_t it_a;
+    LSMatIter_init_view(&it_a, par->a, LSMAT_AXIS_0, i);
+    size_t k = 0;
+    double va = 0.;
+    while (LSMatIter_next(&it_a, &k, &va)) {
+        LSMatIter_t it_b;
+        LSMatIter_init_view(&it_b, par->b, LSMAT_AXIS_0, k);
+        size_t j = 0;
+        double vb = 0.;
+        while (LSMatIter_next(&it_b, &j, &vb)) {
+            LSArithSpa_scatter_(spa, j, va * vb);
+        }
+    }
+    LSArithSpa_sort_(spa);
+    for (size_t n = 0; n < spa->n_occupied; n++) {
+        const size_t j = spa->occupied[n];
+        if (LSMatWriter_put(w, j, spa->acc[j]) != LSMAT_OK) {
+            return false;
+        }
+    }
+    return LSMatWriter_end_row(w, i) == LSMAT_OK;
+}
+
+/*
+ * Cursors of a k-way merge, kept in a binary heap ordered by the column each
+ * of them is at.
+ */
+typedef struct LSArithMerge_ {
+    LSMatIter_t *its;
+    size_t *col;
+    double *v;
+    size_t *heap;
+    size_t n_heap;
+} LSArithMerge_t;
+
+static bool LSArithMerge_init_(LSArithMerge_t *restrict m, size_t n) {
+    m->its = malloc(n * sizeof(LSMatIter_t));
+    m->col = malloc(n * sizeof(size_t));
+    m->v = malloc(n * sizeof(double));
+    m->heap = malloc(n * sizeof(size_t));
+    m->n_heap = 0;
+    return m->its != NULL && m->col != NULL && m->v != NULL && m->heap != NULL;
+}
+
+static void LSArithMerge_destroy_(LSArithMerge_t *restrict m) {
+    free(m->its);
+    free(m->col);
+    free(m->v);
+    free(m->heap);
+}
+
+static void LSArithMerge_sift_down_(LSArithMerge_t *restrict m, size_t pos) {
+    const size_t item = m->heap[pos];
+    for (;;) {
+        size_t child = 2 * pos + 1;
+        if (child >= m->n_heap) {
+            break;
+        }
+        if (child + 1 < m->n_heap && m->col[m->heap[child + 1]] < m->col[m->heap[child]]) {
+            child++;
+        }
+        if (m->col[m->heap[child]] >= m->col[item]) {
+            break;
+        }
+        m->heap[pos] = m->heap[child];
+        pos = child;
+    }
+    m->heap[pos] = item;
+}
+
+static bool LSArith_par_sum_row_(LSArithPar_t *restrict par, LSArithMerge_t *restrict m,
+                                 LSMatWriter_t *restrict w, size_t i) {
+    m->n_heap = 0;
+    for (size_t k = 0; k < par->n_views; k++) {
+        LSMatIter_init_view(m->its + k, par->views[k], LSMAT_AXIS_0, i);
+        if (LSMatIter_next(m->its + k, m->col + k, m->v + k)) {
+            m->heap[m->n_heap++] = k;
+        }
+    }
+    for (size_t pos = m->n_heap / 2; pos-- > 0;) {
+        LSArithMerge_sift_down_(m, pos);
+    }
+    size_t steps = 0;
+    while (m->n_heap > 0) {
+        const size_t j = m->col[m->heap[0]];
+        double sum = 0.;
+        while (m->n_heap > 0 && m->col[m->heap[0]] == j) {
+            const size_t k = m->heap[0];
+            steps++;
+            sum += par->coefs[k] * m->v[k];
+            if (!LSMatIter_next(m->its + k, m->col + k, m->v + k)) {
+                m->heap[0] = m->heap[--m->n_heap];
             }
-            if (advance_pb) {
-                pb = LSMatCell_succ_of(pb, LSMAT_AXIS_1);
+            if (m->n_heap > 0) {
+                LSArithMerge_sift_down_(m, 0);
             }
         }
+        if (LSMatWriter_put(w, j, sum) != LSMAT_OK) {
+            return false;
+        }
+    }
+    LSPROF_ADD_(LSPROF_MERGE_STEPS, steps);
+    return LSMatWriter_end_row(w, i) == LSMAT_OK;
+}
+
+static void LSArith_par_rows_task_(void *ctx, size_t task) {
+    LSArithPar_t *const par = ctx;
+    LSMatWriter_t *const w = par->writers + task;
+    LSArithSpa_t spa;
+    LSArithMerge_t merge;
+    const bool mul = par->op == LSARITH_OP_MUL_;
+    const bool sum = par->op == LSARITH_OP_SUM_;
+    if (mul && !LSArithSpa_init_(&spa, par->out->shape[LSMAT_AXIS_1])) {
+        LSArithSpa_destroy_(&spa);
+        atomic_store(&par->failed, true);
+        return;
+    }
+    if (sum && !LSArithMerge_init_(&merge, par->n_views)) {
+        LSArithMerge_destroy_(&merge);
+        atomic_store(&par->failed, true);
+        return;
+    }
+    for (size_t i = par->row_split[task]; i < par->row_split[task + 1]; i++) {
+        bool ok;
+        if (mul) {
+            ok = LSArith_par_mul_row_(par, &spa, w, i);
+        } else if (sum) {
+            ok = LSArith_par_sum_row_(par, &merge, w, i);
+        } else {
+            ok = LSArith_par_addsub_row_(par, w, i);
+        }
+        if (!ok) {
+            atomic_store(&par->failed, true);
+            break;
+        }
+    }
+    if (mul) {
+        LSArithSpa_destroy_(&spa);
+    }
+    if (sum) {
+        LSArithMerge_destroy_(&merge);
+    }
+}
+
+static void LSArith_par_stitch_task_(void *ctx, size_t task) {
+    LSArithPar_t *const par = ctx;
+    const size_t n_cols = par->out->shape[LSMAT_AXIS_1];
+    const size_t begin = n_cols * task / par->n_chunks;
+    const size_t end = n_cols * (task + 1) / par->n_chunks;
+    LSMat_stitch(par->out, par->writers, par->n_chunks, begin, end);
+}
+
+/*
+ * The cost of an output row: the number of stored entries in the matching
+ * row of the left operand, or of all operands of a sum, plus one for the row
+ * itself.
+ */
+static size_t LSArith_par_row_cost_(const LSArithPar_t *restrict par, size_t i) {
+    if (par->op != LSARITH_OP_SUM_) {
+        return LSArith_view_line_len_(par->a, i) + 1;
+    }
+    size_t cost = 1;
+    for (size_t k = 0; k < par->n_views; k++) {
+        cost += LSArith_view_line_len_(par->views[k], i);
+    }
+    return cost;
+}
+
+// Split the output rows into chunks of about the same cost.
+static void LSArith_par_split_(LSArithPar_t *restrict par) {
+    const size_t n_rows = par->out->shape[LSMAT_AXIS_0];
+    size_t total = 0;
+    for (size_t i = 0; i < n_rows; i++) {
+        total += LSArith_par_row_cost_(par, i);
+    }
+    size_t acc = 0;
+    size_t chunk = 1;
+    par->row_split[0] = 0;
+    for (size_t i = 0; i < n_rows && chunk < par->n_chunks; i++) {
+        acc += LSArith_par_row_cost_(par, i);
+        while (chunk < par->n_chunks && acc * par->n_chunks >= total * chunk) {
+            par->row_split[chunk++] = i + 1;
+        }
+    }
+    while (chunk <= par->n_chunks) {
+        par->row_split[chunk++] = n_rows;
+    }
+}
+
+// Run a kernel whose operands and output are already set in par.
+static lsarith_errno_t LSArith_rowwise_(LSArithPar_t *restrict par) {
+    LSMat_t *const out = par->out;
+    par->n_chunks = n_threads_;
+    atomic_init(&par->failed, false);
+    par->writers = calloc(par->n_chunks, sizeof(LSMatWriter_t));
+    par->row_split = malloc((par->n_chunks + 1) * sizeof(size_t));
+    if (par->writers == NULL || par->row_split == NULL) {
+        free(par->writers);
+        free(par->row_split);
+        return LSARITH_E_GEN;
+    }
+    size_t n_writers = 0;
+    while (n_writers < par->n_chunks &&
+           LSMatWriter_init(par->writers + n_writers, out) == LSMAT_OK) {
+        n_writers++;
+    }
+    if (n_writers < par->n_chunks) {
+        for (size_t k = 0; k < n_writers; k++) {
+            LSMatWriter_destroy(par->writers + k);
+        }
+        free(par->writers);
+        free(par->row_split);
+        return LSARITH_E_GEN;
+    }
+    LSArith_par_split_(par);
+    LSMat_zero(out);
+    LSThreads_run(n_threads_, par->n_chunks, LSArith_par_rows_task_, par);
+    LSThreads_run(n_threads_, par->n_chunks, LSArith_par_stitch_task_, par);
+    // The cells belong to the writers until they are adopted, so this has to
+    // happen even if a worker failed.
+    if (LSMat_adopt(out, par->writers, par->n_chunks) != LSMAT_OK) {
+        atomic_store(&par->failed, true);
+    }
+    free(par->writers);
+    free(par->row_split);
+    if (atomic_load(&par->failed)) {
+        LSMat_zero(out);
+        return LSARITH_E_GEN;
     }
     return LSARITH_OK;
 }
 
-lsarith_errno_t LSArith_mat_add(const LSMat_t *restrict a, const LSMat_t *restrict b,
+static lsarith_errno_t LSArith_view_binary_(const LSMatView_t a, const LSMatView_t b,
+                                            LSMat_t *restrict out, LSArithOp_t op) {
+    LSArithPar_t par = {.a = a, .b = b, .out = out, .op = op};
+    return LSArith_rowwise_(&par);
+}
+
+lsarith_errno_t LSArith_view_sum(const LSMatView_t *restrict views, const double *restrict coefs,
+                                 size_t n, LSMat_t *restrict out) {
+    LSPROF_FN_();
+    if (views == NULL || coefs == NULL || out == NULL || n == 0) {
+        return LSARITH_E_GEN;
+    }
+    for (size_t k = 0; k < n; k++) {
+        if (views[k].mat == NULL) {
+            return LSARITH_E_GEN;
+        }
+        if (LSMatView_shape_of(views[k], LSMAT_AXIS_0) != out->shape[LSMAT_AXIS_0] ||
+            LSMatView_shape_of(views[k], LSMAT_AXIS_1) != out->shape[LSMAT_AXIS_1]) {
+            return LSARITH_E_SHAPE;
+        }
+        if (views[k].mat == out) {
+            return LSARITH_E_GEN;
+        }
+    }
+    LSArithPar_t par = {
+        .a = views[0],
+        .views = views,
+        .coefs = coefs,
+        .n_views = n,
+        .out = out,
+        .op = LSARITH_OP_SUM_,
+    };
+    return LSArith_rowwise_(&par);
+}
+
+lsarith_errno_t LSArith_view_mul(const LSMatView_t a, const LSMatView_t b, LSMat_t *restrict out) {
+    LSPROF_FN_();
+    if (a.mat == NULL || b.mat == NULL || out == NULL) {
+        return LSARITH_E_GEN;
+    }
+    if (LSMatView_shape_of(a, LSMAT_AXIS_1) != LSMatView_shape_of(b, LSMAT_AXIS_0) ||
+        out->shape[LSMAT_AXIS_0] != LSMatView_shape_of(a, LSMAT_AXIS_0) ||
+        out->shape[LSMAT_AXIS_1] != LSMatView_shape_of(b, LSMAT_AXIS_1)) {
+        return LSARITH_E_SHAPE;
+    }
+    return LSArith_view_binary_(a, b, out, LSARITH_OP_MUL_);
+}
+
+lsarith_errno_t LSArith_mat_mul(const LSMat_t *restrict a, const LSMat_t *restrict b,
                                 LSMat_t *restrict out) {
-    return LSArith_mat_addsub_(a, b, out, false);
+    LSPROF_FN_();
+    return LSArith_view_mul(LSArith_view_of_(a), LSArith_view_of_(b), out);
 }
 
-lsarith_errno_t LSArith_mat_sub(const LSMat_t *restrict a, const LSMat_t *restrict b,
+LSMatView_t LSArith_mat_T(LSMat_t *restrict a) {
+    LSMatView_t v = LSMatView_from(a);
+    v.axes_mapping[LSMAT_AXIS_0] ^= v.axes_mapping[LSMAT_AXIS_1];
+    v.axes_mapping[LSMAT_AXIS_1] ^= v.axes_mapping[LSMAT_AXIS_0];
+    v.axes_mapping[LSMAT_AXIS_0] ^= v.axes_mapping[LSMAT_AXIS_1];
+    return v;
+}
+
+static lsarith_errno_t LSArith_writer_open_(LSMatWriter_t *restrict w, LSMat_t *restrict out) {
+    if (LSMatWriter_init(w, out) != LSMAT_OK) {
+        return LSARITH_E_GEN;
+    }
+    LSMat_zero(out);
+    return LSARITH_OK;
+}
+
+static lsarith_errno_t LSArith_writer_close_(LSMatWriter_t *restrict w, LSMat_t *restrict out,
+                                             bool ok) {
+    LSMat_stitch(out, w, 1, 0, out->shape[LSMAT_AXIS_1]);
+    ok = LSMat_adopt(out, w, 1) == LSMAT_OK && ok;
+    if (!ok) {
+        LSMat_zero(out);
+        return LSARITH_E_GEN;
+    }
+    return LSARITH_OK;
+}
+
+static lsarith_errno_t LSArith_csr_addsub_(const LSMatCsr_t *restrict a,
+                                           const LSMatCsr_t *restrict b, LSMat_t *restrict out,
+                                           bool sub) {
+    if (a == NULL || b == NULL || out == NULL) {
+        return LSARITH_E_GEN;
+    }
+    for (size_t i = 0; i < LSMAT_AXIS_COUNT_; i++) {
+        if (a->shape[i] != b->shape[i] || a->shape[i] != out->shape[i]) {
+            return LSARITH_E_SHAPE;
+        }
+    }
+    // The output is written row by row, so both sides want rows.
+    LSMatCsr_t *a_conv = NULL;
+    LSMatCsr_t *b_conv = NULL;
+    if (a->major != LSMAT_AXIS_0) {
+        a = a_conv = LSMatCsr_transcode(a);
+    }
+    if (b->major != LSMAT_AXIS_0) {
+        b = b_conv = LSMatCsr_transcode(b);
+    }
+    LSMatWriter_t w;
+    if (a == NULL || b == NULL || LSArith_writer_open_(&w, out) != LSARITH_OK) {
+        LSMatCsr_free(a_conv);
+        LSMatCsr_free(b_conv);
+        return LSARITH_E_GEN;
+    }
+    bool ok = true;
+    size_t steps = 0;
+    for (size_t i = 0; ok && i < a->shape[LSMAT_AXIS_0]; i++) {
+        size_t ka = a->ptr[i];
+        size_t kb = b->ptr[i];
+        const size_t ka_end = a->ptr[i + 1];
+        const size_t kb_end = b->ptr[i + 1];
+        while (ok && (ka < ka_end || kb < kb_end)) {
+            size_t j;
+            double v;
+            steps++;
+            if (kb >= kb_end || (ka < ka_end && a->idx[ka] < b->idx[kb])) {
+                j = a->idx[ka];
+                v = a->v[ka++];
+            } else if (ka >= ka_end || b->idx[kb] < a->idx[ka]) {
+                j = b->idx[kb];
+                v = sub ? -b->v[kb++] : b->v[kb++];
+            } else {
+                j = a->idx[ka];
+                v = sub ? a->v[ka++] - b->v[kb++] : a->v[ka++] + b->v[kb++];
+            }
+            ok = LSMatWriter_put(&w, j, v) == LSMAT_OK;
+        }
+        ok = ok && LSMatWriter_end_row(&w, i) == LSMAT_OK;
+    }
+    LSPROF_ADD_(LSPROF_MERGE_STEPS, steps);
+    if (a_conv != NULL) {
+        LSMatCsr_free(a_conv);
+    }
+    if (b_conv != NULL) {
+        LSMatCsr_free(b_conv);
+    }
+    return LSArith_writer_close_(&w, out, ok);
+}
+
+lsarith_errno_t LSArith_csr_add(const LSMatCsr_t *restrict a, const LSMatCsr_t *restrict b,
                                 LSMat_t *restrict out) {
-    return LSArith_mat_addsub_(a, b, out, true);
+    LSPROF_FN_();
+    return LSArith_csr_addsub_(a, b, out, false);
 }
 
-lsarith_errno_t LSArith_mat_mul(const LSMat_t *restrict a, const LSMat_t *restrict b,
+lsarith_errno_t LSArith_csr_sub(const LSMatCsr_t *restrict a, const LSMatCsr_t *restrict b,
+                                LSMat_t *restrict out) {
+    LSPROF_FN_();
+    return LSArith_csr_addsub_(a, b, out, true);
+}
+
+lsarith_errno_t LSArith_csr_mul(const LSMatCsr_t *restrict a, const LSMatCsr_t *restrict b,
                                 LSMat_t *restrict out) {
+    LSPROF_FN_();
+    if (a == NULL || b == NULL || out == NULL) {
+        return LSARITH_E_GEN;
+    }
     if (a->shape[LSMAT_AXIS_1] != b->shape[LSMAT_AXIS_0] ||
         out->shape[LSMAT_AXIS_0] != a->shape[LSMAT_AXIS_0] ||
         out->shape[LSMAT_AXIS_1] != b->shape[LSMAT_AXIS_1]) {
         return LSARITH_E_SHAPE;
     }
-    LSMat_zero(out);
+    // The product is accumulated row by row, so both sides want rows.
+    LSMatCsr_t *a_conv = NULL;
+    LSMatCsr_t *b_conv = NULL;
+    if (a->major != LSMAT_AXIS_0) {
+        a = a_conv = LSMatCsr_transcode(a);
+    }
+    if (b->major != LSMAT_AXIS_0) {
+        b = b_conv = LSMatCsr_transcode(b);
+    }
+    LSArithSpa_t spa;
+    LSMatWriter_t w;
+    if (a == NULL || b == NULL || !LSArithSpa_init_(&spa, out->shape[LSMAT_AXIS_1])) {
+        if (a != NULL && b != NULL) {
+            LSArithSpa_destroy_(&spa);
+        }
+        LSMatCsr_free(a_conv);
+        LSMatCsr_free(b_conv);
+        return LSARITH_E_GEN;
+    }
+    if (LSArith_writer_open_(&w, out) != LSARITH_OK) {
+        LSArithSpa_destroy_(&spa);
+        LSMatCsr_free(a_conv);
+        LSMatCsr_free(b_conv);
+        return LSARITH_E_GEN;
+    }
+    bool ok = true;
+    for (size_t i = 0; ok && i < a->shape[LSMAT_AXIS_0]; i++) {
+        LSArithSpa_reset_(&spa);
+        for (size_t ka = a->ptr[i]; ka < a->ptr[i + 1]; ka++) {
+            const size_t k = a->idx[ka];
+            for (size_t kb = b->ptr[k]; kb < b->ptr[k + 1]; kb++) {
+                LSArithSpa_scatter_(&spa, b->idx[kb], a->v[ka] * b->v[kb]);
+            }
+        }
+        LSArithSpa_sort_(&spa);
+        for (size_t n = 0; ok && n < spa.n_occupied; n++) {
+            const size_t j = spa.occupied[n];
+            ok = LSMatWriter_put(&w, j, spa.acc[j]) == LSMAT_OK;
+        }
+        ok = ok && LSMatWriter_end_row(&w, i) == LSMAT_OK;
+    }
+    LSArithSpa_destroy_(&spa);
+    if (a_conv != NULL) {
+        LSMatCsr_free(a_conv);
+    }
+    if (b_conv != NULL) {
+        LSMatCsr_free(b_conv);
+    }
+    return LSArith_writer_close_(&w, out, ok);
+}
+
+lsarith_errno_t LSArith_mat_scale(LSMat_t *restrict a, double alpha, bool prune) {
+    LSPROF_FN_();
+    if (a == NULL) {
+        return LSARITH_E_GEN;
+    }
+    if (alpha == 0. && prune) {
+        LSMat_zero(a);
+        return LSARITH_OK;
+    }
+    a->version++;
     for (size_t i = 0; i < a->shape[LSMAT_AXIS_0]; i++) {
-        const LSMatHead_t ha = a->heads[LSMAT_AXIS_0][i];
-        if (ha.first_cell == NULL) {
+        LSMatHead_t *const head = a->heads[LSMAT_AXIS_0] + i;
+        if (head->dense != NULL) {
+            size_t len = 0;
+            for (size_t j = 0; j < a->shape[LSMAT_AXIS_1]; j++) {
+                head->dense[j] *= alpha;
+                len += head->dense[j] != 0.;
+            }
+            head->len = len;
             continue;
         }
-        for (size_t j = 0; j < b->shape[LSMAT_AXIS_1]; j++) {
-            double sum = 0.;
-            LSMatCell_t *pa = ha.first_cell;
-            LSMatCell_t *pb = b->heads[LSMAT_AXIS_1][j].first_cell;
-            while (pa != NULL || pb != NULL) {
-                bool advance_pa = false;
-                bool advance_pb = false;
-                if (pa != NULL && pb != NULL) {
-                    const size_t ka = LSMatCell_idx_of(pa, LSMAT_AXIS_1);
-                    const size_t kb = LSMatCell_idx_of(pb, LSMAT_AXIS_0);
-                    if (ka == kb) {
-                        sum += pa->v * pb->v;
-                    }
-                    advance_pa = ka <= kb;
-                    advance_pb = ka >= kb;
-                } else {
-                    advance_pa = pa != NULL;
-                    advance_pb = pb != NULL;
-                }
-                if (advance_pa) {
-                    pa = LSMatCell_succ_of(pa, LSMAT_AXIS_1);
-                }
-                if (advance_pb) {
-                    pb = LSMatCell_succ_of(pb, LSMAT_AXIS_0);
+        LSMatCell_t *p = head->first_cell;
+        while (p != NULL) {
+            LSMatCell_t *const t = LSMatCell_succ_of(p, LSMAT_AXIS_1);
+            p->v *= alpha;
+            if (prune && p->v == 0.) {
+                LSMat_set(a, i, LSMatCell_idx_of(p, LSMAT_AXIS_1), 0.);
+            }
+            p = t;
+        }
+    }
+    return LSMat_adapt(a) == LSMAT_OK ? LSARITH_OK : LSARITH_E_GEN;
+}
+
+lsarith_errno_t LSArith_mat_axpy(LSMat_t *y, double alpha, const LSMat_t *x, bool prune) {
+    LSPROF_FN_();
+    if (x == NULL || y == NULL) {
+        return LSARITH_E_GEN;
+    }
+    if (x->shape[LSMAT_AXIS_0] != y->shape[LSMAT_AXIS_0] ||
+        x->shape[LSMAT_AXIS_1] != y->shape[LSMAT_AXIS_1]) {
+        return LSARITH_E_SHAPE;
+    }
+    if (x == y) {
+        return LSArith_mat_scale(y, 1. + alpha, prune);
+    }
+    const size_t n_cols = x->shape[LSMAT_AXIS_1] > 0 ? x->shape[LSMAT_AXIS_1] : 1;
+    size_t *const idx = malloc(n_cols * sizeof(size_t));
+    double *const v = malloc(n_cols * sizeof(double));
+    lsarith_errno_t err = idx != NULL && v != NULL ? LSARITH_OK : LSARITH_E_GEN;
+    for (size_t i = 0; err == LSARITH_OK && i < x->shape[LSMAT_AXIS_0]; i++) {
+        LSMatIter_t it;
+        LSMatIter_init(&it, x, LSMAT_AXIS_0, i);
+        size_t n = 0;
+        while (LSMatIter_next(&it, idx + n, v + n)) {
+            n++;
+        }
+        if (LSMat_accumulate_row(y, i, alpha, idx, v, n, prune) != LSMAT_OK) {
+            err = LSARITH_E_GEN;
+        }
+    }
+    free(idx);
+    free(v);
+    return err;
+}
+
+lsarith_errno_t LSArith_mat_add_assign(LSMat_t *a, const LSMat_t *b, bool prune) {
+    LSPROF_FN_();
+    return LSArith_mat_axpy(a, 1., b, prune);
+}
+
+lsarith_errno_t LSArith_mat_sub_assign(LSMat_t *a, const LSMat_t *b, bool prune) {
+    LSPROF_FN_();
+    return LSArith_mat_axpy(a, -1., b, prune);
+}
+
+lsarith_errno_t LSArith_mat_mul_acc(LSMat_t *c, double alpha, const LSMat_t *a, const LSMat_t *b,
+                                    bool prune) {
+    LSPROF_FN_();
+    if (a == NULL || b == NULL || c == NULL || c == a || c == b) {
+        return LSARITH_E_GEN;
+    }
+    if (a->shape[LSMAT_AXIS_1] != b->shape[LSMAT_AXIS_0] ||
+        c->shape[LSMAT_AXIS_0] != a->shape[LSMAT_AXIS_0] ||
+        c->shape[LSMAT_AXIS_1] != b->shape[LSMAT_AXIS_1]) {
+        return LSARITH_E_SHAPE;
+    }
+    LSArithSpa_t spa;
+    const size_t n_cols = c->shape[LSMAT_AXIS_1] > 0 ? c->shape[LSMAT_AXIS_1] : 1;
+    double *const v = malloc(n_cols * sizeof(double));
+    if (v == NULL || !LSArithSpa_init_(&spa, c->shape[LSMAT_AXIS_1])) {
+        if (v != NULL) {
+            LSArithSpa_destroy_(&spa);
+        }
+        free(v);
+        return LSARITH_E_GEN;
+    }
+    lsarith_errno_t err = LSARITH_OK;
+    for (size_t i = 0; err == LSARITH_OK && i < c->shape[LSMAT_AXIS_0]; i++) {
+        LSArithSpa_reset_(&spa);
+        LSMatIter_t it_a;
+        LSMatIter_init(&it_a, a, LSMAT_AXIS_0, i);
+        size_t k = 0;
+        double va = 0.;
+        while (LSMatIter_next(&it_a, &k, &va)) {
+            LSMatIter_t it_b;
+            LSMatIter_init(&it_b, b, LSMAT_AXIS_0, k);
+            size_t j = 0;
+            double vb = 0.;
+            while (LSMatIter_next(&it_b, &j, &vb)) {
+                LSArithSpa_scatter_(&spa, j, va * vb);
+            }
+        }
+        LSArithSpa_sort_(&spa);
+        for (size_t n = 0; n < spa.n_occupied; n++) {
+            v[n] = spa.acc[spa.occupied[n]];
+        }
+        if (LSMat_accumulate_row(c, i, alpha, spa.occupied, v, spa.n_occupied, prune) !=
+            LSMAT_OK) {
+            err = LSARITH_E_GEN;
+        }
+    }
+    LSArithSpa_destroy_(&spa);
+    free(v);
+    return err;
+}
+
+/*
+ * Products with dense operands. x holds n_vecs vectors interleaved, i.e. a
+ * row-major matrix with one row per column of the sparse operand, and y is
+ * laid out the same way with one row per row of it.
+ */
+typedef struct LSArithSpmm_ {
+    const LSMat_t *mat;
+    const LSMatCsr_t *csr;
+    const double *x;
+    double *y;
+    size_t n_vecs;
+    size_t n_chunks;
+} LSArithSpmm_t;
+
+#define SPMM_BATCH_ 64
+
+static void LSArith_spmm_mat_row_(const LSArithSpmm_t *restrict spmm, size_t i) {
+    const LSMat_t *const mat = spmm->mat;
+    const LSMatHead_t *const head = mat->heads[LSMAT_AXIS_0] + i;
+    const size_t n_vecs = spmm->n_vecs;
+    double *const y = spmm->y + i * n_vecs;
+    if (head->dense != NULL && n_vecs == 1) {
+        y[0] = LSSimd_dot(head->dense, spmm->x, mat->shape[LSMAT_AXIS_1]);
+        return;
+    }
+    const LSMatCell_t *p = head->first_cell;
+    if (head->dense == NULL && n_vecs == 1) {
+        double s = 0.;
+        while (p != NULL) {
+            s += p->v * spmm->x[LSMatCell_idx_of(p, LSMAT_AXIS_1)];
+            p = LSMatCell_succ_of(p, LSMAT_AXIS_1);
+        }
+        y[0] = s;
+        return;
+    }
+    // Cells are scattered over the arena, so they are gathered in batches
+    // for the kernel, which vectorizes along the vectors instead.
+    double v[SPMM_BATCH_];
+    size_t idx[SPMM_BATCH_];
+    size_t n = 0;
+    size_t j = 0;
+    memset(y, 0, n_vecs * sizeof(double));
+    for (;;) {
+        if (head->dense != NULL) {
+            for (; j < mat->shape[LSMAT_AXIS_1] && n < SPMM_BATCH_; j++) {
+                if (head->dense[j] != 0.) {
+                    v[n] = head->dense[j];
+                    idx[n++] = j;
                 }
             }
-            if (sum != 0.) {
-                LSMat_set(out, i, j, sum);
+        } else {
+            for (; p != NULL && n < SPMM_BATCH_; p = LSMatCell_succ_of(p, LSMAT_AXIS_1)) {
+                v[n] = p->v;
+                idx[n++] = LSMatCell_idx_of(p, LSMAT_AXIS_1);
             }
         }
+        if (n == 0) {
+            break;
+        }
+        LSSimd_spmm_row(v, idx, n, spmm->x, n_vecs, y);
+        n = 0;
+    }
+}
+
+static void LSArith_spmm_csr_row_(const LSArithSpmm_t *restrict spmm, size_t i) {
+    const LSMatCsr_t *const csr = spmm->csr;
+    const size_t n_vecs = spmm->n_vecs;
+    const size_t begin = csr->ptr[i];
+    const size_t end = csr->ptr[i + 1];
+    double *const y = spmm->y + i * n_vecs;
+    if (n_vecs == 1) {
+        y[0] = LSSimd_gather_dot(csr->v + begin, csr->idx + begin, spmm->x, end - begin);
+        return;
+    }
+    memset(y, 0, n_vecs * sizeof(double));
+    LSSimd_spmm_row(csr->v + begin, csr->idx + begin, end - begin, spmm->x, n_vecs, y);
+}
+
+static void LSArith_spmm_task_(void *ctx, size_t task) {
+    const LSArithSpmm_t *const spmm = ctx;
+    const size_t n_rows = spmm->mat != NULL ? spmm->mat->shape[LSMAT_AXIS_0]
+                                            : spmm->csr->shape[LSMAT_AXIS_0];
+    const size_t begin = n_rows * task / spmm->n_chunks;
+    const size_t end = n_rows * (task + 1) / spmm->n_chunks;
+    for (size_t i = begin; i < end; i++) {
+        if (spmm->mat != NULL) {
+            LSArith_spmm_mat_row_(spmm, i);
+        } else {
+            LSArith_spmm_csr_row_(spmm, i);
+        }
     }
+}
 
+lsarith_errno_t LSArith_mat_densemat(const LSMat_t *restrict a, const double *restrict x,
+                                     size_t n_vecs, double *restrict y) {
+    LSPROF_FN_();
+    if (a == NULL || x == NULL || y == NULL || n_vecs == 0) {
+        return LSARITH_E_GEN;
+    }
+    LSArithSpmm_t spmm = {.mat = a, .x = x, .y = y, .n_vecs = n_vecs, .n_chunks = n_threads_};
+    LSThreads_run(n_threads_, spmm.n_chunks, LSArith_spmm_task_, &spmm);
     return LSARITH_OK;
 }
 
-LSMatView_t LSArith_mat_T(LSMat_t *restrict a) {
-    LSMatView_t v = LSMatView_from(a);
-    v.axes_mapping[LSMAT_AXIS_0] ^= v.axes_mapping[LSMAT_AXIS_1];
-    v.axes_mapping[LSMAT_AXIS_1] ^= v.axes_mapping[LSMAT_AXIS_0];
-    v.axes_mapping[LSMAT_AXIS_0] ^= v.axes_mapping[LSMAT_AXIS_1];
-    return v;
+lsarith_errno_t LSArith_mat_vec(const LSMat_t *restrict a, const double *restrict x,
+                                double *restrict y) {
+    LSPROF_FN_();
+    return LSArith_mat_densemat(a, x, 1, y);
+}
+
+lsarith_errno_t LSArith_csr_densemat(const LSMatCsr_t *restrict a, const double *restrict x,
+                                     size_t n_vecs, double *restrict y) {
+    LSPROF_FN_();
+    if (a == NULL || x == NULL || y == NULL || n_vecs == 0) {
+        return LSARITH_E_GEN;
+    }
+    if (a->major == LSMAT_AXIS_0) {
+        LSArithSpmm_t spmm = {.csr = a, .x = x, .y = y, .n_vecs = n_vecs, .n_chunks = n_threads_};
+        LSThreads_run(n_threads_, spmm.n_chunks, LSArith_spmm_task_, &spmm);
+        return LSARITH_OK;
+    }
+    // Compressed columns scatter into y, which rows of different columns
+    // would race on, so this one stays serial.
+    memset(y, 0, a->shape[LSMAT_AXIS_0] * n_vecs * sizeof(double));
+    for (size_t j = 0; j < a->shape[LSMAT_AXIS_1]; j++) {
+        for (size_t k = a->ptr[j]; k < a->ptr[j + 1]; k++) {
+            LSSimd_spmm_row(a->v + k, &j, 1, x, n_vecs, y + a->idx[k] * n_vecs);
+        }
+    }
+    return LSARITH_OK;
+}
+
+lsarith_errno_t LSArith_csr_vec(const LSMatCsr_t *restrict a, const double *restrict x,
+                                double *restrict y) {
+    LSPROF_FN_();
+    return LSArith_csr_densemat(a, x, 1, y);
+}
+
+const char *LSArith_simd_isa(void) {
+    return LSSimd_isa();
 }
@@ -0,0 +1,69 @@
+#ifndef LSATOMIC_H_INCLUDED_
+#define LSATOMIC_H_INCLUDED_
+
+#include "lsmat/lsmat.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * Accesses to plain fields that lock-free readers may see while a writer
+ * changes them. Release stores and acquire loads compile to ordinary moves
+ * on x86, so the single-threaded paths pay nothing for going through here.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+
+static inline LSMatCell_t *LSAtomic_load_cell_(LSMatCell_t *const *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void LSAtomic_store_cell_(LSMatCell_t **p, LSMatCell_t *cell) {
+    __atomic_store_n(p, cell, __ATOMIC_RELEASE);
+}
+
+static inline double LSAtomic_load_f64_(const double *p) {
+    double v;
+    __atomic_load(p, &v, __ATOMIC_RELAXED);
+    return v;
+}
+
+static inline void LSAtomic_store_f64_(double *p, double v) {
+    __atomic_store(p, &v, __ATOMIC_RELAXED);
+}
+
+static inline void LSAtomic_inc_u64_(uint64_t *p) {
+    __atomic_fetch_add(p, 1, __ATOMIC_RELAXED);
+}
+
+#else
+
+// Aligned word accesses do not tear on any target we build for.
+static inline LSMatCell_t *LSAtomic_load_cell_(LSMatCell_t *const *p) {
+    LSMatCell_t *const cell = *(LSMatCell_t *const volatile *)p;
+    atomic_thread_fence(memory_order_acquire);
+    return cell;
+}
+
+static inline void LSAtomic_store_cell_(LSMatCell_t **p, LSMatCell_t *cell) {
+    atomic_thread_fence(memory_order_release);
+    *(LSMatCell_t *volatile *)p = cell;
+}
+
+static inline double LSAtomic_load_f64_(const double *p) {
+    return *(const volatile double *)p;
+}
+
+static inline void LSAtomic_store_f64_(double *p, double v) {
+    *(volatile double *)p = v;
+}
+
+static inline void LSAtomic_inc_u64_(uint64_t *p) {
+    static atomic_flag lock_ = ATOMIC_FLAG_INIT;
+    while (atomic_flag_test_and_set_explicit(&lock_, memory_order_acquire)) {
+    }
+    (*p)++;
+    atomic_flag_clear_explicit(&lock_, memory_order_release);
+}
+
+#endif
+
+#endif /* LSATOMIC_H_INCLUDED_ */
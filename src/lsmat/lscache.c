@@ -0,0 +1,211 @@
+#include "lsmat/lscache.h"
+#include "lsmat/lsmat.h"
+#include "lsmem.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_MIN_BUCKETS_ 64u
+
+// FNV-1a; keys are short byte strings built by the caller.
+static uint64_t LSCache_hash_(const unsigned char *restrict key, size_t key_len) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t k = 0; k < key_len; k++) {
+        h ^= key[k];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static void LSCache_unlink_lru_(LSCache_t *restrict cache, LSCacheEntry_t *restrict e) {
+    if (e->newer != NULL) {
+        e->newer->older = e->older;
+    } else {
+        cache->newest = e->older;
+    }
+    if (e->older != NULL) {
+        e->older->newer = e->newer;
+    } else {
+        cache->oldest = e->newer;
+    }
+    e->newer = NULL;
+    e->older = NULL;
+}
+
+static void LSCache_push_lru_(LSCache_t *restrict cache, LSCacheEntry_t *restrict e) {
+    e->older = cache->newest;
+    e->newer = NULL;
+    if (cache->newest != NULL) {
+        cache->newest->newer = e;
+    } else {
+        cache->oldest = e;
+    }
+    cache->newest = e;
+}
+
+static LSCacheEntry_t **LSCache_slot_of_(const LSCache_t *restrict cache, uint64_t hash,
+                                         const void *restrict key, size_t key_len) {
+    LSCacheEntry_t **slot = cache->buckets + (hash & (cache->n_buckets - 1));
+    while (*slot != NULL && ((*slot)->hash != hash || (*slot)->key_len != key_len ||
+                             memcmp((*slot)->key, key, key_len) != 0)) {
+        slot = &(*slot)->chain;
+    }
+    return slot;
+}
+
+static void LSCache_evict_(LSCache_t *restrict cache, LSCacheEntry_t *restrict e) {
+    LSCacheEntry_t **const slot = LSCache_slot_of_(cache, e->hash, e->key, e->key_len);
+    *slot = e->chain;
+    LSCache_unlink_lru_(cache, e);
+    cache->bytes -= e->bytes;
+    cache->n_entries--;
+    LSMat_free(e->mat);
+    FREE_NULLIFY_(e);
+}
+
+static void LSCache_shrink_to_(LSCache_t *restrict cache, size_t limit) {
+    while (cache->oldest != NULL && cache->bytes > limit) {
+        LSCache_evict_(cache, cache->oldest);
+    }
+}
+
+static void LSCache_grow_(LSCache_t *restrict cache) {
+    const size_t n_buckets = cache->n_buckets * 2;
+    LSCacheEntry_t **const buckets = lsmem_calloc_(n_buckets, sizeof(LSCacheEntry_t *));
+    if (buckets == NULL) {
+        // Longer chains are still correct.
+        return;
+    }
+    for (size_t b = 0; b < cache->n_buckets; b++) {
+        LSCacheEntry_t *e = cache->buckets[b];
+        while (e != NULL) {
+            LSCacheEntry_t *const t = e->chain;
+            LSCacheEntry_t **const slot = buckets + (e->hash & (n_buckets - 1));
+            e->chain = *slot;
+            *slot = e;
+            e = t;
+        }
+    }
+    FREE_NULLIFY_(cache->buckets);
+    cache->buckets = buckets;
+    cache->n_buckets = n_buckets;
+}
+
+lsmat_errno_t LSCache_init(LSCache_t *restrict cache, size_t limit) {
+    if (cache == NULL) {
+        return LSMAT_E_GEN;
+    }
+    memset(cache, 0, sizeof(LSCache_t));
+    cache->buckets = lsmem_calloc_(CACHE_MIN_BUCKETS_, sizeof(LSCacheEntry_t *));
+    if (cache->buckets == NULL) {
+        return LSMAT_E_GEN;
+    }
+    cache->n_buckets = CACHE_MIN_BUCKETS_;
+    cache->limit = limit;
+    return LSMAT_OK;
+}
+
+lsmat_errno_t LSCache_destroy(LSCache_t *restrict cache) {
+    if (cache == NULL) {
+        return LSMAT_E_GEN;
+    }
+    LSCache_clear(cache);
+    if (cache->buckets != NULL) {
+        FREE_NULLIFY_(cache->buckets);
+    }
+    cache->n_buckets = 0;
+    return LSMAT_OK;
+}
+
+LSMat_t *LSCache_get(LSCache_t *restrict cache, const void *restrict key, size_t key_len) {
+    if (cache == NULL || cache->buckets == NULL) {
+        return NULL;
+    }
+    const uint64_t hash = LSCache_hash_(key, key_len);
+    LSCacheEntry_t *const e = *LSCache_slot_of_(cache, hash, key, key_len);
+    if (e == NULL) {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    LSCache_unlink_lru_(cache, e);
+    LSCache_push_lru_(cache, e);
+    return e->mat;
+}
+
+/*
+ * Keep a reference to mat under key, charged bytes against the limit. Entries
+ * that could never fit are not stored at all. deps lists the ids of the
+ * matrices mat was computed from, for LSCache_drop_id.
+ */
+lsmat_errno_t LSCache_put(LSCache_t *restrict cache, const void *restrict key, size_t key_len,
+                          const uint64_t *restrict deps, size_t n_deps, LSMat_t *restrict mat,
+                          size_t bytes) {
+    if (cache == NULL || cache->buckets == NULL || mat == NULL) {
+        return LSMAT_E_GEN;
+    }
+    // The ids follow the key, aligned, in the same block.
+    const size_t deps_at = (sizeof(LSCacheEntry_t) + key_len + _Alignof(uint64_t) - 1) &
+                           ~(_Alignof(uint64_t) - 1);
+    const size_t entry_size = deps_at + n_deps * sizeof(uint64_t);
+    bytes += entry_size;
+    if (bytes > cache->limit) {
+        return LSMAT_OK;
+    }
+    const uint64_t hash = LSCache_hash_(key, key_len);
+    LSCacheEntry_t *const old = *LSCache_slot_of_(cache, hash, key, key_len);
+    if (old != NULL) {
+        LSCache_evict_(cache, old);
+    }
+    LSCache_shrink_to_(cache, cache->limit - bytes);
+    LSCacheEntry_t *const e = lsmem_malloc_(entry_size);
+    if (e == NULL) {
+        return LSMAT_E_GEN;
+    }
+    e->hash = hash;
+    e->mat = LSMat_retain(mat);
+    e->bytes = bytes;
+    e->deps = (uint64_t *)((unsigned char *)e + deps_at);
+    e->n_deps = n_deps;
+    if (n_deps > 0) {
+        memcpy(e->deps, deps, n_deps * sizeof(uint64_t));
+    }
+    e->key_len = key_len;
+    memcpy(e->key, key, key_len);
+    if (cache->n_entries >= cache->n_buckets) {
+        LSCache_grow_(cache);
+    }
+    LSCacheEntry_t **const slot = cache->buckets + (hash & (cache->n_buckets - 1));
+    e->chain = *slot;
+    *slot = e;
+    LSCache_push_lru_(cache, e);
+    cache->bytes += bytes;
+    cache->n_entries++;
+    return LSMAT_OK;
+}
+
+void LSCache_set_limit(LSCache_t *restrict cache, size_t limit) {
+    cache->limit = limit;
+    LSCache_shrink_to_(cache, limit);
+}
+
+void LSCache_clear(LSCache_t *restrict cache) {
+    LSCache_shrink_to_(cache, 0);
+}
+
+// Forget everything computed from, or holding, the matrix with the given id.
+void LSCache_drop_id(LSCache_t *restrict cache, uint64_t id) {
+    LSCacheEntry_t *e = cache->oldest;
+    while (e != NULL) {
+        LSCacheEntry_t *const newer = e->newer;
+        bool hit = e->mat->id == id;
+        for (size_t k = 0; !hit && k < e->n_deps; k++) {
+            hit = e->deps[k] == id;
+        }
+        if (hit) {
+            LSCache_evict_(cache, e);
+        }
+        e = newer;
+    }
+}
@@ -0,0 +1,228 @@
+#include "lsmat/lsconc.h"
+#include "lsatomic.h"
+#include "lsmat/lsmat.h"
+#include "lsprobe.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#define CONC_COLLECT_EVERY_ 64u
+
+/*
+ * Readers walk rows without taking any lock. Writers lock the stripe of the
+ * row and then the stripe of the column; rows always come first, so two
+ * writers never wait on each other in a cycle. Cells taken out of the lists
+ * are parked in the bucket of the current epoch, and go back to the arena
+ * once the epoch has moved on far enough that no reader can still see them.
+ */
+
+static bool LSMatConc_locks_init_(mtx_t *restrict locks, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+        if (mtx_init(locks + k, mtx_plain) != thrd_success) {
+            while (k-- > 0) {
+                mtx_destroy(locks + k);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+static void LSMatConc_locks_destroy_(mtx_t *restrict locks, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+        mtx_destroy(locks + k);
+    }
+}
+
+lsmat_errno_t LSMatConc_init(LSMatConc_t *restrict conc, LSMat_t *restrict mat, size_t n_stripes,
+                             size_t n_readers) {
+    if (conc == NULL || mat == NULL || n_stripes == 0) {
+        return LSMAT_E_GEN;
+    }
+    *conc = (LSMatConc_t){
+        .mat = mat,
+        .n_stripes = n_stripes,
+        .n_readers = n_readers,
+    };
+    conc->row_locks = malloc(n_stripes * sizeof(mtx_t));
+    conc->col_locks = malloc(n_stripes * sizeof(mtx_t));
+    conc->readers = calloc(n_readers > 0 ? n_readers : 1, sizeof(LSMatConcReader_t));
+    bool ok = conc->row_locks != NULL && conc->col_locks != NULL && conc->readers != NULL;
+    const bool row_ok = ok && LSMatConc_locks_init_(conc->row_locks, n_stripes);
+    const bool col_ok = row_ok && LSMatConc_locks_init_(conc->col_locks, n_stripes);
+    const bool lock_ok = col_ok && mtx_init(&conc->lock, mtx_plain) == thrd_success;
+    if (!lock_ok) {
+        if (col_ok) {
+            LSMatConc_locks_destroy_(conc->col_locks, n_stripes);
+        }
+        if (row_ok) {
+            LSMatConc_locks_destroy_(conc->row_locks, n_stripes);
+        }
+        free(conc->row_locks);
+        free(conc->col_locks);
+        free(conc->readers);
+        conc->mat = NULL;
+        return LSMAT_E_GEN;
+    }
+    for (size_t r = 0; r < n_readers; r++) {
+        atomic_init(&conc->readers[r].epoch, 0);
+    }
+    // Zero marks a reader that is outside, so epochs start at one.
+    atomic_init(&conc->epoch, 1);
+    return LSMAT_OK;
+}
+
+// Hand a bucket of retired cells back to the arena; needs conc->lock.
+static void LSMatConc_reclaim_(LSMatConc_t *restrict conc, size_t bucket) {
+    LSMatCell_t *p = conc->retired[bucket];
+    while (p != NULL) {
+        LSMatCell_t *const t = LSMatCell_succ_of(p, LSMAT_AXIS_0);
+        LSMatArena_recycle(&conc->mat->arena, p);
+        p = t;
+    }
+    conc->retired[bucket] = NULL;
+}
+
+lsmat_errno_t LSMatConc_destroy(LSMatConc_t *restrict conc) {
+    if (conc == NULL || conc->mat == NULL) {
+        return LSMAT_E_GEN;
+    }
+    for (size_t k = 0; k < LSMAT_CONC_EPOCHS; k++) {
+        LSMatConc_reclaim_(conc, k);
+    }
+    LSMatConc_locks_destroy_(conc->row_locks, conc->n_stripes);
+    LSMatConc_locks_destroy_(conc->col_locks, conc->n_stripes);
+    mtx_destroy(&conc->lock);
+    free(conc->row_locks);
+    free(conc->col_locks);
+    free(conc->readers);
+    // Rows may have crossed the dense threshold while writers left them be.
+    const lsmat_errno_t err = LSMat_adapt(conc->mat);
+    conc->mat = NULL;
+    return err;
+}
+
+void LSMatConc_enter(LSMatConc_t *restrict conc, size_t reader) {
+    LSMatConcReader_t *const r = conc->readers + reader;
+    atomic_store_explicit(&r->epoch, atomic_load(&conc->epoch), memory_order_relaxed);
+    // The announcement has to be visible before the first pointer is read.
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void LSMatConc_leave(LSMatConc_t *restrict conc, size_t reader) {
+    atomic_store_explicit(&conc->readers[reader].epoch, 0, memory_order_release);
+}
+
+double LSMatConc_at(const LSMatConc_t *restrict conc, size_t i_0, size_t i_1) {
+    LSPROF_FN_();
+    const LSMat_t *const mat = conc->mat;
+    if (i_0 >= mat->shape[LSMAT_AXIS_0] || i_1 >= mat->shape[LSMAT_AXIS_1]) {
+        return 0.;
+    }
+    const LSMatHead_t *const head = mat->heads[LSMAT_AXIS_0] + i_0;
+    if (head->dense != NULL) {
+        return LSAtomic_load_f64_(head->dense + i_1);
+    }
+    // The cursor and the skip index belong to the writers; walk the list.
+    const LSMatCell_t *p = LSAtomic_load_cell_(&head->first_cell);
+    while (p != NULL) {
+        const size_t j = LSMatCell_idx_of(p, LSMAT_AXIS_1);
+        if (j >= i_1) {
+            return j == i_1 ? LSAtomic_load_f64_(&p->v) : 0.;
+        }
+        p = LSAtomic_load_cell_(&p->axes[LSMAT_AXIS_1].next);
+    }
+    return 0.;
+}
+
+/*
+ * Move to the next epoch if every reader inside has seen the current one.
+ * The bucket about to be reused holds cells retired three epochs back.
+ * Needs conc->lock.
+ */
+static void LSMatConc_collect_(LSMatConc_t *restrict conc) {
+    atomic_thread_fence(memory_order_seq_cst);
+    const uint64_t epoch = atomic_load(&conc->epoch);
+    for (size_t r = 0; r < conc->n_readers; r++) {
+        const uint64_t seen = atomic_load_explicit(&conc->readers[r].epoch, memory_order_acquire);
+        if (seen != 0 && seen != epoch) {
+            return;
+        }
+    }
+    atomic_store(&conc->epoch, epoch + 1);
+    LSMatConc_reclaim_(conc, (epoch + 1) % LSMAT_CONC_EPOCHS);
+    conc->n_retired = 0;
+}
+
+static lsmat_errno_t LSMatConc_set_locked_(LSMatConc_t *restrict conc, size_t i_0, size_t i_1,
+                                           double v, LSMatCell_t **restrict out_retired) {
+    LSMat_t *const mat = conc->mat;
+    LSMatHead_t *const head_0 = mat->heads[LSMAT_AXIS_0] + i_0;
+    LSMatHead_t *const head_1 = mat->heads[LSMAT_AXIS_1] + i_1;
+    LSAtomic_inc_u64_(&mat->version);
+    // Rows keep their layout until the session ends, so a dense row stays
+    // dense and its array stays put.
+    if (head_0->dense != NULL) {
+        const double old = head_0->dense[i_1];
+        LSAtomic_store_f64_(head_0->dense + i_1, v);
+        head_0->len += (old == 0.) - (v == 0.);
+        return LSMAT_OK;
+    }
+    LSMatCell_t *const cell = LSMatHead_seek(head_0, i_1, LSMAT_AXIS_1);
+    if (cell != NULL && v != 0.) {
+        LSAtomic_store_f64_(&cell->v, v);
+        return LSMAT_OK;
+    }
+    if (cell != NULL) {
+        LSMatHead_remove(head_0, cell, LSMAT_AXIS_1);
+        LSMatHead_remove(head_1, cell, LSMAT_AXIS_0);
+        *out_retired = cell;
+        return LSMAT_OK;
+    }
+    if (v == 0.) {
+        return LSMAT_OK;
+    }
+    mtx_lock(&conc->lock);
+    LSMatCell_t *const new_cell = LSMatArena_alloc(&mat->arena);
+    mtx_unlock(&conc->lock);
+    if (new_cell == NULL) {
+        return LSMAT_E_GEN;
+    }
+    LSMatCell_set_idx(new_cell, LSMAT_AXIS_0, i_0);
+    LSMatCell_set_idx(new_cell, LSMAT_AXIS_1, i_1);
+    new_cell->v = v;
+    LSMatCell_t *dup = NULL;
+    LSMatHead_insert(head_0, new_cell, LSMAT_AXIS_1, &dup);
+    LSMatHead_insert(head_1, new_cell, LSMAT_AXIS_0, &dup);
+    return LSMAT_OK;
+}
+
+lsmat_errno_t LSMatConc_set(LSMatConc_t *restrict conc, size_t i_0, size_t i_1, double v) {
+    LSPROF_FN_();
+    if (conc == NULL || conc->mat == NULL || i_0 >= conc->mat->shape[LSMAT_AXIS_0] ||
+        i_1 >= conc->mat->shape[LSMAT_AXIS_1]) {
+        return LSMAT_E_GEN;
+    }
+    mtx_t *const row_lock = conc->row_locks + i_0 % conc->n_stripes;
+    mtx_t *const col_lock = conc->col_locks + i_1 % conc->n_stripes;
+    LSMatCell_t *retired = NULL;
+    mtx_lock(row_lock);
+    mtx_lock(col_lock);
+    const lsmat_errno_t err = LSMatConc_set_locked_(conc, i_0, i_1, v, &retired);
+    mtx_unlock(col_lock);
+    mtx_unlock(row_lock);
+    if (retired != NULL) {
+        mtx_lock(&conc->lock);
+        // Only the column link is free to reuse; readers may still follow the row one.
+        const size_t bucket = atomic_load(&conc->epoch) % LSMAT_CONC_EPOCHS;
+        *LSMatCell_ref_succ_of(retired, LSMAT_AXIS_0) = conc->retired[bucket];
+        conc->retired[bucket] = retired;
+        if (++conc->n_retired >= CONC_COLLECT_EVERY_) {
+            LSMatConc_collect_(conc);
+        }
+        mtx_unlock(&conc->lock);
+    }
+    return err;
+}
@@ -0,0 +1,322 @@
+#include "lsmat/lscsr.h"
+#include "lsmat/lsmat.h"
+#include "lsfile.h"
+#include "lsmem.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OTHER_AXIS_(a_) ((lsmat_axis_t)(LSMAT_AXIS_COUNT_ - 1 - (a_)))
+
+#define FILE_MAGIC_ "LSMATCSR"
+#define FILE_VERSION_ 1u
+#define FILE_BYTE_ORDER_ 0x01020304u
+#define FILE_DTYPE_F64_ 1u
+
+/*
+ * On-disk layout: this header, then ptr, idx and v exactly as they sit in
+ * memory, all in native byte order. Every array starts 8-aligned, so a
+ * mapping of the file is usable as is.
+ */
+typedef struct LSMatCsrFileHeader_ {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t dtype;
+    uint32_t idx_width;
+    uint64_t shape[LSMAT_AXIS_COUNT_];
+    uint64_t nnz;
+    uint64_t major;
+    uint64_t reserved;
+} LSMatCsrFileHeader_t;
+
+LSMatCsr_t *LSMatCsr_new(size_t shape_0, size_t shape_1, lsmat_axis_t major, size_t nnz) {
+    if (major >= LSMAT_AXIS_COUNT_) {
+        return NULL;
+    }
+    LSMatCsr_t *const csr = lsmem_malloc_(sizeof(LSMatCsr_t));
+    if (csr == NULL) {
+        return NULL;
+    }
+    csr->shape[LSMAT_AXIS_0] = shape_0;
+    csr->shape[LSMAT_AXIS_1] = shape_1;
+    csr->major = major;
+    csr->nnz = nnz;
+    csr->map = NULL;
+    csr->map_len = 0;
+    // Keep the arrays non-NULL even for empty matrices.
+    csr->ptr = lsmem_calloc_(csr->shape[major] + 1, sizeof(size_t));
+    csr->idx = lsmem_malloc_((nnz > 0 ? nnz : 1) * sizeof(size_t));
+    csr->v = lsmem_malloc_((nnz > 0 ? nnz : 1) * sizeof(double));
+    if (csr->ptr == NULL || csr->idx == NULL || csr->v == NULL) {
+        LSMatCsr_free(csr);
+        return NULL;
+    }
+    return csr;
+}
+
+lsmat_errno_t LSMatCsr_free(LSMatCsr_t *restrict csr) {
+    if (csr == NULL) {
+        return LSMAT_E_GEN;
+    }
+    if (csr->map != NULL) {
+        // The arrays point into the file.
+        LSFile_unmap(csr->map, csr->map_len);
+    } else {
+        FREE_NULLIFY_(csr->ptr);
+        FREE_NULLIFY_(csr->idx);
+        FREE_NULLIFY_(csr->v);
+    }
+    FREE_NULLIFY_(csr);
+    return LSMAT_OK;
+}
+
+double LSMatCsr_at(const LSMatCsr_t *restrict csr, size_t i_0, size_t i_1) {
+    if (csr == NULL || i_0 >= csr->shape[LSMAT_AXIS_0] || i_1 >= csr->shape[LSMAT_AXIS_1]) {
+        return 0.;
+    }
+    const size_t indices[LSMAT_AXIS_COUNT_] = {i_0, i_1};
+    const size_t line = indices[csr->major];
+    const size_t target = indices[OTHER_AXIS_(csr->major)];
+    size_t lo = csr->ptr[line];
+    size_t hi = csr->ptr[line + 1];
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (csr->idx[mid] < target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < csr->ptr[line + 1] && csr->idx[lo] == target ? csr->v[lo] : 0.;
+}
+
+LSMatCsr_t *LSMatCsr_transcode(const LSMatCsr_t *restrict csr) {
+    if (csr == NULL) {
+        return NULL;
+    }
+    const lsmat_axis_t minor = OTHER_AXIS_(csr->major);
+    LSMatCsr_t *const out =
+        LSMatCsr_new(csr->shape[LSMAT_AXIS_0], csr->shape[LSMAT_AXIS_1], minor, csr->nnz);
+    if (out == NULL) {
+        return NULL;
+    }
+    // Counting sort on the minor index; lines are visited in order, so the
+    // output lines come out sorted as well.
+    for (size_t k = 0; k < csr->nnz; k++) {
+        out->ptr[csr->idx[k] + 1]++;
+    }
+    for (size_t j = 0; j < csr->shape[minor]; j++) {
+        out->ptr[j + 1] += out->ptr[j];
+    }
+    for (size_t i = 0; i < csr->shape[csr->major]; i++) {
+        for (size_t k = csr->ptr[i]; k < csr->ptr[i + 1]; k++) {
+            const size_t dst = out->ptr[csr->idx[k]]++;
+            out->idx[dst] = i;
+            out->v[dst] = csr->v[k];
+        }
+    }
+    // Shift the cursors back into line offsets.
+    for (size_t j = csr->shape[minor]; j > 0; j--) {
+        out->ptr[j] = out->ptr[j - 1];
+    }
+    out->ptr[0] = 0;
+    return out;
+}
+
+LSMatCsr_t *LSMat_freeze(const LSMat_t *restrict mat, lsmat_axis_t major) {
+    if (mat == NULL || major >= LSMAT_AXIS_COUNT_) {
+        return NULL;
+    }
+    size_t nnz = 0;
+    for (size_t i = 0; i < mat->shape[LSMAT_AXIS_0]; i++) {
+        nnz += mat->heads[LSMAT_AXIS_0][i].len;
+    }
+    LSMatCsr_t *const csr =
+        LSMatCsr_new(mat->shape[LSMAT_AXIS_0], mat->shape[LSMAT_AXIS_1], major, nnz);
+    if (csr == NULL) {
+        return NULL;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < mat->shape[major]; i++) {
+        LSMatIter_t it;
+        LSMatIter_init(&it, mat, major, i);
+        while (LSMatIter_next(&it, csr->idx + k, csr->v + k)) {
+            k++;
+        }
+        csr->ptr[i + 1] = k;
+    }
+    return csr;
+}
+
+LSMat_t *LSMatCsr_thaw(const LSMatCsr_t *restrict csr) {
+    if (csr == NULL) {
+        return NULL;
+    }
+    const lsmat_axis_t major = csr->major;
+    const lsmat_axis_t minor = OTHER_AXIS_(major);
+    LSMat_t *const mat = LSMat_new(csr->shape[LSMAT_AXIS_0], csr->shape[LSMAT_AXIS_1]);
+    if (mat == NULL) {
+        return NULL;
+    }
+    if (major == LSMAT_AXIS_0) {
+        // Rows go through a writer, which also rejects indices that are out
+        // of range or out of order, as a damaged file may hold.
+        LSMatWriter_t w;
+        if (LSMatWriter_init(&w, mat) != LSMAT_OK) {
+            LSMat_free(mat);
+            return NULL;
+        }
+        bool ok = true;
+        for (size_t i = 0; ok && i < csr->shape[LSMAT_AXIS_0]; i++) {
+            for (size_t k = csr->ptr[i]; ok && k < csr->ptr[i + 1]; k++) {
+                ok = LSMatWriter_put(&w, csr->idx[k], csr->v[k]) == LSMAT_OK;
+            }
+            ok = ok && LSMatWriter_end_row(&w, i) == LSMAT_OK;
+        }
+        LSMat_stitch(mat, &w, 1, 0, mat->shape[LSMAT_AXIS_1]);
+        ok = LSMat_adopt(mat, &w, 1) == LSMAT_OK && ok;
+        if (!ok) {
+            LSMat_free(mat);
+            return NULL;
+        }
+        return mat;
+    }
+    // Lines are sorted and visited in order, so every cell is appended to
+    // the tail of both of its lists.
+    for (size_t i = 0; i < csr->shape[major]; i++) {
+        for (size_t k = csr->ptr[i]; k < csr->ptr[i + 1]; k++) {
+            if (csr->v[k] == 0.) {
+                continue;
+            }
+            const size_t j = csr->idx[k];
+            LSMatCell_t *const cell = LSMatArena_alloc(&mat->arena);
+            if (cell == NULL) {
+                LSMat_free(mat);
+                return NULL;
+            }
+            LSMatCell_set_idx(cell, major, i);
+            LSMatCell_set_idx(cell, minor, j);
+            cell->v = csr->v[k];
+            LSMatHead_append(mat->heads[major] + i, cell, minor);
+            LSMatHead_append(mat->heads[minor] + j, cell, major);
+        }
+    }
+    if (LSMat_adapt(mat) != LSMAT_OK) {
+        LSMat_free(mat);
+        return NULL;
+    }
+    return mat;
+}
+
+lsmat_errno_t LSMatCsr_save(const LSMatCsr_t *restrict csr, const char *restrict path) {
+    if (csr == NULL || path == NULL) {
+        return LSMAT_E_GEN;
+    }
+    // Files are always row-major.
+    LSMatCsr_t *const rows = csr->major == LSMAT_AXIS_0 ? NULL : LSMatCsr_transcode(csr);
+    const LSMatCsr_t *const src = rows != NULL ? rows : csr;
+    if (src->major != LSMAT_AXIS_0) {
+        return LSMAT_E_GEN;
+    }
+    LSMatCsrFileHeader_t header = {
+        .version = FILE_VERSION_,
+        .byte_order = FILE_BYTE_ORDER_,
+        .dtype = FILE_DTYPE_F64_,
+        .idx_width = sizeof(size_t),
+        .shape = {src->shape[LSMAT_AXIS_0], src->shape[LSMAT_AXIS_1]},
+        .nnz = src->nnz,
+        .major = LSMAT_AXIS_0,
+    };
+    memcpy(header.magic, FILE_MAGIC_, sizeof(header.magic));
+    // The target may be mapped, by a load of it here or elsewhere; it is
+    // replaced whole rather than truncated under those mappings.
+    char *tmp = NULL;
+    FILE *const f = LSFile_open_replacement(path, &tmp);
+    bool ok = f != NULL;
+    ok = ok && fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok && fwrite(src->ptr, sizeof(size_t), src->shape[LSMAT_AXIS_0] + 1, f) ==
+                   src->shape[LSMAT_AXIS_0] + 1;
+    ok = ok && fwrite(src->idx, sizeof(size_t), src->nnz, f) == src->nnz;
+    ok = ok && fwrite(src->v, sizeof(double), src->nnz, f) == src->nnz;
+    if (f != NULL && !LSFile_commit_replacement(f, tmp, path, ok)) {
+        ok = false;
+    }
+    if (rows != NULL) {
+        LSMatCsr_free(rows);
+    }
+    return ok ? LSMAT_OK : LSMAT_E_GEN;
+}
+
+static bool LSMatCsr_check_header_(const LSMatCsrFileHeader_t *restrict h, size_t len) {
+    if (len < sizeof(LSMatCsrFileHeader_t) ||
+        memcmp(h->magic, FILE_MAGIC_, sizeof(h->magic)) != 0 || h->version != FILE_VERSION_ ||
+        h->byte_order != FILE_BYTE_ORDER_ || h->dtype != FILE_DTYPE_F64_ ||
+        h->idx_width != sizeof(size_t) || h->major != LSMAT_AXIS_0) {
+        return false;
+    }
+    // Sizes are checked against the file before anything is multiplied.
+    const size_t n_words = (len - sizeof(LSMatCsrFileHeader_t)) / sizeof(uint64_t);
+    if (h->shape[LSMAT_AXIS_0] >= n_words || h->nnz > n_words / 2 ||
+        h->shape[LSMAT_AXIS_0] > LSMAT_IDX_MAX || h->shape[LSMAT_AXIS_1] > LSMAT_IDX_MAX ||
+        h->shape[LSMAT_AXIS_1] > SIZE_MAX / sizeof(LSMatHead_t)) {
+        return false;
+    }
+    return len == sizeof(LSMatCsrFileHeader_t) +
+                      (h->shape[LSMAT_AXIS_0] + 1 + 2 * h->nnz) * sizeof(uint64_t);
+}
+
+/*
+ * Map a file written by LSMatCsr_save. The header, the row pointers and the
+ * column indices are checked here, with one read-only pass over each; the
+ * pages of idx and v are still shared with every other process that maps
+ * the same file until someone thaws them.
+ */
+LSMatCsr_t *LSMatCsr_load(const char *restrict path) {
+    if (path == NULL) {
+        return NULL;
+    }
+    size_t len = 0;
+    void *const map = LSFile_map(path, &len);
+    if (map == NULL) {
+        return NULL;
+    }
+    LSMatCsr_t *csr = lsmem_malloc_(sizeof(LSMatCsr_t));
+    const LSMatCsrFileHeader_t *const h = map;
+    if (csr == NULL || !LSMatCsr_check_header_(h, len)) {
+        LSFile_unmap(map, len);
+        if (csr != NULL) {
+            FREE_NULLIFY_(csr);
+        }
+        return NULL;
+    }
+    csr->shape[LSMAT_AXIS_0] = h->shape[LSMAT_AXIS_0];
+    csr->shape[LSMAT_AXIS_1] = h->shape[LSMAT_AXIS_1];
+    csr->major = LSMAT_AXIS_0;
+    csr->nnz = h->nnz;
+    csr->ptr = (size_t *)((char *)map + sizeof(LSMatCsrFileHeader_t));
+    csr->idx = csr->ptr + csr->shape[LSMAT_AXIS_0] + 1;
+    csr->v = (double *)(csr->idx + csr->nnz);
+    csr->map = map;
+    csr->map_len = len;
+    // Row pointers bound every later access, so they must be sane.
+    bool ok = csr->ptr[0] == 0 && csr->ptr[csr->shape[LSMAT_AXIS_0]] == csr->nnz;
+    for (size_t i = 0; ok && i < csr->shape[LSMAT_AXIS_0]; i++) {
+        ok = csr->ptr[i] <= csr->ptr[i + 1];
+    }
+    // Every consumer of the arrays trusts that rows are strictly ascending
+    // and in range, so that is settled once, here.
+    for (size_t i = 0; ok && i < csr->shape[LSMAT_AXIS_0]; i++) {
+        for (size_t k = csr->ptr[i]; ok && k < csr->ptr[i + 1]; k++) {
+            ok = csr->idx[k] < csr->shape[LSMAT_AXIS_1] &&
+                 (k == csr->ptr[i] || csr->idx[k - 1] < csr->idx[k]);
+        }
+    }
+    if (!ok) {
+        LSMatCsr_free(csr);
+        return NULL;
+    }
+    return csr;
+}
@@ -0,0 +1,142 @@
+#ifdef __linux__
+#define _DEFAULT_SOURCE
+#endif
+
+#include "lsfile.h"
+#include "lsmem.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FILE_TMP_TRIES_ 16u
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Map a whole file read-only. The pages are shared with every other mapping
+ * of the file; Windows builds read the file into memory instead.
+ */
+void *LSFile_map(const char *restrict path, size_t *restrict out_len) {
+    *out_len = 0;
+#ifdef _WIN32
+    FILE *const f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    size_t len = 0;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        const long end = ftell(f);
+        len = end > 0 ? (size_t)end : 0;
+    }
+    void *map = len > 0 ? lsmem_malloc_(len) : NULL;
+    if (map == NULL || fseek(f, 0, SEEK_SET) != 0 || fread(map, 1, len, f) != len) {
+        fclose(f);
+        if (map != NULL) {
+            FREE_NULLIFY_(map);
+        }
+        return NULL;
+    }
+    fclose(f);
+#else
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+    const size_t len = (size_t)st.st_size;
+    void *const map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+#endif
+    *out_len = len;
+    return map;
+}
+
+void LSFile_unmap(void *map, size_t len) {
+    if (map == NULL) {
+        return;
+    }
+#ifdef _WIN32
+    (void)len;
+    FREE_NULLIFY_(map);
+#else
+    munmap(map, len);
+#endif
+}
+
+/*
+ * Open a fresh file next to path, to be renamed over it once complete.
+ * Mappings of the old file keep their inode, so truncating it under them
+ * (and the SIGBUS that follows) never happens.
+ */
+FILE *LSFile_open_replacement(const char *restrict path, char **restrict out_tmp) {
+    *out_tmp = NULL;
+    const size_t len = strlen(path) + 32;
+    char *const tmp = malloc(len);
+    if (tmp == NULL) {
+        return NULL;
+    }
+    for (unsigned k = 0; k < FILE_TMP_TRIES_; k++) {
+#ifdef _WIN32
+        snprintf(tmp, len, "%s.tmp%u", path, k);
+        FILE *const f = fopen(tmp, "wbx");
+        if (f == NULL) {
+            continue;
+        }
+#else
+        snprintf(tmp, len, "%s.tmp%ld.%u", path, (long)getpid(), k);
+        const int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd < 0) {
+            if (errno == EEXIST) {
+                continue;
+            }
+            break;
+        }
+        FILE *const f = fdopen(fd, "wb");
+        if (f == NULL) {
+            close(fd);
+            remove(tmp);
+            break;
+        }
+#endif
+        *out_tmp = tmp;
+        return f;
+    }
+    free(tmp);
+    return NULL;
+}
+
+// Close f and move it over path if ok; otherwise throw it away.
+bool LSFile_commit_replacement(FILE *f, char *tmp, const char *restrict path, bool ok) {
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+#ifdef _WIN32
+    // rename() will not replace an existing file here; nothing maps it anyway.
+    if (ok) {
+        remove(path);
+    }
+#endif
+    if (ok && rename(tmp, path) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        remove(tmp);
+    }
+    free(tmp);
+    return ok;
+}
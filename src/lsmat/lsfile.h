@@ -0,0 +1,13 @@
+#ifndef LSFILE_H_INCLUDED_
+#define LSFILE_H_INCLUDED_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+void *LSFile_map(const char *restrict path, size_t *restrict out_len);
+void LSFile_unmap(void *map, size_t len);
+FILE *LSFile_open_replacement(const char *restrict path, char **restrict out_tmp);
+bool LSFile_commit_replacement(FILE *f, char *tmp, const char *restrict path, bool ok);
+
+#endif /* LSFILE_H_INCLUDED_ */
@@ -0,0 +1,794 @@
+#include "lsmat/lsarith.h"
+#include "lsmat/lscsr.h"
+#include "lsmat/lsmat.h"
+#include "lsprobe.h"
+#include "lssimd.h"
+#include "lsthreads.h"
+#include <float.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LU_NONE_ SIZE_MAX
+// The diagonal stays the pivot while it is within this factor of the largest candidate.
+#define LU_PIVOT_TOL_ 0.1
+// Right-hand sides are solved this many at a time.
+#define LU_BLOCK_ 16u
+
+typedef enum LSLuState_ {
+    LSLU_VAR_,
+    LSLU_ELEM_,
+    LSLU_DEAD_,
+    LSLU_DENSE_,
+} LSLuState_t;
+
+/*
+ * Approximate minimum degree on the pattern of A + A^T. Eliminated variables
+ * become elements, which stand for the clique their elimination would have
+ * made. Every variable keeps its elements and then its plain neighbours in
+ * one list, which never grows: each elimination that reaches a variable also
+ * takes an entry out of its list. Degrees are bounded from above rather than
+ * counted.
+ */
+typedef struct LSLuOrder_ {
+    size_t n;
+    size_t *start;
+    size_t *n_elems;
+    size_t *n_vars;
+    size_t *slab;
+    size_t **elem_vars;
+    size_t *elem_len;
+    unsigned char *state;
+    size_t *deg;
+    size_t *bucket;
+    size_t *next;
+    size_t *prev;
+    size_t *mark;
+    size_t *w;
+    size_t *w_mark;
+    size_t *lp;
+} LSLuOrder_t;
+
+static void LSLuOrder_destroy_(LSLuOrder_t *restrict o) {
+    if (o->elem_vars != NULL) {
+        for (size_t e = 0; e < o->n; e++) {
+            free(o->elem_vars[e]);
+        }
+    }
+    free(o->start);
+    free(o->n_elems);
+    free(o->n_vars);
+    free(o->slab);
+    free(o->elem_vars);
+    free(o->elem_len);
+    free(o->state);
+    free(o->deg);
+    free(o->bucket);
+    free(o->next);
+    free(o->prev);
+    free(o->mark);
+    free(o->w);
+    free(o->w_mark);
+    free(o->lp);
+}
+
+static void LSLuOrder_link_(LSLuOrder_t *restrict o, size_t i) {
+    const size_t d = o->deg[i];
+    o->prev[i] = LU_NONE_;
+    o->next[i] = o->bucket[d];
+    if (o->bucket[d] != LU_NONE_) {
+        o->prev[o->bucket[d]] = i;
+    }
+    o->bucket[d] = i;
+}
+
+static void LSLuOrder_unlink_(LSLuOrder_t *restrict o, size_t i) {
+    if (o->prev[i] != LU_NONE_) {
+        o->next[o->prev[i]] = o->next[i];
+    } else {
+        o->bucket[o->deg[i]] = o->next[i];
+    }
+    if (o->next[i] != LU_NONE_) {
+        o->prev[o->next[i]] = o->prev[i];
+    }
+}
+
+static bool LSLuOrder_init_(LSLuOrder_t *restrict o, const LSMatCsr_t *restrict csc) {
+    const size_t n = csc->shape[LSMAT_AXIS_1];
+    const size_t n1 = n > 0 ? n : 1;
+    *o = (LSLuOrder_t){.n = n};
+    o->start = calloc(n + 1, sizeof(size_t));
+    o->n_elems = calloc(n1, sizeof(size_t));
+    o->n_vars = calloc(n1, sizeof(size_t));
+    o->elem_vars = calloc(n1, sizeof(size_t *));
+    o->elem_len = calloc(n1, sizeof(size_t));
+    o->state = calloc(n1, sizeof(unsigned char));
+    o->deg = malloc(n1 * sizeof(size_t));
+    o->bucket = malloc(n1 * sizeof(size_t));
+    o->next = malloc(n1 * sizeof(size_t));
+    o->prev = malloc(n1 * sizeof(size_t));
+    o->mark = calloc(n1, sizeof(size_t));
+    o->w = malloc(n1 * sizeof(size_t));
+    o->w_mark = calloc(n1, sizeof(size_t));
+    o->lp = malloc(n1 * sizeof(size_t));
+    if (o->start == NULL || o->n_elems == NULL || o->n_vars == NULL || o->elem_vars == NULL ||
+        o->elem_len == NULL || o->state == NULL || o->deg == NULL || o->bucket == NULL ||
+        o->next == NULL || o->prev == NULL || o->mark == NULL || o->w == NULL ||
+        o->w_mark == NULL || o->lp == NULL) {
+        return false;
+    }
+    // Every off-diagonal entry links both of its ends.
+    for (size_t j = 0; j < n; j++) {
+        for (size_t k = csc->ptr[j]; k < csc->ptr[j + 1]; k++) {
+            if (csc->idx[k] != j) {
+                o->start[csc->idx[k] + 1]++;
+                o->start[j + 1]++;
+            }
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        o->start[i + 1] += o->start[i];
+    }
+    o->slab = malloc((o->start[n] > 0 ? o->start[n] : 1) * sizeof(size_t));
+    if (o->slab == NULL) {
+        return false;
+    }
+    for (size_t j = 0; j < n; j++) {
+        for (size_t k = csc->ptr[j]; k < csc->ptr[j + 1]; k++) {
+            const size_t i = csc->idx[k];
+            if (i != j) {
+                o->slab[o->start[i] + o->n_vars[i]++] = j;
+                o->slab[o->start[j] + o->n_vars[j]++] = i;
+            }
+        }
+    }
+    // Entries present on both sides of the diagonal were linked twice.
+    for (size_t i = 0; i < n; i++) {
+        size_t *const list = o->slab + o->start[i];
+        size_t len = 0;
+        for (size_t t = 0; t < o->n_vars[i]; t++) {
+            if (o->mark[list[t]] != i + 1) {
+                o->mark[list[t]] = i + 1;
+                list[len++] = list[t];
+            }
+        }
+        o->n_vars[i] = len;
+    }
+    // Nearly full rows would touch every list at each step; they go last,
+    // out of the graph.
+    const double dense = 10. * sqrt((double)n);
+    const size_t max_deg = dense > 16. ? (size_t)dense : 16;
+    for (size_t i = 0; i < n; i++) {
+        o->state[i] = o->n_vars[i] > max_deg ? LSLU_DENSE_ : LSLU_VAR_;
+        o->mark[i] = 0;
+        o->bucket[i] = LU_NONE_;
+    }
+    for (size_t i = 0; i < n; i++) {
+        size_t *const list = o->slab + o->start[i];
+        size_t len = 0;
+        for (size_t t = 0; t < o->n_vars[i]; t++) {
+            if (o->state[list[t]] == LSLU_VAR_) {
+                list[len++] = list[t];
+            }
+        }
+        o->n_vars[i] = len;
+        o->deg[i] = len;
+        if (o->state[i] == LSLU_VAR_) {
+            LSLuOrder_link_(o, i);
+        }
+    }
+    return true;
+}
+
+static void LSLuOrder_absorb_(LSLuOrder_t *restrict o, size_t e) {
+    o->state[e] = LSLU_DEAD_;
+    free(o->elem_vars[e]);
+    o->elem_vars[e] = NULL;
+}
+
+// Eliminate p, which is the s-th pivot, and update the variables it reaches.
+static bool LSLuOrder_eliminate_(LSLuOrder_t *restrict o, size_t p, size_t s, size_t n_live,
+                                 size_t *restrict min_deg) {
+    size_t *const list_p = o->slab + o->start[p];
+    size_t n_lp = 0;
+    o->mark[p] = s;
+    for (size_t t = 0; t < o->n_elems[p] + o->n_vars[p]; t++) {
+        const size_t u = list_p[t];
+        const bool elem = t < o->n_elems[p];
+        if (elem && o->state[u] != LSLU_ELEM_) {
+            continue;
+        }
+        const size_t *const vars = elem ? o->elem_vars[u] : &list_p[t];
+        const size_t n_vars = elem ? o->elem_len[u] : 1;
+        for (size_t k = 0; k < n_vars; k++) {
+            if (o->state[vars[k]] == LSLU_VAR_ && o->mark[vars[k]] != s) {
+                o->mark[vars[k]] = s;
+                o->lp[n_lp++] = vars[k];
+            }
+        }
+        if (elem) {
+            // The new element covers everything this one did.
+            LSLuOrder_absorb_(o, u);
+        }
+    }
+    o->state[p] = LSLU_ELEM_;
+    o->n_elems[p] = 0;
+    o->n_vars[p] = 0;
+    o->elem_len[p] = n_lp;
+    if (n_lp > 0) {
+        o->elem_vars[p] = malloc(n_lp * sizeof(size_t));
+        if (o->elem_vars[p] == NULL) {
+            return false;
+        }
+        memcpy(o->elem_vars[p], o->lp, n_lp * sizeof(size_t));
+    }
+    // w(e) ends up as the part of each older element outside the new one.
+    for (size_t t = 0; t < n_lp; t++) {
+        const size_t i = o->lp[t];
+        const size_t *const list = o->slab + o->start[i];
+        LSLuOrder_unlink_(o, i);
+        for (size_t k = 0; k < o->n_elems[i]; k++) {
+            const size_t e = list[k];
+            if (o->state[e] != LSLU_ELEM_) {
+                continue;
+            }
+            if (o->w_mark[e] != s) {
+                o->w_mark[e] = s;
+                o->w[e] = o->elem_len[e];
+            }
+            o->w[e]--;
+        }
+    }
+    for (size_t t = 0; t < n_lp; t++) {
+        const size_t i = o->lp[t];
+        size_t *const list = o->slab + o->start[i];
+        size_t ne = 0;
+        size_t ext = 0;
+        for (size_t k = 0; k < o->n_elems[i]; k++) {
+            const size_t e = list[k];
+            if (o->state[e] != LSLU_ELEM_) {
+                continue;
+            }
+            if (o->w[e] == 0) {
+                // Nothing is left outside the new element.
+                LSLuOrder_absorb_(o, e);
+                continue;
+            }
+            list[ne++] = e;
+            ext += o->w[e];
+        }
+        // Neighbours inside the new element are reached through it now.
+        size_t na = 0;
+        for (size_t k = 0; k < o->n_vars[i]; k++) {
+            const size_t v = list[o->n_elems[i] + k];
+            if (o->state[v] == LSLU_VAR_ && o->mark[v] != s) {
+                list[ne + na++] = v;
+            }
+        }
+        // Either p or an element of p has just left the list, which makes room.
+        if (na > 0) {
+            list[ne + na] = list[ne];
+        }
+        list[ne] = p;
+        o->n_elems[i] = ne + 1;
+        o->n_vars[i] = na;
+        size_t d = na + ext + n_lp - 1;
+        d = d < o->deg[i] + n_lp - 1 ? d : o->deg[i] + n_lp - 1;
+        d = d < n_live - 1 ? d : n_live - 1;
+        o->deg[i] = d;
+        LSLuOrder_link_(o, i);
+        *min_deg = d < *min_deg ? d : *min_deg;
+    }
+    return true;
+}
+
+static bool LSLuOrder_run_(const LSMatCsr_t *restrict csc, size_t *restrict q) {
+    LSLuOrder_t o;
+    if (!LSLuOrder_init_(&o, csc)) {
+        LSLuOrder_destroy_(&o);
+        return false;
+    }
+    size_t n_live = 0;
+    for (size_t i = 0; i < o.n; i++) {
+        n_live += o.state[i] == LSLU_VAR_;
+    }
+    size_t k = 0;
+    size_t min_deg = 0;
+    while (n_live > 0) {
+        while (o.bucket[min_deg] == LU_NONE_) {
+            min_deg++;
+        }
+        const size_t p = o.bucket[min_deg];
+        LSLuOrder_unlink_(&o, p);
+        q[k++] = p;
+        if (!LSLuOrder_eliminate_(&o, p, k, n_live--, &min_deg)) {
+            LSLuOrder_destroy_(&o);
+            return false;
+        }
+    }
+    for (size_t i = 0; i < o.n; i++) {
+        if (o.state[i] == LSLU_DENSE_) {
+            q[k++] = i;
+        }
+    }
+    LSLuOrder_destroy_(&o);
+    return true;
+}
+
+/*
+ * Left-looking LU with threshold partial pivoting. Column k of L and U comes
+ * from solving L x = A(:, q[k]) over the columns already done; the pattern of
+ * x is found by a depth-first search through L before any arithmetic, so the
+ * work stays proportional to the flops. L keeps original row numbers until
+ * every pivot is known.
+ */
+typedef struct LSLuFactor_ {
+    size_t n;
+    size_t *l_ptr;
+    size_t *l_idx;
+    double *l_v;
+    size_t l_cap;
+    size_t *u_ptr;
+    size_t *u_idx;
+    double *u_v;
+    size_t u_cap;
+    double *x;
+    size_t *reach;
+    size_t *stack;
+    size_t *pstack;
+    size_t *mark;
+} LSLuFactor_t;
+
+static void LSLuFactor_destroy_(LSLuFactor_t *restrict f) {
+    free(f->l_ptr);
+    free(f->l_idx);
+    free(f->l_v);
+    free(f->u_ptr);
+    free(f->u_idx);
+    free(f->u_v);
+    free(f->x);
+    free(f->reach);
+    free(f->stack);
+    free(f->pstack);
+    free(f->mark);
+}
+
+static bool LSLuFactor_reserve_(size_t **restrict idx, double **restrict v, size_t *restrict cap,
+                                size_t need) {
+    if (need <= *cap) {
+        return true;
+    }
+    const size_t new_cap = 2 * *cap > need ? 2 * *cap : need;
+    size_t *const new_idx = realloc(*idx, new_cap * sizeof(size_t));
+    if (new_idx == NULL) {
+        return false;
+    }
+    *idx = new_idx;
+    double *const new_v = realloc(*v, new_cap * sizeof(double));
+    if (new_v == NULL) {
+        return false;
+    }
+    *v = new_v;
+    *cap = new_cap;
+    return true;
+}
+
+// Push the rows reachable from j through L onto reach, in reverse topological order.
+static size_t LSLuFactor_dfs_(LSLuFactor_t *restrict f, const size_t *restrict pinv, size_t j,
+                              size_t top, size_t stamp) {
+    size_t depth = 1;
+    f->stack[0] = j;
+    while (depth > 0) {
+        const size_t r = f->stack[depth - 1];
+        const size_t col = pinv[r];
+        if (f->mark[r] != stamp) {
+            f->mark[r] = stamp;
+            f->pstack[depth - 1] = col != LU_NONE_ ? f->l_ptr[col] : 0;
+        }
+        const size_t end = col != LU_NONE_ ? f->l_ptr[col + 1] : 0;
+        bool done = true;
+        for (size_t k = f->pstack[depth - 1]; k < end; k++) {
+            const size_t i = f->l_idx[k];
+            if (f->mark[i] != stamp) {
+                f->pstack[depth - 1] = k + 1;
+                f->stack[depth++] = i;
+                done = false;
+                break;
+            }
+        }
+        if (done) {
+            depth--;
+            f->reach[--top] = r;
+        }
+    }
+    return top;
+}
+
+static lsarith_errno_t LSLuFactor_column_(LSLuFactor_t *restrict f, const LSMatCsr_t *restrict csc,
+                                          size_t k, size_t col, size_t *restrict pinv) {
+    const size_t n = f->n;
+    if (!LSLuFactor_reserve_(&f->l_idx, &f->l_v, &f->l_cap, f->l_ptr[k] + n) ||
+        !LSLuFactor_reserve_(&f->u_idx, &f->u_v, &f->u_cap, f->u_ptr[k] + n)) {
+        return LSARITH_E_GEN;
+    }
+    size_t top = n;
+    double scale = 0.;
+    for (size_t t = csc->ptr[col]; t < csc->ptr[col + 1]; t++) {
+        scale = fabs(csc->v[t]) > scale ? fabs(csc->v[t]) : scale;
+        if (f->mark[csc->idx[t]] != k + 1) {
+            top = LSLuFactor_dfs_(f, pinv, csc->idx[t], top, k + 1);
+        }
+    }
+    for (size_t t = top; t < n; t++) {
+        f->x[f->reach[t]] = 0.;
+    }
+    for (size_t t = csc->ptr[col]; t < csc->ptr[col + 1]; t++) {
+        f->x[csc->idx[t]] = csc->v[t];
+    }
+    size_t n_steps = 0;
+    for (size_t t = top; t < n; t++) {
+        const size_t r = f->reach[t];
+        const size_t c = pinv[r];
+        if (c == LU_NONE_) {
+            continue;
+        }
+        // The first entry of every column of L is its unit diagonal.
+        const double xr = f->x[r];
+        for (size_t p = f->l_ptr[c] + 1; p < f->l_ptr[c + 1]; p++) {
+            f->x[f->l_idx[p]] -= f->l_v[p] * xr;
+        }
+        n_steps += f->l_ptr[c + 1] - f->l_ptr[c];
+    }
+    LSPROF_ADD_(LSPROF_MERGE_STEPS, n_steps);
+    size_t piv = LU_NONE_;
+    double best = -1.;
+    size_t unz = f->u_ptr[k];
+    for (size_t t = top; t < n; t++) {
+        const size_t r = f->reach[t];
+        if (pinv[r] != LU_NONE_) {
+            f->u_idx[unz] = pinv[r];
+            f->u_v[unz++] = f->x[r];
+        } else if (fabs(f->x[r]) > best) {
+            best = fabs(f->x[r]);
+            piv = r;
+        }
+    }
+    // A pivot at the level of rounding noise left by the elimination counts as zero.
+    if (piv == LU_NONE_ || !(best > (double)n * DBL_EPSILON * scale)) {
+        return LSARITH_E_NOINV;
+    }
+    // Staying on the diagonal keeps the fill the ordering planned for.
+    if (pinv[col] == LU_NONE_ && f->mark[col] == k + 1 && fabs(f->x[col]) >= LU_PIVOT_TOL_ * best) {
+        piv = col;
+    }
+    const double pivot = f->x[piv];
+    f->u_idx[unz] = k;
+    f->u_v[unz++] = pivot;
+    f->u_ptr[k + 1] = unz;
+    pinv[piv] = k;
+    size_t lnz = f->l_ptr[k];
+    f->l_idx[lnz] = piv;
+    f->l_v[lnz++] = 1.;
+    for (size_t t = top; t < n; t++) {
+        const size_t r = f->reach[t];
+        if (pinv[r] == LU_NONE_ && f->x[r] != 0.) {
+            f->l_idx[lnz] = r;
+            f->l_v[lnz++] = f->x[r] / pivot;
+        }
+    }
+    f->l_ptr[k + 1] = lnz;
+    return LSARITH_OK;
+}
+
+// Rows come out of a transcode in order, which puts each diagonal at one end.
+static LSMatCsr_t *LSLuFactor_rows_(size_t n, size_t *restrict ptr, size_t *restrict idx,
+                                    double *restrict v) {
+    const LSMatCsr_t csc = {
+        .shape = {n, n},
+        .major = LSMAT_AXIS_1,
+        .nnz = ptr[n],
+        .ptr = ptr,
+        .idx = idx,
+        .v = v,
+    };
+    return LSMatCsr_transcode(&csc);
+}
+
+lsarith_errno_t LSArith_lu(const LSMat_t *restrict a, LSMatLu_t *restrict lu) {
+    LSPROF_FN_();
+    if (a == NULL || lu == NULL) {
+        return LSARITH_E_GEN;
+    }
+    *lu = (LSMatLu_t){0};
+    if (a->shape[LSMAT_AXIS_0] != a->shape[LSMAT_AXIS_1]) {
+        return LSARITH_E_SHAPE;
+    }
+    const size_t n = a->shape[LSMAT_AXIS_0];
+    const size_t n1 = n > 0 ? n : 1;
+    LSMatCsr_t *const csc = LSMat_freeze(a, LSMAT_AXIS_1);
+    LSLuFactor_t f = {.n = n, .l_cap = 4 * (csc != NULL ? csc->nnz : 0) + n1};
+    f.u_cap = f.l_cap;
+    f.l_ptr = calloc(n + 1, sizeof(size_t));
+    f.l_idx = malloc(f.l_cap * sizeof(size_t));
+    f.l_v = malloc(f.l_cap * sizeof(double));
+    f.u_ptr = calloc(n + 1, sizeof(size_t));
+    f.u_idx = malloc(f.u_cap * sizeof(size_t));
+    f.u_v = malloc(f.u_cap * sizeof(double));
+    f.x = malloc(n1 * sizeof(double));
+    f.reach = malloc(n1 * sizeof(size_t));
+    f.stack = malloc(n1 * sizeof(size_t));
+    f.pstack = malloc(n1 * sizeof(size_t));
+    f.mark = calloc(n1, sizeof(size_t));
+    lu->n = n;
+    lu->q = malloc(n1 * sizeof(size_t));
+    lu->pinv = malloc(n1 * sizeof(size_t));
+    lsarith_errno_t err = LSARITH_E_GEN;
+    if (csc != NULL && f.l_ptr != NULL && f.l_idx != NULL && f.l_v != NULL && f.u_ptr != NULL &&
+        f.u_idx != NULL && f.u_v != NULL && f.x != NULL && f.reach != NULL && f.stack != NULL &&
+        f.pstack != NULL && f.mark != NULL && lu->q != NULL && lu->pinv != NULL &&
+        LSLuOrder_run_(csc, lu->q)) {
+        err = LSARITH_OK;
+    }
+    for (size_t i = 0; err == LSARITH_OK && i < n; i++) {
+        lu->pinv[i] = LU_NONE_;
+    }
+    for (size_t k = 0; err == LSARITH_OK && k < n; k++) {
+        err = LSLuFactor_column_(&f, csc, k, lu->q[k], lu->pinv);
+    }
+    if (err == LSARITH_OK) {
+        for (size_t t = 0; t < f.l_ptr[n]; t++) {
+            f.l_idx[t] = lu->pinv[f.l_idx[t]];
+        }
+        lu->l = LSLuFactor_rows_(n, f.l_ptr, f.l_idx, f.l_v);
+        lu->u = LSLuFactor_rows_(n, f.u_ptr, f.u_idx, f.u_v);
+        err = lu->l != NULL && lu->u != NULL ? LSARITH_OK : LSARITH_E_GEN;
+    }
+    if (csc != NULL) {
+        LSMatCsr_free(csc);
+    }
+    LSLuFactor_destroy_(&f);
+    if (err != LSARITH_OK) {
+        LSMatLu_destroy(lu);
+    }
+    return err;
+}
+
+lsmat_errno_t LSMatLu_destroy(LSMatLu_t *restrict lu) {
+    if (lu == NULL) {
+        return LSMAT_E_GEN;
+    }
+    if (lu->l != NULL) {
+        LSMatCsr_free(lu->l);
+    }
+    if (lu->u != NULL) {
+        LSMatCsr_free(lu->u);
+    }
+    free(lu->q);
+    free(lu->pinv);
+    *lu = (LSMatLu_t){0};
+    return LSMAT_OK;
+}
+
+// Solve in place on z, whose rows are already in pivot order.
+static void LSArith_lu_substitute_(const LSMatLu_t *restrict lu, double *restrict z,
+                                   size_t n_vecs, double *restrict acc) {
+    const LSMatCsr_t *const l = lu->l;
+    const LSMatCsr_t *const u = lu->u;
+    // Rows of L end with their unit diagonal; rows of U start with theirs.
+    for (size_t k = 0; k < lu->n; k++) {
+        const size_t p = l->ptr[k];
+        memset(acc, 0, n_vecs * sizeof(double));
+        LSSimd_spmm_row(l->v + p, l->idx + p, l->ptr[k + 1] - p - 1, z, n_vecs, acc);
+        for (size_t c = 0; c < n_vecs; c++) {
+            z[k * n_vecs + c] -= acc[c];
+        }
+    }
+    for (size_t k = lu->n; k-- > 0;) {
+        const size_t p = u->ptr[k];
+        memset(acc, 0, n_vecs * sizeof(double));
+        LSSimd_spmm_row(u->v + p + 1, u->idx + p + 1, u->ptr[k + 1] - p - 1, z, n_vecs, acc);
+        for (size_t c = 0; c < n_vecs; c++) {
+            z[k * n_vecs + c] = (z[k * n_vecs + c] - acc[c]) / u->v[p];
+        }
+    }
+}
+
+lsarith_errno_t LSArith_lu_solve(const LSMatLu_t *restrict lu, const double *restrict b,
+                                 size_t n_vecs, double *restrict x) {
+    LSPROF_FN_();
+    if (lu == NULL || lu->l == NULL || b == NULL || x == NULL || n_vecs == 0) {
+        return LSARITH_E_GEN;
+    }
+    const size_t n = lu->n;
+    double *const z = malloc((n > 0 ? n : 1) * n_vecs * sizeof(double));
+    double *const acc = malloc(n_vecs * sizeof(double));
+    if (z == NULL || acc == NULL) {
+        free(z);
+        free(acc);
+        return LSARITH_E_GEN;
+    }
+    for (size_t i = 0; i < n; i++) {
+        memcpy(z + lu->pinv[i] * n_vecs, b + i * n_vecs, n_vecs * sizeof(double));
+    }
+    LSArith_lu_substitute_(lu, z, n_vecs, acc);
+    for (size_t k = 0; k < n; k++) {
+        memcpy(x + lu->q[k] * n_vecs, z + k * n_vecs, n_vecs * sizeof(double));
+    }
+    free(z);
+    free(acc);
+    return LSARITH_OK;
+}
+
+/*
+ * Sparse right-hand sides are solved in blocks of columns, one block per
+ * task. Each block keeps its columns compressed until they are all done.
+ */
+typedef struct LSLuBlock_ {
+    size_t *ptr;
+    size_t *idx;
+    double *v;
+} LSLuBlock_t;
+
+typedef struct LSLuSolve_ {
+    const LSMatLu_t *lu;
+    const LSMatCsr_t *b;
+    LSLuBlock_t *blocks;
+    atomic_bool failed;
+} LSLuSolve_t;
+
+static size_t LSLuSolve_width_(size_t n_cols, size_t block) {
+    const size_t begin = block * LU_BLOCK_;
+    return begin + LU_BLOCK_ < n_cols ? LU_BLOCK_ : n_cols - begin;
+}
+
+static bool LSLuSolve_block_(const LSLuSolve_t *restrict s, LSLuBlock_t *restrict blk,
+                             size_t begin, size_t end, double *restrict z, double *restrict x,
+                             double *restrict acc) {
+    const LSMatLu_t *const lu = s->lu;
+    const LSMatCsr_t *const b = s->b;
+    const size_t w = end - begin;
+    const size_t n = lu->n;
+    memset(z, 0, n * w * sizeof(double));
+    for (size_t j = begin; j < end; j++) {
+        for (size_t t = b->ptr[j]; t < b->ptr[j + 1]; t++) {
+            z[lu->pinv[b->idx[t]] * w + (j - begin)] = b->v[t];
+        }
+    }
+    LSArith_lu_substitute_(lu, z, w, acc);
+    for (size_t k = 0; k < n; k++) {
+        memcpy(x + lu->q[k] * w, z + k * w, w * sizeof(double));
+    }
+    blk->ptr = calloc(w + 1, sizeof(size_t));
+    if (blk->ptr == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        for (size_t c = 0; c < w; c++) {
+            blk->ptr[c + 1] += x[i * w + c] != 0.;
+        }
+    }
+    for (size_t c = 0; c < w; c++) {
+        blk->ptr[c + 1] += blk->ptr[c];
+    }
+    const size_t nnz = blk->ptr[w];
+    blk->idx = malloc((nnz > 0 ? nnz : 1) * sizeof(size_t));
+    blk->v = malloc((nnz > 0 ? nnz : 1) * sizeof(double));
+    if (blk->idx == NULL || blk->v == NULL) {
+        return false;
+    }
+    for (size_t c = 0; c < w; c++) {
+        size_t t = blk->ptr[c];
+        for (size_t i = 0; i < n; i++) {
+            if (x[i * w + c] != 0.) {
+                blk->idx[t] = i;
+                blk->v[t++] = x[i * w + c];
+            }
+        }
+    }
+    return true;
+}
+
+static void LSLuSolve_task_(void *ctx, size_t task) {
+    LSLuSolve_t *const s = ctx;
+    const size_t n_cols = s->b->shape[LSMAT_AXIS_1];
+    const size_t begin = task * LU_BLOCK_;
+    const size_t end = begin + LSLuSolve_width_(n_cols, task);
+    const size_t len = (s->lu->n > 0 ? s->lu->n : 1) * (end - begin);
+    double *const z = malloc(len * sizeof(double));
+    double *const x = malloc(len * sizeof(double));
+    double *const acc = malloc(LU_BLOCK_ * sizeof(double));
+    if (z == NULL || x == NULL || acc == NULL ||
+        !LSLuSolve_block_(s, s->blocks + task, begin, end, z, x, acc)) {
+        atomic_store(&s->failed, true);
+    }
+    free(z);
+    free(x);
+    free(acc);
+}
+
+// Columns are filled in order, so every cell goes on the tail of both of its lists.
+static bool LSLuSolve_emit_(const LSLuSolve_t *restrict s, size_t n_blocks,
+                            LSMat_t *restrict out) {
+    for (size_t t = 0; t < n_blocks; t++) {
+        const LSLuBlock_t *const blk = s->blocks + t;
+        const size_t begin = t * LU_BLOCK_;
+        const size_t w = LSLuSolve_width_(out->shape[LSMAT_AXIS_1], t);
+        for (size_t c = 0; c < w; c++) {
+            for (size_t k = blk->ptr[c]; k < blk->ptr[c + 1]; k++) {
+                LSMatCell_t *const cell = LSMatArena_alloc(&out->arena);
+                if (cell == NULL) {
+                    return false;
+                }
+                LSMatCell_set_idx(cell, LSMAT_AXIS_0, blk->idx[k]);
+                LSMatCell_set_idx(cell, LSMAT_AXIS_1, begin + c);
+                cell->v = blk->v[k];
+                LSMatHead_append(out->heads[LSMAT_AXIS_0] + blk->idx[k], cell, LSMAT_AXIS_1);
+                LSMatHead_append(out->heads[LSMAT_AXIS_1] + begin + c, cell, LSMAT_AXIS_0);
+            }
+        }
+    }
+    return LSMat_adapt(out) == LSMAT_OK;
+}
+
+lsarith_errno_t LSArith_lu_solve_mat(const LSMatLu_t *restrict lu, const LSMat_t *b,
+                                     LSMat_t *out) {
+    LSPROF_FN_();
+    if (lu == NULL || lu->l == NULL || b == NULL || out == NULL) {
+        return LSARITH_E_GEN;
+    }
+    if (b->shape[LSMAT_AXIS_0] != lu->n || out->shape[LSMAT_AXIS_0] != lu->n ||
+        out->shape[LSMAT_AXIS_1] != b->shape[LSMAT_AXIS_1]) {
+        return LSARITH_E_SHAPE;
+    }
+    const size_t n_blocks = (b->shape[LSMAT_AXIS_1] + LU_BLOCK_ - 1) / LU_BLOCK_;
+    LSLuSolve_t s = {
+        .lu = lu,
+        .b = LSMat_freeze(b, LSMAT_AXIS_1),
+        .blocks = calloc(n_blocks > 0 ? n_blocks : 1, sizeof(LSLuBlock_t)),
+    };
+    atomic_init(&s.failed, s.b == NULL || s.blocks == NULL);
+    if (!atomic_load(&s.failed)) {
+        LSThreads_run(LSArith_threads(), n_blocks, LSLuSolve_task_, &s);
+    }
+    // out may be b itself, so it is only cleared once b has been read.
+    bool ok = !atomic_load(&s.failed);
+    if (ok) {
+        LSMat_zero(out);
+        ok = LSLuSolve_emit_(&s, n_blocks, out);
+        if (!ok) {
+            LSMat_zero(out);
+        }
+    }
+    for (size_t t = 0; s.blocks != NULL && t < n_blocks; t++) {
+        free(s.blocks[t].ptr);
+        free(s.blocks[t].idx);
+        free(s.blocks[t].v);
+    }
+    free(s.blocks);
+    if (s.b != NULL) {
+        LSMatCsr_free((LSMatCsr_t *)s.b);
+    }
+    return ok ? LSARITH_OK : LSARITH_E_GEN;
+}
+
+lsarith_errno_t LSArith_solve(const LSMat_t *a, const LSMat_t *b, LSMat_t *out) {
+    LSPROF_FN_();
+    if (a == NULL || b == NULL || out == NULL) {
+        return LSARITH_E_GEN;
+    }
+    if (a->shape[LSMAT_AXIS_0] != a->shape[LSMAT_AXIS_1] ||
+        b->shape[LSMAT_AXIS_0] != a->shape[LSMAT_AXIS_0]) {
+        return LSARITH_E_SHAPE;
+    }
+    LSMatLu_t lu;
+    lsarith_errno_t err = LSArith_lu(a, &lu);
+    if (err != LSARITH_OK) {
+        return err;
+    }
+    err = LSArith_lu_solve_mat(&lu, b, out);
+    LSMatLu_destroy(&lu);
+    return err;
+}
@@ -1,25 +1,49 @@
 #include "lsmat/lsmat.h"
+#include "lsatomic.h"
+#include "lsmem.h"
+#include "lsprobe.h"
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define FREE_NULLIFY_(ptr_)                                                                        \
-    do {                                                                                           \
-        if (lsmat_free_hook_ != NULL) {                                                            \
-            lsmat_free_hook_((ptr_));                                                              \
-        }                                                                                          \
-        free((ptr_));                                                                              \
-        (ptr_) = NULL;                                                                             \
-    } while (0)
-
 #define MAP_AXIS_(m_, a_) (m_->axes_mapping[a_])
 
-lsmat_alloc_hook_t lsmat_alloc_hook_ = NULL;
-lsmat_free_hook_t lsmat_free_hook_ = NULL;
+#define SLAB_MIN_CELLS_ 64u
+#define SLAB_MAX_CELLS_ 65536u
+
+#define SKIP_MAX_LEVEL_ 16u
+#define SKIP_BUILD_LEN_ 64u
+#define SKIP_DROP_LEN_ 16u
+
+typedef struct LSMatSkipNode_ {
+    LSMatCell_t *cell;
+    size_t height;
+    struct LSMatSkipNode_ *next[];
+} LSMatSkipNode_t;
+
+/*
+ * Skip list over a subset of the cells in a list; the list itself forms the
+ * bottom level. About a quarter of the cells carry a tower.
+ */
+typedef struct LSMatSkip_ {
+    uint64_t rng;
+    LSMatSkipNode_t *first[SKIP_MAX_LEVEL_];
+} LSMatSkip_t;
+
+_Atomic(lsmat_alloc_hook_t) lsmat_alloc_hook_ = NULL;
+_Atomic(lsmat_free_hook_t) lsmat_free_hook_ = NULL;
+
+// Matrix ids are never reused, so (id, version) names one state for good.
+static atomic_uint_least64_t next_mat_id_ = 1;
 
 size_t LSMatCell_idx_of(const LSMatCell_t *restrict cell, lsmat_axis_t axis) {
-    return cell != NULL ? cell->axes[axis % LSMAT_AXIS_COUNT_].i : SIZE_MAX;
+    return cell != NULL ? cell->idx[axis % LSMAT_AXIS_COUNT_] : SIZE_MAX;
+}
+
+void LSMatCell_set_idx(LSMatCell_t *restrict cell, lsmat_axis_t axis, size_t i) {
+    cell->idx[axis % LSMAT_AXIS_COUNT_] = (lsmat_idx_t)i;
 }
 
 LSMatCell_t *LSMatCell_succ_of(const LSMatCell_t *restrict cell, lsmat_axis_t axis) {
@@ -30,6 +54,7 @@ LSMatCell_t **LSMatCell_ref_succ_of(LSMatCell_t *restrict cell, lsmat_axis_t axi
     return cell != NULL ? &cell->axes[axis % LSMAT_AXIS_COUNT_].next : NULL;
 }
 
+#ifndef LSMAT_SINGLY_LINKED
 LSMatCell_t *LSMatCell_prec_of(const LSMatCell_t *restrict cell, lsmat_axis_t axis) {
     return cell != NULL ? cell->axes[axis % LSMAT_AXIS_COUNT_].prev : NULL;
 }
@@ -37,33 +62,345 @@ LSMatCell_t *LSMatCell_prec_of(const LSMatCell_t *restrict cell, lsmat_axis_t ax
 LSMatCell_t **LSMatCell_ref_prec_of(LSMatCell_t *restrict cell, lsmat_axis_t axis) {
     return cell != NULL ? &cell->axes[axis % LSMAT_AXIS_COUNT_].prev : NULL;
 }
+#endif
 
-lsmat_errno_t LSMatHead_destroy(LSMatHead_t *restrict head, lsmat_axis_t axis) {
-    LSMatCell_t *p = head->first_cell;
-    head->first_cell = NULL;
+static inline void LSMatCell_link_prec_(LSMatCell_t *restrict cell, lsmat_axis_t axis,
+                                        LSMatCell_t *prec) {
+#ifdef LSMAT_SINGLY_LINKED
+    (void)cell;
+    (void)axis;
+    (void)prec;
+#else
+    cell->axes[axis].prev = prec;
+#endif
+}
+
+static void LSMatArena_count_free_(LSMatArena_t *restrict arena, size_t n_free) {
+    // A single writer needs no read-modify-write, only a tear-free store.
+    atomic_store_explicit(&arena->n_free, n_free, memory_order_relaxed);
+}
+
+lsmat_errno_t LSMatArena_init(LSMatArena_t *restrict arena) {
+    if (arena == NULL) {
+        return LSMAT_E_GEN;
+    }
+    arena->slabs = NULL;
+    arena->free_cells = NULL;
+    LSMatArena_count_free_(arena, 0);
+    return LSMAT_OK;
+}
+
+lsmat_errno_t LSMatArena_destroy(LSMatArena_t *restrict arena) {
+    if (arena == NULL) {
+        return LSMAT_E_GEN;
+    }
+    LSMatSlab_t *p = arena->slabs;
     while (p != NULL) {
-        LSMatCell_t *t = LSMatCell_succ_of(p, axis);
-        if (lsmat_free_hook_ != NULL) {
-            lsmat_free_hook_(p);
+        LSMatSlab_t *t = p->next;
+        FREE_NULLIFY_(p);
+        p = t;
+    }
+    arena->slabs = NULL;
+    arena->free_cells = NULL;
+    LSMatArena_count_free_(arena, 0);
+    return LSMAT_OK;
+}
+
+LSMatCell_t *LSMatArena_alloc(LSMatArena_t *restrict arena) {
+    LSMatCell_t *cell = arena->free_cells;
+    if (cell != NULL) {
+        // Recycled cells are chained through their row successor.
+        arena->free_cells = LSMatCell_succ_of(cell, LSMAT_AXIS_0);
+        LSMatArena_count_free_(arena,
+                               atomic_load_explicit(&arena->n_free, memory_order_relaxed) - 1);
+    } else {
+        LSMatSlab_t *slab = arena->slabs;
+        if (slab == NULL || slab->used == slab->cap) {
+            size_t cap = slab == NULL ? SLAB_MIN_CELLS_ : slab->cap * 2;
+            cap = cap > SLAB_MAX_CELLS_ ? SLAB_MAX_CELLS_ : cap;
+            LSMatSlab_t *new_slab = malloc(sizeof(LSMatSlab_t) + cap * sizeof(LSMatCell_t));
+            if (new_slab == NULL) {
+                return NULL;
+            }
+            lsmem_hook_alloc_(new_slab);
+            LSPROF_ADD_(LSPROF_SLAB_ALLOCS, 1);
+            new_slab->next = slab;
+            new_slab->cap = cap;
+            new_slab->used = 0;
+            arena->slabs = slab = new_slab;
         }
-        free(p);
+        cell = slab->cells + slab->used++;
+    }
+    LSPROF_ADD_(LSPROF_CELL_ALLOCS, 1);
+    memset(cell, 0, sizeof(LSMatCell_t));
+    return cell;
+}
+
+void LSMatArena_recycle(LSMatArena_t *restrict arena, LSMatCell_t *restrict cell) {
+    *LSMatCell_ref_succ_of(cell, LSMAT_AXIS_0) = arena->free_cells;
+    arena->free_cells = cell;
+    LSMatArena_count_free_(arena, atomic_load_explicit(&arena->n_free, memory_order_relaxed) + 1);
+}
+
+static size_t LSMatSkip_height_(LSMatSkip_t *restrict skip) {
+    // xorshift64; two bits per level give a branching factor of 4.
+    skip->rng ^= skip->rng << 13;
+    skip->rng ^= skip->rng >> 7;
+    skip->rng ^= skip->rng << 17;
+    uint64_t bits = skip->rng;
+    size_t height = 0;
+    while (height < SKIP_MAX_LEVEL_ && (bits & 3u) == 0) {
+        height++;
+        bits >>= 2;
+    }
+    return height;
+}
+
+static void LSMatSkip_free_(LSMatSkip_t *restrict skip) {
+    LSMatSkipNode_t *p = skip->first[0];
+    while (p != NULL) {
+        LSMatSkipNode_t *t = p->next[0];
+        FREE_NULLIFY_(p);
         p = t;
     }
+    FREE_NULLIFY_(skip);
+}
+
+/*
+ * Fill update with the last node on each level whose cell index is less than
+ * i, NULL standing for the front of the level.
+ */
+static void LSMatSkip_search_(const LSMatSkip_t *restrict skip, size_t i, lsmat_axis_t axis,
+                              LSMatSkipNode_t **restrict update) {
+    LSMatSkipNode_t *p = NULL;
+    for (size_t lv = SKIP_MAX_LEVEL_; lv-- > 0;) {
+        LSMatSkipNode_t *p_n = p != NULL ? p->next[lv] : skip->first[lv];
+        while (p_n != NULL && LSMatCell_idx_of(p_n->cell, axis) < i) {
+            p = p_n;
+            p_n = p->next[lv];
+        }
+        update[lv] = p;
+    }
+}
+
+static lsmat_errno_t LSMatSkip_link_(LSMatSkip_t *restrict skip, LSMatCell_t *restrict cell,
+                                     size_t height, LSMatSkipNode_t **restrict update) {
+    LSMatSkipNode_t *const node =
+        lsmem_malloc_(sizeof(LSMatSkipNode_t) + height * sizeof(LSMatSkipNode_t *));
+    if (node == NULL) {
+        return LSMAT_E_GEN;
+    }
+    node->cell = cell;
+    node->height = height;
+    for (size_t lv = 0; lv < height; lv++) {
+        LSMatSkipNode_t **const fwd = update[lv] != NULL ? update[lv]->next : skip->first;
+        node->next[lv] = fwd[lv];
+        fwd[lv] = node;
+        update[lv] = node;
+    }
     return LSMAT_OK;
 }
 
-LSMatCell_t *LSMatHead_cell_at(const LSMatHead_t *restrict head, size_t i, lsmat_axis_t axis) {
+static void LSMatSkip_insert_(LSMatSkip_t *restrict skip, LSMatCell_t *restrict cell,
+                              lsmat_axis_t axis) {
+    const size_t height = LSMatSkip_height_(skip);
+    if (height == 0) {
+        return;
+    }
+    LSMatSkipNode_t *update[SKIP_MAX_LEVEL_];
+    LSMatSkip_search_(skip, LSMatCell_idx_of(cell, axis), axis, update);
+    // A missing tower only costs a few extra steps, so failure is harmless.
+    LSMatSkip_link_(skip, cell, height, update);
+}
+
+static void LSMatSkip_remove_(LSMatSkip_t *restrict skip, const LSMatCell_t *restrict cell,
+                              lsmat_axis_t axis) {
+    LSMatSkipNode_t *update[SKIP_MAX_LEVEL_];
+    LSMatSkip_search_(skip, LSMatCell_idx_of(cell, axis), axis, update);
+    LSMatSkipNode_t *const node = update[0] != NULL ? update[0]->next[0] : skip->first[0];
+    if (node == NULL || node->cell != cell) {
+        return;
+    }
+    for (size_t lv = 0; lv < node->height; lv++) {
+        LSMatSkipNode_t **const fwd = update[lv] != NULL ? update[lv]->next : skip->first;
+        fwd[lv] = node->next[lv];
+    }
+    LSMatSkipNode_t *t = node;
+    FREE_NULLIFY_(t);
+}
+
+static void LSMatHead_build_index_(LSMatHead_t *restrict head, lsmat_axis_t axis) {
+    LSMatSkip_t *const skip = lsmem_malloc_(sizeof(LSMatSkip_t));
+    if (skip == NULL) {
+        return;
+    }
+    skip->rng = 0x9E3779B97F4A7C15u;
+    LSMatSkipNode_t *update[SKIP_MAX_LEVEL_] = {0};
+    for (size_t lv = 0; lv < SKIP_MAX_LEVEL_; lv++) {
+        skip->first[lv] = NULL;
+    }
+    for (LSMatCell_t *p = head->first_cell; p != NULL; p = LSMatCell_succ_of(p, axis)) {
+        const size_t height = LSMatSkip_height_(skip);
+        if (height > 0 && LSMatSkip_link_(skip, p, height, update) != LSMAT_OK) {
+            LSMatSkip_free_(skip);
+            return;
+        }
+    }
+    head->index = skip;
+}
+
+size_t LSMatHead_index_bytes(const LSMatHead_t *restrict head) {
+    if (head->index == NULL) {
+        return 0;
+    }
+    size_t bytes = sizeof(LSMatSkip_t);
+    for (const LSMatSkipNode_t *p = head->index->first[0]; p != NULL; p = p->next[0]) {
+        bytes += sizeof(LSMatSkipNode_t) + p->height * sizeof(LSMatSkipNode_t *);
+    }
+    return bytes;
+}
+
+static void LSMatHead_drop_index_(LSMatHead_t *restrict head) {
+    if (head->index != NULL) {
+        LSMatSkip_free_(head->index);
+        head->index = NULL;
+    }
+}
+
+lsmat_errno_t LSMatArena_adopt(LSMatArena_t *restrict dst, LSMatArena_t *restrict src) {
+    if (dst == NULL || src == NULL) {
+        return LSMAT_E_GEN;
+    }
+    // Keep the current slab of dst in front so that it goes on filling up.
+    LSMatSlab_t **tail = dst->slabs != NULL ? &dst->slabs->next : &dst->slabs;
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
+    }
+    *tail = src->slabs;
+    LSMatCell_t *p = src->free_cells;
+    while (p != NULL) {
+        LSMatCell_t *const t = LSMatCell_succ_of(p, LSMAT_AXIS_0);
+        LSMatArena_recycle(dst, p);
+        p = t;
+    }
+    return LSMatArena_init(src);
+}
+
+lsmat_errno_t LSMatHead_init(LSMatHead_t *restrict head) {
     if (head == NULL) {
-        return NULL;
+        return LSMAT_E_GEN;
     }
+    head->first_cell = NULL;
+    head->last_cell = NULL;
+    head->cursor = NULL;
+    head->len = 0;
+    head->index = NULL;
+    head->dense = NULL;
+    return LSMAT_OK;
+}
+
+lsmat_errno_t LSMatHead_destroy(LSMatHead_t *restrict head, LSMatArena_t *restrict arena,
+                                lsmat_axis_t axis) {
     LSMatCell_t *p = head->first_cell;
+    LSMatHead_drop_index_(head);
+    if (head->dense != NULL) {
+        FREE_NULLIFY_(head->dense);
+    }
+    LSMatHead_init(head);
     while (p != NULL) {
-        if (LSMatCell_idx_of(p, axis) == i) {
+        LSMatCell_t *t = LSMatCell_succ_of(p, axis);
+        LSMatArena_recycle(arena, p);
+        p = t;
+    }
+    return LSMAT_OK;
+}
+
+/*
+ * Find the last cell whose index is less than i, or NULL if there is none.
+ * The tail and the cursor are tried first, so that sequential and
+ * near-sequential accesses stay cheap.
+ */
+static LSMatCell_t *LSMatHead_seek_prec_(const LSMatHead_t *restrict head, size_t i,
+                                         lsmat_axis_t axis) {
+    LSMatCell_t *const first = head->first_cell;
+    LSMatCell_t *const last = head->last_cell;
+    if (first == NULL || LSMatCell_idx_of(first, axis) >= i) {
+        return NULL;
+    }
+    if (LSMatCell_idx_of(last, axis) < i) {
+        return last;
+    }
+    LSMatCell_t *p = first;
+    if (head->index != NULL) {
+        LSMatSkipNode_t *update[SKIP_MAX_LEVEL_];
+        LSMatSkip_search_(head->index, i, axis, update);
+        p = update[0] != NULL ? update[0]->cell : first;
+    }
+    LSMatCell_t *const cursor = head->cursor;
+    if (cursor != NULL) {
+        const size_t cursor_idx = LSMatCell_idx_of(cursor, axis);
+#ifndef LSMAT_SINGLY_LINKED
+        if (cursor_idx >= i && head->index == NULL &&
+            cursor_idx - i < i - LSMatCell_idx_of(first, axis)) {
+            // Closer to the cursor than to the front; walk backwards.
+            size_t steps = 0;
+            p = cursor;
+            while (LSMatCell_idx_of(p, axis) >= i) {
+                p = LSMatCell_prec_of(p, axis);
+                steps++;
+            }
+            LSPROF_ADD_(LSPROF_CELLS_TRAVERSED, steps);
             return p;
         }
-        p = LSMatCell_succ_of(p, axis);
+#endif
+        if (cursor_idx < i && cursor_idx > LSMatCell_idx_of(p, axis)) {
+            p = cursor;
+        }
+    }
+    LSMatCell_t *p_n = NULL;
+    size_t steps = 0;
+    while ((p_n = LSMatCell_succ_of(p, axis)) != NULL && LSMatCell_idx_of(p_n, axis) < i) {
+        p = p_n;
+        steps++;
+    }
+    LSPROF_ADD_(LSPROF_CELLS_TRAVERSED, steps);
+    return p;
+}
+
+static void LSMatHead_grow_(LSMatHead_t *restrict head, LSMatCell_t *restrict cell,
+                            lsmat_axis_t axis) {
+    LSPROF_ADD_(LSPROF_INSERTS, 1);
+    head->len++;
+    if (head->index != NULL) {
+        LSMatSkip_insert_(head->index, cell, axis);
+    } else if (head->len >= SKIP_BUILD_LEN_) {
+        LSMatHead_build_index_(head, axis);
+    }
+}
+
+LSMatCell_t *LSMatHead_cell_at(const LSMatHead_t *restrict head, size_t i, lsmat_axis_t axis) {
+    if (head == NULL) {
+        return NULL;
+    }
+    const LSMatCell_t *const prec = LSMatHead_seek_prec_(head, i, axis);
+    LSMatCell_t *const p = prec != NULL ? LSMatCell_succ_of(prec, axis) : head->first_cell;
+    return LSMatCell_idx_of(p, axis) == i ? p : NULL;
+}
+
+LSMatCell_t *LSMatHead_seek(LSMatHead_t *restrict head, size_t i, lsmat_axis_t axis) {
+    if (head == NULL) {
+        return NULL;
     }
-    return NULL;
+    LSMatCell_t *const prec = LSMatHead_seek_prec_(head, i, axis);
+    LSMatCell_t *const p = prec != NULL ? LSMatCell_succ_of(prec, axis) : head->first_cell;
+#ifdef LSMAT_SINGLY_LINKED
+    // Without back links, park in front of the cell so that removing it
+    // right after the lookup does not need another walk.
+    head->cursor = prec;
+#else
+    head->cursor = LSMatCell_idx_of(p, axis) == i ? p : prec;
+#endif
+    return LSMatCell_idx_of(p, axis) == i ? p : NULL;
 }
 
 lsmat_errno_t LSMatHead_insert(LSMatHead_t *restrict head, LSMatCell_t *restrict cell,
@@ -73,50 +410,48 @@ lsmat_errno_t LSMatHead_insert(LSMatHead_t *restrict head, LSMatCell_t *restrict
     }
     *out_dup = NULL;
     const size_t cell_idx = LSMatCell_idx_of(cell, axis);
-    LSMatCell_t *p = head->first_cell;
-    LSMatCell_t *p_n = NULL;
-    // Empty list
-    if (p == NULL) {
-        head->first_cell = cell;
-        *LSMatCell_ref_prec_of(cell, axis) = NULL;
-        *LSMatCell_ref_succ_of(cell, axis) = NULL;
-        return LSMAT_OK;
-    }
-    // First element
-    if (LSMatCell_idx_of(p, axis) == cell_idx) {
-        *out_dup = p;
+    LSMatCell_t *const prec = LSMatHead_seek_prec_(head, cell_idx, axis);
+    LSMatCell_t *const succ = prec != NULL ? LSMatCell_succ_of(prec, axis) : head->first_cell;
+    if (LSMatCell_idx_of(succ, axis) == cell_idx) {
+        head->cursor = succ;
+        *out_dup = succ;
         return LSMAT_E_DUP;
-    } else if (cell_idx < LSMatCell_idx_of(p, axis)) {
-        *LSMatCell_ref_prec_of(cell, axis) = NULL;
-        *LSMatCell_ref_prec_of(p, axis) = cell;
-        *LSMatCell_ref_succ_of(cell, axis) = p;
-        head->first_cell = cell;
-        return LSMAT_OK;
     }
-    // Body element
-    while (p != NULL && (p_n = LSMatCell_succ_of(p, axis)) != NULL) {
-        if (LSMatCell_idx_of(p, axis) == cell_idx) {
-            *out_dup = p;
-            return LSMAT_E_DUP;
-        } else if (LSMatCell_idx_of(p, axis) < cell_idx && cell_idx < LSMatCell_idx_of(p_n, axis)) {
-            *LSMatCell_ref_succ_of(p, axis) = cell;
-            *LSMatCell_ref_prec_of(cell, axis) = p;
-            *LSMatCell_ref_prec_of(p_n, axis) = cell;
-            *LSMatCell_ref_succ_of(cell, axis) = p_n;
-            return LSMAT_OK;
-        }
-        p = p_n;
+    LSMatCell_link_prec_(cell, axis, prec);
+    *LSMatCell_ref_succ_of(cell, axis) = succ;
+    // Lock-free readers may be walking the list; the cell must be complete
+    // before it becomes reachable.
+    LSAtomic_store_cell_(prec != NULL ? LSMatCell_ref_succ_of(prec, axis) : &head->first_cell,
+                         cell);
+    if (succ != NULL) {
+        LSMatCell_link_prec_(succ, axis, cell);
+    } else {
+        head->last_cell = cell;
     }
-    // Tail element
-    if (LSMatCell_idx_of(p, axis) == cell_idx) {
-        *out_dup = p;
-        return LSMAT_E_DUP;
+    head->cursor = cell;
+    LSMatHead_grow_(head, cell, axis);
+    return LSMAT_OK;
+}
+
+lsmat_errno_t LSMatHead_append(LSMatHead_t *restrict head, LSMatCell_t *restrict cell,
+                               lsmat_axis_t axis) {
+    if (head == NULL || cell == NULL) {
+        return LSMAT_E_GEN;
+    }
+    LSMatCell_t *const last = head->last_cell;
+    if (last != NULL && LSMatCell_idx_of(last, axis) >= LSMatCell_idx_of(cell, axis)) {
+        return LSMAT_E_GEN;
+    }
+    LSMatCell_link_prec_(cell, axis, last);
+    *LSMatCell_ref_succ_of(cell, axis) = NULL;
+    if (last != NULL) {
+        *LSMatCell_ref_succ_of(last, axis) = cell;
     } else {
-        *LSMatCell_ref_succ_of(p, axis) = cell;
-        *LSMatCell_ref_prec_of(cell, axis) = p;
-        *LSMatCell_ref_succ_of(cell, axis) = NULL;
-        return LSMAT_OK;
+        head->first_cell = cell;
     }
+    head->last_cell = cell;
+    LSMatHead_grow_(head, cell, axis);
+    return LSMAT_OK;
 }
 
 lsmat_errno_t LSMatHead_remove(LSMatHead_t *restrict head, LSMatCell_t *restrict cell,
@@ -124,127 +459,804 @@ lsmat_errno_t LSMatHead_remove(LSMatHead_t *restrict head, LSMatCell_t *restrict
     if (head == NULL || cell == NULL) {
         return LSMAT_E_GEN;
     }
+#ifdef LSMAT_SINGLY_LINKED
+    LSMatCell_t *const prec = LSMatHead_seek_prec_(head, LSMatCell_idx_of(cell, axis), axis);
+    if ((prec != NULL ? LSMatCell_succ_of(prec, axis) : head->first_cell) != cell) {
+        return LSMAT_E_GEN;
+    }
+#else
     LSMatCell_t *const prec = LSMatCell_prec_of(cell, axis);
+#endif
     LSMatCell_t *const succ = LSMatCell_succ_of(cell, axis);
     if (succ != NULL) {
-        *LSMatCell_ref_prec_of(succ, axis) = prec;
-        *LSMatCell_ref_succ_of(cell, axis) = NULL;
+        LSMatCell_link_prec_(succ, axis, prec);
+    } else {
+        // This is the last element
+        head->last_cell = prec;
     }
+    // The cell keeps its successor, so that a reader standing on it can
+    // still get to the rest of the list.
     if (prec != NULL) {
-        *LSMatCell_ref_succ_of(prec, axis) = succ;
-        *LSMatCell_ref_prec_of(cell, axis) = NULL;
+        LSAtomic_store_cell_(LSMatCell_ref_succ_of(prec, axis), succ);
+        LSMatCell_link_prec_(cell, axis, NULL);
     } else {
         // This is the first element
-        head->first_cell = succ;
+        LSAtomic_store_cell_(&head->first_cell, succ);
+    }
+    if (head->cursor == cell) {
+        head->cursor = prec;
+    }
+    LSPROF_ADD_(LSPROF_REMOVALS, 1);
+    head->len--;
+    if (head->index != NULL) {
+        if (head->len < SKIP_DROP_LEN_) {
+            LSMatHead_drop_index_(head);
+        } else {
+            LSMatSkip_remove_(head->index, cell, axis);
+        }
     }
     return LSMAT_OK;
 }
 
 LSMat_t *LSMat_new(size_t shape_0, size_t shape_1) {
+    LSPROF_FN_();
+#ifdef LSMAT_COMPACT_INDEX
+    if (shape_0 > LSMAT_IDX_MAX || shape_1 > LSMAT_IDX_MAX) {
+        return NULL;
+    }
+#endif
     LSMat_t *const mat = malloc(sizeof(LSMat_t));
+    if (mat == NULL) {
+        return NULL;
+    }
     mat->shape[LSMAT_AXIS_0] = shape_0;
     mat->shape[LSMAT_AXIS_1] = shape_1;
     // calloc has covered the trivial constructor for LSMatHead_t,
     // thus we skip it.
-    mat->heads[LSMAT_AXIS_0] = calloc(shape_0, sizeof(LSMatHead_t));
-    mat->heads[LSMAT_AXIS_1] = calloc(shape_1, sizeof(LSMatHead_t));
-    if (lsmat_alloc_hook_ != NULL) {
-        lsmat_alloc_hook_(mat);
-        lsmat_alloc_hook_(mat->heads[LSMAT_AXIS_0]);
-        lsmat_alloc_hook_(mat->heads[LSMAT_AXIS_1]);
+    mat->heads[LSMAT_AXIS_0] = calloc(shape_0 > 0 ? shape_0 : 1, sizeof(LSMatHead_t));
+    mat->heads[LSMAT_AXIS_1] = calloc(shape_1 > 0 ? shape_1 : 1, sizeof(LSMatHead_t));
+    if (mat->heads[LSMAT_AXIS_0] == NULL || mat->heads[LSMAT_AXIS_1] == NULL) {
+        free(mat->heads[LSMAT_AXIS_0]);
+        free(mat->heads[LSMAT_AXIS_1]);
+        free(mat);
+        return NULL;
     }
+    LSMatArena_init(&mat->arena);
+    mat->dense_rows = NULL;
+    mat->dense_groups = NULL;
+    mat->n_dense_rows = 0;
+    mat->n_dense_words = 0;
+    mat->id = atomic_fetch_add(&next_mat_id_, 1);
+    mat->version = 0;
+    atomic_init(&mat->refs, 1);
+    lsmem_hook_alloc_(mat);
+    lsmem_hook_alloc_(mat->heads[LSMAT_AXIS_0]);
+    lsmem_hook_alloc_(mat->heads[LSMAT_AXIS_1]);
     return mat;
 }
 
 lsmat_errno_t LSMat_free(LSMat_t *restrict mat) {
+    LSPROF_FN_();
     if (mat == NULL) {
         return LSMAT_E_GEN;
     }
-    for (size_t i = 0; i < mat->shape[LSMAT_AXIS_0]; i++) {
-        LSMatHead_destroy(mat->heads[LSMAT_AXIS_0] + i, 1);
+    if (atomic_fetch_sub(&mat->refs, 1) > 1) {
+        return LSMAT_OK;
     }
+    // All cells live in the arena, so the lists need not be walked.
+    LSMat_zero(mat);
     FREE_NULLIFY_(mat->heads[LSMAT_AXIS_0]);
-    // freeing the rows is equivalent to freeing the whole matrix.
-    // thus we skip freeing the columns.
     FREE_NULLIFY_(mat->heads[LSMAT_AXIS_1]);
-    memset(mat->shape, 0, sizeof(mat->shape));
-    if (lsmat_free_hook_ != NULL) {
-        lsmat_free_hook_(mat);
+    if (mat->dense_rows != NULL) {
+        FREE_NULLIFY_(mat->dense_rows);
     }
+    memset(mat->shape, 0, sizeof(mat->shape));
+    lsmem_hook_free_(mat);
     free(mat);
     return LSMAT_OK;
 }
 
+void LSMat_set_hooks(lsmat_alloc_hook_t alloc_hook, lsmat_free_hook_t free_hook) {
+    atomic_store_explicit(&lsmat_alloc_hook_, alloc_hook, memory_order_release);
+    atomic_store_explicit(&lsmat_free_hook_, free_hook, memory_order_release);
+}
+
+LSMat_t *LSMat_retain(LSMat_t *restrict mat) {
+    if (mat != NULL) {
+        atomic_fetch_add(&mat->refs, 1);
+    }
+    return mat;
+}
+
+bool LSMat_is_shared(const LSMat_t *restrict mat) {
+    return mat != NULL && atomic_load(&((LSMat_t *)mat)->refs) > 1;
+}
+
+/*
+ * A row is worth storing densely once its cells take more memory than a
+ * plain array of the row. It goes back to cells only when it has thinned
+ * out to half of that, so that it does not flip on every update.
+ */
+static bool LSMat_row_wants_dense_(const LSMat_t *restrict mat, size_t len) {
+    return len * sizeof(LSMatCell_t) >= mat->shape[LSMAT_AXIS_1] * sizeof(double);
+}
+
+static bool LSMat_row_wants_sparse_(const LSMat_t *restrict mat, size_t len) {
+    return 2 * len * sizeof(LSMatCell_t) < mat->shape[LSMAT_AXIS_1] * sizeof(double);
+}
+
+/*
+ * Dense rows are marked in a bitmap, and a coarser bitmap on top of it marks
+ * the words that hold any mark. Rows come and go in O(1) whatever the order,
+ * and a walk over them skips 4096 rows at a time where there are none.
+ */
+static lsmat_errno_t LSMat_dense_rows_add_(LSMat_t *restrict mat, size_t i) {
+    if (mat->dense_rows == NULL) {
+        const size_t n_rows_words = (mat->shape[LSMAT_AXIS_0] + 63) / 64;
+        const size_t n_words = n_rows_words + (n_rows_words + 63) / 64;
+        uint64_t *const bits = lsmem_calloc_(n_words, sizeof(uint64_t));
+        if (bits == NULL) {
+            return LSMAT_E_GEN;
+        }
+        mat->dense_rows = bits;
+        mat->dense_groups = bits + n_rows_words;
+        mat->n_dense_words = n_words;
+    }
+    uint64_t *const word = mat->dense_rows + i / 64;
+    const uint64_t bit = (uint64_t)1 << (i % 64);
+    if ((*word & bit) == 0) {
+        *word |= bit;
+        mat->dense_groups[i / 4096] |= (uint64_t)1 << (i / 64 % 64);
+        mat->n_dense_rows++;
+    }
+    return LSMAT_OK;
+}
+
+static void LSMat_dense_rows_remove_(LSMat_t *restrict mat, size_t i) {
+    if (mat->dense_rows == NULL) {
+        return;
+    }
+    uint64_t *const word = mat->dense_rows + i / 64;
+    const uint64_t bit = (uint64_t)1 << (i % 64);
+    if ((*word & bit) != 0) {
+        *word &= ~bit;
+        if (*word == 0) {
+            mat->dense_groups[i / 4096] &= ~((uint64_t)1 << (i / 64 % 64));
+        }
+        mat->n_dense_rows--;
+    }
+}
+
+size_t LSMat_next_dense_row(const LSMat_t *restrict mat, size_t i) {
+    const size_t n_rows = mat->shape[LSMAT_AXIS_0];
+    if (mat->n_dense_rows == 0 || i >= n_rows) {
+        return n_rows;
+    }
+    size_t w = i / 64;
+    uint64_t bits = mat->dense_rows[w] & (~(uint64_t)0 << (i % 64));
+    if (bits == 0) {
+        const size_t n_rows_words = (n_rows + 63) / 64;
+        const size_t n_groups = (n_rows_words + 63) / 64;
+        if (++w >= n_rows_words) {
+            return n_rows;
+        }
+        size_t g = w / 64;
+        uint64_t groups = mat->dense_groups[g] & (~(uint64_t)0 << (w % 64));
+        while (groups == 0) {
+            if (++g >= n_groups) {
+                return n_rows;
+            }
+            groups = mat->dense_groups[g];
+        }
+        w = g * 64 + (size_t)__builtin_ctzll(groups);
+        bits = mat->dense_rows[w];
+    }
+    return w * 64 + (size_t)__builtin_ctzll(bits);
+}
+
+static lsmat_errno_t LSMat_densify_row_(LSMat_t *restrict mat, size_t i) {
+    LSMatHead_t *const head = mat->heads[LSMAT_AXIS_0] + i;
+    double *const dense = lsmem_calloc_(mat->shape[LSMAT_AXIS_1], sizeof(double));
+    if (dense == NULL) {
+        return LSMAT_E_GEN;
+    }
+    if (LSMat_dense_rows_add_(mat, i) != LSMAT_OK) {
+        double *t = dense;
+        FREE_NULLIFY_(t);
+        return LSMAT_E_GEN;
+    }
+    // Explicit zeros left behind by unpruned updates do not count.
+    size_t len = 0;
+    LSMatCell_t *p = head->first_cell;
+    LSMatHead_drop_index_(head);
+    LSMatHead_init(head);
+    while (p != NULL) {
+        LSMatCell_t *const t = LSMatCell_succ_of(p, LSMAT_AXIS_1);
+        const size_t j = LSMatCell_idx_of(p, LSMAT_AXIS_1);
+        dense[j] = p->v;
+        len += p->v != 0.;
+        LSMatHead_remove(mat->heads[LSMAT_AXIS_1] + j, p, LSMAT_AXIS_0);
+        LSMatArena_recycle(&mat->arena, p);
+        p = t;
+    }
+    head->dense = dense;
+    head->len = len;
+    return LSMAT_OK;
+}
+
+static lsmat_errno_t LSMat_sparsify_row_(LSMat_t *restrict mat, size_t i) {
+    LSMatHead_t *const head = mat->heads[LSMAT_AXIS_0] + i;
+    double *dense = head->dense;
+    const size_t len = head->len;
+    LSMatHead_init(head);
+    for (size_t j = 0; j < mat->shape[LSMAT_AXIS_1]; j++) {
+        if (dense[j] == 0.) {
+            continue;
+        }
+        LSMatCell_t *const cell = LSMatArena_alloc(&mat->arena);
+        if (cell == NULL) {
+            // Roll back to the dense row, which is still intact.
+            LSMatCell_t *p = head->first_cell;
+            while (p != NULL) {
+                LSMatCell_t *const t = LSMatCell_succ_of(p, LSMAT_AXIS_1);
+                LSMatHead_remove(mat->heads[LSMAT_AXIS_1] + LSMatCell_idx_of(p, LSMAT_AXIS_1), p,
+                                 LSMAT_AXIS_0);
+                LSMatArena_recycle(&mat->arena, p);
+                p = t;
+            }
+            LSMatHead_drop_index_(head);
+            LSMatHead_init(head);
+            head->dense = dense;
+            head->len = len;
+            return LSMAT_E_GEN;
+        }
+        LSMatCell_set_idx(cell, LSMAT_AXIS_0, i);
+        LSMatCell_set_idx(cell, LSMAT_AXIS_1, j);
+        cell->v = dense[j];
+        LSMatCell_t *dup = NULL;
+        LSMatHead_append(head, cell, LSMAT_AXIS_1);
+        LSMatHead_insert(mat->heads[LSMAT_AXIS_1] + j, cell, LSMAT_AXIS_0, &dup);
+    }
+    FREE_NULLIFY_(dense);
+    LSMat_dense_rows_remove_(mat, i);
+    return LSMAT_OK;
+}
+
+static lsmat_errno_t LSMat_adapt_row_(LSMat_t *restrict mat, size_t i) {
+    const LSMatHead_t *const head = mat->heads[LSMAT_AXIS_0] + i;
+    if (head->dense == NULL && LSMat_row_wants_dense_(mat, head->len)) {
+        return LSMat_densify_row_(mat, i);
+    } else if (head->dense != NULL && LSMat_row_wants_sparse_(mat, head->len)) {
+        return LSMat_sparsify_row_(mat, i);
+    }
+    return LSMAT_OK;
+}
+
+lsmat_errno_t LSMat_adapt(LSMat_t *restrict mat) {
+    LSPROF_FN_();
+    if (mat == NULL) {
+        return LSMAT_E_GEN;
+    }
+    for (size_t i = 0; i < mat->shape[LSMAT_AXIS_0]; i++) {
+        if (LSMat_adapt_row_(mat, i) != LSMAT_OK) {
+            return LSMAT_E_GEN;
+        }
+    }
+    return LSMAT_OK;
+}
+
 double LSMat_at(const LSMat_t *restrict mat, size_t i_0, size_t i_1) {
+    LSPROF_FN_();
     if (mat == NULL) {
         return 0.;
     }
-    if (i_0 > mat->shape[LSMAT_AXIS_0] || i_1 > mat->shape[LSMAT_AXIS_1]) {
+    if (i_0 >= mat->shape[LSMAT_AXIS_0] || i_1 >= mat->shape[LSMAT_AXIS_1]) {
         return 0.;
     }
-    LSMatCell_t *cell = LSMatHead_cell_at(mat->heads[LSMAT_AXIS_0] + i_0, i_1, LSMAT_AXIS_1);
+    const LSMatHead_t *const head = mat->heads[LSMAT_AXIS_0] + i_0;
+    if (head->dense != NULL) {
+        return head->dense[i_1];
+    }
+    // Readers may share the matrix, so the lookup leaves the cursor alone.
+    const LSMatCell_t *const cell = LSMatHead_cell_at(head, i_1, LSMAT_AXIS_1);
     return cell == NULL ? 0. : cell->v;
 }
 
-static void LSMat_set_nonzero_(LSMat_t *restrict mat, size_t i_0, size_t i_1, double v) {
+static lsmat_errno_t LSMat_set_nonzero_(LSMat_t *restrict mat, size_t i_0, size_t i_1, double v) {
     LSMatHead_t *const head_0 = mat->heads[LSMAT_AXIS_0] + i_0;
     LSMatHead_t *const head_1 = mat->heads[LSMAT_AXIS_1] + i_1;
-    LSMatCell_t *new_cell = calloc(1, sizeof(LSMatCell_t));
-    if (lsmat_alloc_hook_ != NULL) {
-        lsmat_alloc_hook_(new_cell);
+    if (head_0->dense != NULL) {
+        head_0->len += head_0->dense[i_1] == 0.;
+        head_0->dense[i_1] = v;
+        return LSMAT_OK;
     }
-    new_cell->axes[LSMAT_AXIS_0].i = i_0;
-    new_cell->axes[LSMAT_AXIS_1].i = i_1;
+    LSMatCell_t *new_cell = LSMatArena_alloc(&mat->arena);
+    if (new_cell == NULL) {
+        return LSMAT_E_GEN;
+    }
+    LSMatCell_set_idx(new_cell, LSMAT_AXIS_0, i_0);
+    LSMatCell_set_idx(new_cell, LSMAT_AXIS_1, i_1);
     new_cell->v = v;
     LSMatCell_t *dup = NULL;
     if (LSMatHead_insert(head_0, new_cell, LSMAT_AXIS_1, &dup) == LSMAT_E_DUP ||
         LSMatHead_insert(head_1, new_cell, LSMAT_AXIS_0, &dup) == LSMAT_E_DUP) {
         dup->v = v;
-        if (lsmat_free_hook_ != NULL) {
-            lsmat_free_hook_(new_cell);
-        }
-        free(new_cell);
+        LSMatArena_recycle(&mat->arena, new_cell);
+        return LSMAT_OK;
     }
+    return LSMat_adapt_row_(mat, i_0);
 }
 
-static void LSMat_set_zero_(LSMat_t *restrict mat, size_t i_0, size_t i_1) {
+static lsmat_errno_t LSMat_set_zero_(LSMat_t *restrict mat, size_t i_0, size_t i_1) {
     LSMatHead_t *const head_0 = mat->heads[LSMAT_AXIS_0] + i_0;
     LSMatHead_t *const head_1 = mat->heads[LSMAT_AXIS_1] + i_1;
-    LSMatCell_t *cell = LSMatHead_cell_at(head_0, i_1, LSMAT_AXIS_1);
+    if (head_0->dense != NULL) {
+        if (head_0->dense[i_1] == 0.) {
+            return LSMAT_OK;
+        }
+        head_0->dense[i_1] = 0.;
+        head_0->len--;
+        return LSMat_adapt_row_(mat, i_0);
+    }
+    LSMatCell_t *cell = LSMatHead_seek(head_0, i_1, LSMAT_AXIS_1);
     if (cell == NULL) {
-        return;
+        return LSMAT_OK;
     }
     LSMatHead_remove(head_0, cell, LSMAT_AXIS_1);
     LSMatHead_remove(head_1, cell, LSMAT_AXIS_0);
-    if (lsmat_free_hook_ != NULL) {
-        lsmat_free_hook_(cell);
-    }
-    free(cell);
+    LSMatArena_recycle(&mat->arena, cell);
+    return LSMAT_OK;
 }
 
 lsmat_errno_t LSMat_set(LSMat_t *restrict mat, size_t i_0, size_t i_1, double v) {
+    LSPROF_FN_();
     if (mat == NULL || i_0 >= mat->shape[LSMAT_AXIS_0] || i_1 >= mat->shape[LSMAT_AXIS_1]) {
         return LSMAT_E_GEN;
     }
+    mat->version++;
     if (v == 0.) {
-        LSMat_set_zero_(mat, i_0, i_1);
-    } else {
-        LSMat_set_nonzero_(mat, i_0, i_1, v);
+        return LSMat_set_zero_(mat, i_0, i_1);
+    }
+    return LSMat_set_nonzero_(mat, i_0, i_1, v);
+}
+
+lsmat_errno_t LSMat_accumulate_row(LSMat_t *restrict mat, size_t i, double alpha,
+                                   const size_t *restrict idx, const double *restrict v, size_t n,
+                                   bool prune) {
+    LSPROF_FN_();
+    if (mat == NULL || i >= mat->shape[LSMAT_AXIS_0] || (n > 0 && (idx == NULL || v == NULL))) {
+        return LSMAT_E_GEN;
+    }
+    // The row walk below relies on idx being strictly ascending; check it
+    // up front so that a bad call leaves the row untouched.
+    for (size_t k = 0; k < n; k++) {
+        if (idx[k] >= mat->shape[LSMAT_AXIS_1] || (k > 0 && idx[k] <= idx[k - 1])) {
+            return LSMAT_E_GEN;
+        }
+    }
+    mat->version++;
+    LSMatHead_t *const head = mat->heads[LSMAT_AXIS_0] + i;
+    if (head->dense != NULL) {
+        for (size_t k = 0; k < n; k++) {
+            double *const slot = head->dense + idx[k];
+            const double old = *slot;
+            *slot += alpha * v[k];
+            head->len += (old == 0.) - (*slot == 0.);
+        }
+        return LSMat_adapt_row_(mat, i);
+    }
+    // Walk the row alongside the entries; cells in the way are updated where
+    // they are, and new ones go right behind the walk.
+    LSMatCell_t *prec = NULL;
+    LSMatCell_t *p = head->first_cell;
+    size_t steps = 0;
+    for (size_t k = 0; k < n; k++) {
+        const size_t j = idx[k];
+        const double d = alpha * v[k];
+        while (p != NULL && LSMatCell_idx_of(p, LSMAT_AXIS_1) < j) {
+            prec = p;
+            p = LSMatCell_succ_of(p, LSMAT_AXIS_1);
+            steps++;
+        }
+        if (p != NULL && LSMatCell_idx_of(p, LSMAT_AXIS_1) == j) {
+            p->v += d;
+            if (prune && p->v == 0.) {
+                LSMatCell_t *const t = LSMatCell_succ_of(p, LSMAT_AXIS_1);
+                head->cursor = prec;
+                LSMatHead_remove(head, p, LSMAT_AXIS_1);
+                LSMatHead_remove(mat->heads[LSMAT_AXIS_1] + j, p, LSMAT_AXIS_0);
+                LSMatArena_recycle(&mat->arena, p);
+                p = t;
+            }
+            continue;
+        }
+        if (d == 0.) {
+            continue;
+        }
+        LSMatCell_t *const cell = LSMatArena_alloc(&mat->arena);
+        if (cell == NULL) {
+            return LSMAT_E_GEN;
+        }
+        LSMatCell_set_idx(cell, LSMAT_AXIS_0, i);
+        LSMatCell_set_idx(cell, LSMAT_AXIS_1, j);
+        cell->v = d;
+        LSMatCell_t *dup = NULL;
+        // The cursor hint makes the row insertion O(1); the column cursor
+        // keeps its insertions cheap as long as rows come in order.
+        head->cursor = prec;
+        LSMatHead_insert(head, cell, LSMAT_AXIS_1, &dup);
+        LSMatHead_insert(mat->heads[LSMAT_AXIS_1] + j, cell, LSMAT_AXIS_0, &dup);
+        prec = cell;
+    }
+    LSPROF_ADD_(LSPROF_CELLS_TRAVERSED, steps);
+    return LSMat_adapt_row_(mat, i);
+}
+
+lsmat_errno_t LSMat_prune(LSMat_t *restrict mat) {
+    LSPROF_FN_();
+    if (mat == NULL) {
+        return LSMAT_E_GEN;
+    }
+    for (size_t i = 0; i < mat->shape[LSMAT_AXIS_0]; i++) {
+        LSMatHead_t *const head = mat->heads[LSMAT_AXIS_0] + i;
+        LSMatCell_t *prec = NULL;
+        LSMatCell_t *p = head->dense == NULL ? head->first_cell : NULL;
+        while (p != NULL) {
+            LSMatCell_t *const t = LSMatCell_succ_of(p, LSMAT_AXIS_1);
+            if (p->v == 0.) {
+                head->cursor = prec;
+                LSMatHead_remove(head, p, LSMAT_AXIS_1);
+                LSMatHead_remove(mat->heads[LSMAT_AXIS_1] + LSMatCell_idx_of(p, LSMAT_AXIS_1), p,
+                                 LSMAT_AXIS_0);
+                LSMatArena_recycle(&mat->arena, p);
+            } else {
+                prec = p;
+            }
+            p = t;
+        }
     }
     return LSMAT_OK;
 }
 
 lsmat_errno_t LSMat_zero(LSMat_t *restrict mat) {
+    LSPROF_FN_();
     if (mat == NULL) {
         return LSMAT_E_GEN;
     }
-    for (size_t i = 0; i < mat->shape[LSMAT_AXIS_0]; i++) {
-        LSMatHead_destroy(mat->heads[LSMAT_AXIS_0] + i, 1);
+    mat->version++;
+    LSMatArena_destroy(&mat->arena);
+    for (size_t i = 0; i < LSMAT_AXIS_COUNT_; i++) {
+        for (size_t j = 0; j < mat->shape[i]; j++) {
+            LSMatHead_t *const head = mat->heads[i] + j;
+            LSMatHead_drop_index_(head);
+            if (head->dense != NULL) {
+                FREE_NULLIFY_(head->dense);
+            }
+            LSMatHead_init(head);
+        }
+    }
+    if (mat->dense_rows != NULL) {
+        memset(mat->dense_rows, 0, mat->n_dense_words * sizeof(uint64_t));
+    }
+    mat->n_dense_rows = 0;
+    return LSMAT_OK;
+}
+
+static void LSMat_counting_sort_(size_t *restrict perm, size_t *restrict tmp, size_t n,
+                                 const size_t *restrict keys, size_t *restrict counts,
+                                 size_t n_keys) {
+    memset(counts, 0, (n_keys + 1) * sizeof(size_t));
+    for (size_t k = 0; k < n; k++) {
+        counts[keys[perm[k]] + 1]++;
+    }
+    for (size_t key = 0; key < n_keys; key++) {
+        counts[key + 1] += counts[key];
+    }
+    for (size_t k = 0; k < n; k++) {
+        tmp[counts[keys[perm[k]]]++] = perm[k];
+    }
+    memcpy(perm, tmp, n * sizeof(size_t));
+}
+
+lsmat_errno_t LSMat_build(LSMat_t *restrict mat, const size_t *restrict i_0,
+                          const size_t *restrict i_1, const double *restrict v, size_t n,
+                          lsmat_dup_t dup) {
+    LSPROF_FN_();
+    if (mat == NULL || (n > 0 && (i_0 == NULL || i_1 == NULL || v == NULL))) {
+        return LSMAT_E_GEN;
+    }
+    for (size_t k = 0; k < n; k++) {
+        if (i_0[k] >= mat->shape[LSMAT_AXIS_0] || i_1[k] >= mat->shape[LSMAT_AXIS_1]) {
+            return LSMAT_E_GEN;
+        }
+    }
+    LSMat_zero(mat);
+    if (n == 0) {
+        return LSMAT_OK;
+    }
+    const size_t n_keys = mat->shape[LSMAT_AXIS_0] > mat->shape[LSMAT_AXIS_1]
+                              ? mat->shape[LSMAT_AXIS_0]
+                              : mat->shape[LSMAT_AXIS_1];
+    size_t *const perm = malloc(n * sizeof(size_t));
+    size_t *const tmp = malloc(n * sizeof(size_t));
+    size_t *const counts = malloc((n_keys + 1) * sizeof(size_t));
+    LSMatWriter_t w;
+    bool has_writer = false;
+    lsmat_errno_t err = LSMAT_OK;
+    if (perm == NULL || tmp == NULL || counts == NULL || LSMatWriter_init(&w, mat) != LSMAT_OK) {
+        err = LSMAT_E_GEN;
+        goto cleanup;
+    }
+    has_writer = true;
+    // LSD radix sort with one digit per axis: stable by column, then by row.
+    for (size_t k = 0; k < n; k++) {
+        perm[k] = k;
+    }
+    LSMat_counting_sort_(perm, tmp, n, i_1, counts, mat->shape[LSMAT_AXIS_1]);
+    LSMat_counting_sort_(perm, tmp, n, i_0, counts, mat->shape[LSMAT_AXIS_0]);
+    for (size_t k = 0; k < n;) {
+        const size_t r = i_0[perm[k]];
+        const size_t c = i_1[perm[k]];
+        double sum = v[perm[k]];
+        for (k++; k < n && i_0[perm[k]] == r && i_1[perm[k]] == c; k++) {
+            if (dup == LSMAT_DUP_REJECT) {
+                err = LSMAT_E_DUP;
+                goto cleanup;
+            }
+            sum += v[perm[k]];
+        }
+        if (LSMatWriter_put(&w, c, sum) != LSMAT_OK) {
+            err = LSMAT_E_GEN;
+            goto cleanup;
+        }
+        if ((k == n || i_0[perm[k]] != r) && LSMatWriter_end_row(&w, r) != LSMAT_OK) {
+            err = LSMAT_E_GEN;
+            goto cleanup;
+        }
+    }
+cleanup:
+    if (has_writer) {
+        LSMat_stitch(mat, &w, 1, 0, mat->shape[LSMAT_AXIS_1]);
+        if (LSMat_adopt(mat, &w, 1) != LSMAT_OK && err == LSMAT_OK) {
+            err = LSMAT_E_GEN;
+        }
+    }
+    if (err != LSMAT_OK) {
+        LSMat_zero(mat);
+    }
+    free(perm);
+    free(tmp);
+    free(counts);
+    return err;
+}
+
+void LSMatIter_init(LSMatIter_t *restrict it, const LSMat_t *restrict mat, lsmat_axis_t axis,
+                    size_t line) {
+    const LSMatHead_t *const head = mat->heads[axis] + line;
+    it->mat = mat;
+    it->axis = axis;
+    it->line = line;
+    it->cell = head->first_cell;
+    it->dense = head->dense;
+    it->pos = 0;
+}
+
+bool LSMatIter_next(LSMatIter_t *restrict it, size_t *restrict out_idx, double *restrict out_v) {
+    if (it->axis == LSMAT_AXIS_0 && it->dense != NULL) {
+        const size_t len = it->mat->shape[LSMAT_AXIS_1];
+        while (it->pos < len && it->dense[it->pos] == 0.) {
+            it->pos++;
+        }
+        if (it->pos == len) {
+            return false;
+        }
+        *out_idx = it->pos;
+        *out_v = it->dense[it->pos++];
+        return true;
+    }
+    const lsmat_axis_t minor = it->axis == LSMAT_AXIS_0 ? LSMAT_AXIS_1 : LSMAT_AXIS_0;
+    if (it->axis == LSMAT_AXIS_1) {
+        // Dense rows are not linked into the columns; merge them back in.
+        const LSMat_t *const mat = it->mat;
+        size_t i = LSMat_next_dense_row(mat, it->pos);
+        while (i < mat->shape[LSMAT_AXIS_0] && mat->heads[LSMAT_AXIS_0][i].dense[it->line] == 0.) {
+            i = LSMat_next_dense_row(mat, i + 1);
+        }
+        it->pos = i;
+        if (i < mat->shape[LSMAT_AXIS_0] && i < LSMatCell_idx_of(it->cell, LSMAT_AXIS_0)) {
+            it->pos++;
+            *out_idx = i;
+            *out_v = mat->heads[LSMAT_AXIS_0][i].dense[it->line];
+            return true;
+        }
     }
-    memset(mat->heads[LSMAT_AXIS_1], 0, mat->shape[LSMAT_AXIS_1] * sizeof(LSMatHead_t));
+    if (it->cell == NULL) {
+        return false;
+    }
+    *out_idx = LSMatCell_idx_of(it->cell, minor);
+    *out_v = it->cell->v;
+    it->cell = LSMatCell_succ_of(it->cell, minor);
+    return true;
+}
+
+lsmat_errno_t LSMatWriter_init(LSMatWriter_t *restrict w, LSMat_t *restrict mat) {
+    if (w == NULL || mat == NULL) {
+        return LSMAT_E_GEN;
+    }
+    const size_t n_cols = mat->shape[LSMAT_AXIS_1] > 0 ? mat->shape[LSMAT_AXIS_1] : 1;
+    w->mat = mat;
+    LSMatArena_init(&w->arena);
+    w->col_first = calloc(n_cols, sizeof(LSMatCell_t *));
+    w->col_last = calloc(n_cols, sizeof(LSMatCell_t *));
+    w->col_len = calloc(n_cols, sizeof(size_t));
+    w->row_idx = malloc(n_cols * sizeof(size_t));
+    w->row_v = malloc(n_cols * sizeof(double));
+    w->row_len = 0;
+    w->dense_rows = NULL;
+    w->n_dense_rows = 0;
+    w->cap_dense_rows = 0;
+    if (w->col_first == NULL || w->col_last == NULL || w->col_len == NULL || w->row_idx == NULL ||
+        w->row_v == NULL) {
+        LSMatWriter_destroy(w);
+        return LSMAT_E_GEN;
+    }
+    return LSMAT_OK;
+}
+
+lsmat_errno_t LSMatWriter_destroy(LSMatWriter_t *restrict w) {
+    if (w == NULL) {
+        return LSMAT_E_GEN;
+    }
+    LSMatArena_destroy(&w->arena);
+    free(w->col_first);
+    free(w->col_last);
+    free(w->col_len);
+    free(w->row_idx);
+    free(w->row_v);
+    free(w->dense_rows);
+    w->col_first = w->col_last = NULL;
+    w->col_len = w->row_idx = w->dense_rows = NULL;
+    w->row_v = NULL;
     return LSMAT_OK;
 }
 
+lsmat_errno_t LSMatWriter_put(LSMatWriter_t *restrict w, size_t j, double v) {
+    if (v == 0.) {
+        return LSMAT_OK;
+    }
+    if (j >= w->mat->shape[LSMAT_AXIS_1] || (w->row_len > 0 && w->row_idx[w->row_len - 1] >= j)) {
+        return LSMAT_E_GEN;
+    }
+    w->row_idx[w->row_len] = j;
+    w->row_v[w->row_len] = v;
+    w->row_len++;
+    return LSMAT_OK;
+}
+
+lsmat_errno_t LSMatWriter_end_row(LSMatWriter_t *restrict w, size_t i) {
+    LSMat_t *const mat = w->mat;
+    const size_t n = w->row_len;
+    w->row_len = 0;
+    if (n == 0) {
+        return LSMAT_OK;
+    }
+    if (i >= mat->shape[LSMAT_AXIS_0]) {
+        return LSMAT_E_GEN;
+    }
+    // Writers only ever fill rows of a freshly zeroed matrix.
+    LSMatHead_t *const head = mat->heads[LSMAT_AXIS_0] + i;
+    if (head->first_cell != NULL || head->dense != NULL) {
+        return LSMAT_E_GEN;
+    }
+    if (LSMat_row_wants_dense_(mat, n)) {
+        if (w->n_dense_rows == w->cap_dense_rows) {
+            const size_t cap = w->cap_dense_rows == 0 ? 8 : w->cap_dense_rows * 2;
+            size_t *const rows = realloc(w->dense_rows, cap * sizeof(size_t));
+            if (rows == NULL) {
+                return LSMAT_E_GEN;
+            }
+            w->dense_rows = rows;
+            w->cap_dense_rows = cap;
+        }
+        double *const dense = lsmem_calloc_(mat->shape[LSMAT_AXIS_1], sizeof(double));
+        if (dense == NULL) {
+            return LSMAT_E_GEN;
+        }
+        for (size_t k = 0; k < n; k++) {
+            dense[w->row_idx[k]] = w->row_v[k];
+        }
+        head->dense = dense;
+        head->len = n;
+        w->dense_rows[w->n_dense_rows++] = i;
+        return LSMAT_OK;
+    }
+    LSMatCell_t *prec = NULL;
+    for (size_t k = 0; k < n; k++) {
+        const size_t j = w->row_idx[k];
+        LSMatCell_t *const cell = LSMatArena_alloc(&w->arena);
+        if (cell == NULL) {
+            return LSMAT_E_GEN;
+        }
+        LSMatCell_set_idx(cell, LSMAT_AXIS_0, i);
+        LSMatCell_set_idx(cell, LSMAT_AXIS_1, j);
+        cell->v = w->row_v[k];
+        // The row is linked in one go below, so that its index, if any, is
+        // built in a single pass instead of one search per cell.
+        LSMatCell_link_prec_(cell, LSMAT_AXIS_1, prec);
+        if (prec != NULL) {
+            *LSMatCell_ref_succ_of(prec, LSMAT_AXIS_1) = cell;
+        } else {
+            head->first_cell = cell;
+        }
+        prec = cell;
+        // Columns are only collected here; LSMat_stitch links them into the
+        // matrix once all writers are done.
+        LSMatCell_link_prec_(cell, LSMAT_AXIS_0, w->col_last[j]);
+        if (w->col_last[j] != NULL) {
+            *LSMatCell_ref_succ_of(w->col_last[j], LSMAT_AXIS_0) = cell;
+        } else {
+            w->col_first[j] = cell;
+        }
+        w->col_last[j] = cell;
+        w->col_len[j]++;
+    }
+    head->last_cell = prec;
+    head->len = n;
+    if (n >= SKIP_BUILD_LEN_) {
+        LSMatHead_build_index_(head, LSMAT_AXIS_1);
+    }
+    return LSMAT_OK;
+}
+
+lsmat_errno_t LSMat_stitch(LSMat_t *restrict mat, const LSMatWriter_t *restrict writers,
+                           size_t n_writers, size_t col_begin, size_t col_end) {
+    LSPROF_FN_();
+    if (mat == NULL || writers == NULL || col_end > mat->shape[LSMAT_AXIS_1]) {
+        return LSMAT_E_GEN;
+    }
+    for (size_t j = col_begin; j < col_end; j++) {
+        LSMatHead_t *const head = mat->heads[LSMAT_AXIS_1] + j;
+        for (size_t k = 0; k < n_writers; k++) {
+            LSMatCell_t *const first = writers[k].col_first[j];
+            if (first == NULL) {
+                continue;
+            }
+            LSMatCell_link_prec_(first, LSMAT_AXIS_0, head->last_cell);
+            if (head->last_cell != NULL) {
+                *LSMatCell_ref_succ_of(head->last_cell, LSMAT_AXIS_0) = first;
+            } else {
+                head->first_cell = first;
+            }
+            head->last_cell = writers[k].col_last[j];
+            head->len += writers[k].col_len[j];
+        }
+        if (head->index == NULL && head->len >= SKIP_BUILD_LEN_) {
+            LSMatHead_build_index_(head, LSMAT_AXIS_0);
+        }
+    }
+    return LSMAT_OK;
+}
+
+lsmat_errno_t LSMat_adopt(LSMat_t *restrict mat, LSMatWriter_t *restrict writers,
+                          size_t n_writers) {
+    LSPROF_FN_();
+    if (mat == NULL || writers == NULL) {
+        return LSMAT_E_GEN;
+    }
+    mat->version++;
+    lsmat_errno_t err = LSMAT_OK;
+    for (size_t k = 0; k < n_writers; k++) {
+        LSMatArena_adopt(&mat->arena, &writers[k].arena);
+        for (size_t r = 0; r < writers[k].n_dense_rows; r++) {
+            if (LSMat_dense_rows_add_(mat, writers[k].dense_rows[r]) != LSMAT_OK) {
+                err = LSMAT_E_GEN;
+            }
+        }
+        LSMatWriter_destroy(writers + k);
+    }
+    return err;
+}
+
 LSMatView_t LSMatView_from(LSMat_t *restrict mat) {
     LSMatView_t v;
     for (size_t i = 0; i < LSMAT_AXIS_COUNT_; i++) {
@@ -270,25 +1282,40 @@ lsmat_errno_t LSMatView_set(const LSMatView_t view, size_t i_0, size_t i_1, doub
                      indices[view.axes_mapping[LSMAT_AXIS_1]], v);
 }
 
+void LSMatIter_init_view(LSMatIter_t *restrict it, const LSMatView_t view, lsmat_axis_t axis,
+                         size_t line) {
+    LSMatIter_init(it, view.mat, view.axes_mapping[axis], line);
+}
+
 LSMat_t *LSMatView_realize(const LSMatView_t view) {
-    bool done = false;
-    size_t counters[LSMAT_AXIS_COUNT_] = {0};
-    LSMat_t *new_mat = LSMat_new(view.mat->shape[view.axes_mapping[LSMAT_AXIS_0]],
-                                 view.mat->shape[view.axes_mapping[LSMAT_AXIS_1]]);
-    while (!done) {
-        LSMat_set(new_mat, counters[view.axes_mapping[LSMAT_AXIS_0]],
-                  counters[view.axes_mapping[LSMAT_AXIS_1]],
-                  LSMat_at(view.mat, counters[LSMAT_AXIS_0], counters[LSMAT_AXIS_1]));
-        for (size_t i = 0; i < LSMAT_AXIS_COUNT_; i++) {
-            counters[view.axes_mapping[i]]++;
-            if (counters[view.axes_mapping[i]] < view.mat->shape[view.axes_mapping[i]]) {
-                break;
-            } else if (i == LSMAT_AXIS_COUNT_ - 1) {
-                done = true;
-            } else {
-                counters[view.axes_mapping[i]] = 0;
-            }
+    LSPROF_FN_();
+    LSMat_t *new_mat =
+        LSMat_new(LSMatView_shape_of(view, LSMAT_AXIS_0), LSMatView_shape_of(view, LSMAT_AXIS_1));
+    if (new_mat == NULL) {
+        return NULL;
+    }
+    LSMatWriter_t w;
+    if (LSMatWriter_init(&w, new_mat) != LSMAT_OK) {
+        LSMat_free(new_mat);
+        return NULL;
+    }
+    // Walking the source along the view's rows yields the cells in the order
+    // the new matrix wants them, whichever axis that is in the source.
+    bool ok = true;
+    for (size_t i = 0; ok && i < new_mat->shape[LSMAT_AXIS_0]; i++) {
+        LSMatIter_t it;
+        LSMatIter_init_view(&it, view, LSMAT_AXIS_0, i);
+        size_t j = 0;
+        double v = 0.;
+        while (ok && LSMatIter_next(&it, &j, &v)) {
+            ok = LSMatWriter_put(&w, j, v) == LSMAT_OK;
         }
+        ok = ok && LSMatWriter_end_row(&w, i) == LSMAT_OK;
+    }
+    LSMat_stitch(new_mat, &w, 1, 0, new_mat->shape[LSMAT_AXIS_1]);
+    if (LSMat_adopt(new_mat, &w, 1) != LSMAT_OK || !ok) {
+        LSMat_free(new_mat);
+        return NULL;
     }
     return new_mat;
 }
@@ -0,0 +1,46 @@
+#ifndef LSMEM_H_INCLUDED_
+#define LSMEM_H_INCLUDED_
+
+#include "lsmat/lsmat.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+
+// Hooks may be swapped while workers allocate; each call loads them once.
+static inline void lsmem_hook_alloc_(void *ptr) {
+    const lsmat_alloc_hook_t hook = atomic_load_explicit(&lsmat_alloc_hook_, memory_order_acquire);
+    if (hook != NULL) {
+        hook(ptr);
+    }
+}
+
+static inline void lsmem_hook_free_(void *ptr) {
+    const lsmat_free_hook_t hook = atomic_load_explicit(&lsmat_free_hook_, memory_order_acquire);
+    if (hook != NULL) {
+        hook(ptr);
+    }
+}
+
+#define FREE_NULLIFY_(ptr_)                                                                        \
+    do {                                                                                           \
+        lsmem_hook_free_((ptr_));                                                                  \
+        free((ptr_));                                                                              \
+        (ptr_) = NULL;                                                                             \
+    } while (0)
+
+static inline void *lsmem_malloc_(size_t size) {
+    void *const ptr = malloc(size);
+    if (ptr != NULL) {
+        lsmem_hook_alloc_(ptr);
+    }
+    return ptr;
+}
+
+static inline void *lsmem_calloc_(size_t n, size_t size) {
+    void *const ptr = calloc(n, size);
+    if (ptr != NULL) {
+        lsmem_hook_alloc_(ptr);
+    }
+    return ptr;
+}
+
+#endif /* LSMEM_H_INCLUDED_ */
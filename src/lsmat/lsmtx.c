@@ -0,0 +1,560 @@
+#include "lsmat/lsmtx.h"
+#include "lsfile.h"
+#include "lsmat/lsarith.h"
+#include "lsmat/lsmat.h"
+#include "lsthreads.h"
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MTX_CHUNK_BYTES_ ((size_t)4 << 20)
+#define MTX_CHUNKS_PER_THREAD_ 4u
+#define MTX_BLOCK_ENTRIES_ ((size_t)1 << 15)
+#define MTX_BLOCKS_PER_THREAD_ 2u
+#define MTX_MAX_TOKEN_ 64u
+// "<i> <j> <v>\n" with 20-digit indices and a %.17g value.
+#define MTX_MAX_LINE_ 72u
+
+typedef enum LSMtxSymmetry_ {
+    MTX_GENERAL_,
+    MTX_SYMMETRIC_,
+    MTX_SKEW_,
+} LSMtxSymmetry_t;
+
+typedef struct LSMtxHeader_ {
+    size_t shape[LSMAT_AXIS_COUNT_];
+    size_t nnz;
+    bool pattern;
+    LSMtxSymmetry_t symmetry;
+} LSMtxHeader_t;
+
+/*
+ * The body is cut into chunks at line boundaries. Chunks are parsed in
+ * waves, and each wave is appended to the triplets before the next one
+ * starts, so the chunk buffers are reused throughout.
+ */
+typedef struct LSMtxChunk_ {
+    const char *begin;
+    const char *end;
+    size_t *i_0;
+    size_t *i_1;
+    double *v;
+    size_t n;
+    size_t cap;
+    size_t n_lines;
+    bool failed;
+} LSMtxChunk_t;
+
+typedef struct LSMtxRead_ {
+    const LSMtxHeader_t *header;
+    LSMtxChunk_t *chunks;
+} LSMtxRead_t;
+
+static const double POW10_[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static bool LSMtx_is_blank_(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool LSMtx_ends_token_(const char *p, const char *end) {
+    return p == end || LSMtx_is_blank_(*p) || *p == '\n';
+}
+
+static const char *LSMtx_skip_blanks_(const char *p, const char *end) {
+    while (p < end && LSMtx_is_blank_(*p)) {
+        p++;
+    }
+    return p;
+}
+
+static const char *LSMtx_next_line_(const char *p, const char *end) {
+    const char *const nl = memchr(p, '\n', (size_t)(end - p));
+    return nl != NULL ? nl + 1 : end;
+}
+
+static const char *LSMtx_parse_u64_(const char *p, const char *end, uint64_t *restrict out) {
+    uint64_t x = 0;
+    const char *const start = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        const uint64_t d = (uint64_t)(*p - '0');
+        if (x > (UINT64_MAX - d) / 10) {
+            return NULL;
+        }
+        x = x * 10 + d;
+        p++;
+    }
+    if (p == start || !LSMtx_ends_token_(p, end)) {
+        return NULL;
+    }
+    *out = x;
+    return p;
+}
+
+static const char *LSMtx_parse_f64_slow_(const char *p, const char *end, double *restrict out) {
+    const char *q = p;
+    while (!LSMtx_ends_token_(q, end)) {
+        q++;
+    }
+    const size_t len = (size_t)(q - p);
+    if (len == 0) {
+        return NULL;
+    }
+    // strtod needs a terminated copy; long tokens are rare enough for the heap.
+    char small[MTX_MAX_TOKEN_];
+    char *const buf = len < sizeof(small) ? small : malloc(len + 1);
+    if (buf == NULL) {
+        return NULL;
+    }
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    char *stop = NULL;
+    *out = strtod(buf, &stop);
+    const bool ok = stop == buf + len;
+    if (buf != small) {
+        free(buf);
+    }
+    return ok ? q : NULL;
+}
+
+/*
+ * Decimal mantissas below 2^53 scaled by at most 10^22 are exact in a double,
+ * so one multiplication or division rounds correctly; everything else goes
+ * to strtod.
+ */
+static const char *LSMtx_parse_f64_(const char *p, const char *end, double *restrict out) {
+    const char *const start = p;
+    const bool neg = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+    uint64_t m = 0;
+    int e10 = 0;
+    bool any = false;
+    bool exact = true;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        any = true;
+        if (m < UINT64_MAX / 10 - 1) {
+            m = m * 10 + (uint64_t)(*p - '0');
+        } else {
+            e10++;
+            exact = exact && *p == '0';
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            any = true;
+            if (m < UINT64_MAX / 10 - 1) {
+                m = m * 10 + (uint64_t)(*p - '0');
+                e10--;
+            } else {
+                exact = exact && *p == '0';
+            }
+        }
+    }
+    if (any && p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        const bool neg_exp = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) {
+            p++;
+        }
+        int x = 0;
+        const char *const digits = p;
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            x = x < 10000 ? x * 10 + (*p - '0') : x;
+        }
+        if (p == digits) {
+            return NULL;
+        }
+        e10 += neg_exp ? -x : x;
+    }
+    if (!any || !LSMtx_ends_token_(p, end) || !exact || m > ((uint64_t)1 << 53) || e10 < -22 ||
+        e10 > 22) {
+        return LSMtx_parse_f64_slow_(start, end, out);
+    }
+    const double v = e10 < 0 ? (double)m / POW10_[-e10] : (double)m * POW10_[e10];
+    *out = neg ? -v : v;
+    return p;
+}
+
+static bool LSMtx_chunk_push_(LSMtxChunk_t *restrict c, size_t i, size_t j, double v) {
+    if (c->n == c->cap) {
+        const size_t cap = c->cap > 0 ? c->cap * 2 : 1024;
+        size_t *const i_0 = realloc(c->i_0, cap * sizeof(size_t));
+        if (i_0 != NULL) {
+            c->i_0 = i_0;
+        }
+        size_t *const i_1 = realloc(c->i_1, cap * sizeof(size_t));
+        if (i_1 != NULL) {
+            c->i_1 = i_1;
+        }
+        double *const vs = realloc(c->v, cap * sizeof(double));
+        if (vs != NULL) {
+            c->v = vs;
+        }
+        if (i_0 == NULL || i_1 == NULL || vs == NULL) {
+            return false;
+        }
+        c->cap = cap;
+    }
+    c->i_0[c->n] = i;
+    c->i_1[c->n] = j;
+    c->v[c->n] = v;
+    c->n++;
+    return true;
+}
+
+static bool LSMtx_parse_line_(const LSMtxHeader_t *restrict h, LSMtxChunk_t *restrict c,
+                              const char *restrict p, const char *restrict end) {
+    uint64_t i = 0;
+    uint64_t j = 0;
+    double v = 1.;
+    p = LSMtx_parse_u64_(p, end, &i);
+    p = p != NULL ? LSMtx_parse_u64_(LSMtx_skip_blanks_(p, end), end, &j) : NULL;
+    if (p != NULL && !h->pattern) {
+        p = LSMtx_parse_f64_(LSMtx_skip_blanks_(p, end), end, &v);
+    }
+    if (p == NULL || LSMtx_skip_blanks_(p, end) != end || i == 0 || j == 0 ||
+        i > h->shape[LSMAT_AXIS_0] || j > h->shape[LSMAT_AXIS_1]) {
+        return false;
+    }
+    c->n_lines++;
+    if (!LSMtx_chunk_push_(c, i - 1, j - 1, v)) {
+        return false;
+    }
+    // Only one triangle is stored for symmetric matrices.
+    if (h->symmetry != MTX_GENERAL_ && i != j) {
+        return LSMtx_chunk_push_(c, j - 1, i - 1, h->symmetry == MTX_SKEW_ ? -v : v);
+    }
+    return true;
+}
+
+static void LSMtx_parse_task_(void *ctx, size_t task) {
+    const LSMtxRead_t *const rd = ctx;
+    LSMtxChunk_t *const c = rd->chunks + task;
+    const char *p = c->begin;
+    while (p < c->end) {
+        const char *const next = LSMtx_next_line_(p, c->end);
+        const char *const line = LSMtx_skip_blanks_(p, next);
+        const char *line_end = next;
+        if (line_end > line && line_end[-1] == '\n') {
+            line_end--;
+        }
+        if (line < line_end && *line != '%' && !LSMtx_parse_line_(rd->header, c, line, line_end)) {
+            c->failed = true;
+            return;
+        }
+        p = next;
+    }
+}
+
+static bool LSMtx_parse_header_(const char *p, const char *end, LSMtxHeader_t *restrict h,
+                                const char **restrict out_body) {
+    const char *next = LSMtx_next_line_(p, end);
+    char banner[256];
+    const size_t len = (size_t)(next - p) < sizeof(banner) ? (size_t)(next - p) : sizeof(banner) - 1;
+    for (size_t k = 0; k < len; k++) {
+        banner[k] = (char)tolower((unsigned char)p[k]);
+    }
+    banner[len] = '\0';
+    char object[32];
+    char format[32];
+    char field[32];
+    char symmetry[32];
+    if (sscanf(banner, "%%%%matrixmarket %31s %31s %31s %31s", object, format, field, symmetry) !=
+            4 ||
+        strcmp(object, "matrix") != 0 || strcmp(format, "coordinate") != 0) {
+        return false;
+    }
+    if (strcmp(field, "pattern") == 0) {
+        h->pattern = true;
+    } else if (strcmp(field, "real") == 0 || strcmp(field, "double") == 0 ||
+               strcmp(field, "integer") == 0) {
+        h->pattern = false;
+    } else {
+        return false;
+    }
+    if (strcmp(symmetry, "general") == 0) {
+        h->symmetry = MTX_GENERAL_;
+    } else if (strcmp(symmetry, "symmetric") == 0) {
+        h->symmetry = MTX_SYMMETRIC_;
+    } else if (strcmp(symmetry, "skew-symmetric") == 0) {
+        h->symmetry = MTX_SKEW_;
+    } else {
+        return false;
+    }
+    // Comments and blank lines may come before the size line.
+    for (p = next; p < end; p = next) {
+        next = LSMtx_next_line_(p, end);
+        const char *const line = LSMtx_skip_blanks_(p, next);
+        if (line < next && *line != '%' && *line != '\n') {
+            break;
+        }
+    }
+    uint64_t dims[3];
+    const char *q = LSMtx_skip_blanks_(p, next);
+    for (size_t k = 0; k < 3; k++) {
+        q = q != NULL ? LSMtx_parse_u64_(LSMtx_skip_blanks_(q, next), next, dims + k) : NULL;
+    }
+    if (q == NULL || (h->symmetry != MTX_GENERAL_ && dims[0] != dims[1])) {
+        return false;
+    }
+    h->shape[LSMAT_AXIS_0] = dims[0];
+    h->shape[LSMAT_AXIS_1] = dims[1];
+    h->nnz = dims[2];
+    *out_body = next;
+    return true;
+}
+
+static bool LSMtx_append_(size_t *restrict *restrict i_0, size_t *restrict *restrict i_1,
+                          double *restrict *restrict v, size_t *restrict n,
+                          size_t *restrict cap, const LSMtxChunk_t *restrict c) {
+    if (*n + c->n > *cap) {
+        const size_t cap_new = *n + c->n > 2 * *cap ? *n + c->n : 2 * *cap;
+        size_t *const t_0 = realloc(*i_0, cap_new * sizeof(size_t));
+        if (t_0 != NULL) {
+            *i_0 = t_0;
+        }
+        size_t *const t_1 = realloc(*i_1, cap_new * sizeof(size_t));
+        if (t_1 != NULL) {
+            *i_1 = t_1;
+        }
+        double *const t_v = realloc(*v, cap_new * sizeof(double));
+        if (t_v != NULL) {
+            *v = t_v;
+        }
+        if (t_0 == NULL || t_1 == NULL || t_v == NULL) {
+            return false;
+        }
+        *cap = cap_new;
+    }
+    memcpy(*i_0 + *n, c->i_0, c->n * sizeof(size_t));
+    memcpy(*i_1 + *n, c->i_1, c->n * sizeof(size_t));
+    memcpy(*v + *n, c->v, c->n * sizeof(double));
+    *n += c->n;
+    return true;
+}
+
+LSMat_t *LSMat_read_mtx(const char *restrict path, lsmtx_progress_t progress, void *ctx,
+                        LSMatMtxStats_t *restrict stats) {
+    if (path == NULL) {
+        return NULL;
+    }
+    size_t len = 0;
+    const char *const map = LSFile_map(path, &len);
+    if (map == NULL) {
+        return NULL;
+    }
+    const char *const end = map + len;
+    LSMtxHeader_t header;
+    const char *body = NULL;
+    if (!LSMtx_parse_header_(map, end, &header, &body) ||
+        header.nnz > SIZE_MAX / sizeof(size_t) / 2) {
+        LSFile_unmap((void *)map, len);
+        return NULL;
+    }
+    const size_t n_threads = LSArith_threads();
+    const size_t n_chunks = n_threads * MTX_CHUNKS_PER_THREAD_;
+    LSMtxChunk_t *const chunks = calloc(n_chunks, sizeof(LSMtxChunk_t));
+    LSMtxRead_t rd = {.header = &header, .chunks = chunks};
+    // Symmetric files expand to up to twice their entries. The count comes
+    // from the file, so the body bounds it before it sizes anything: every
+    // entry line takes at least four bytes.
+    const size_t n_fit = (size_t)(end - body) / 4;
+    size_t cap = header.nnz < n_fit ? header.nnz : n_fit;
+    cap = header.symmetry == MTX_GENERAL_ ? cap : 2 * cap;
+    cap = cap > 0 ? cap : 1;
+    size_t *i_0 = malloc(cap * sizeof(size_t));
+    size_t *i_1 = malloc(cap * sizeof(size_t));
+    double *v = malloc(cap * sizeof(double));
+    size_t n = 0;
+    size_t n_lines = 0;
+    bool ok = chunks != NULL && i_0 != NULL && i_1 != NULL && v != NULL;
+    const char *cursor = body;
+    while (ok && cursor < end) {
+        size_t n_used = 0;
+        for (; n_used < n_chunks && cursor < end; n_used++) {
+            const char *const stop = (size_t)(end - cursor) > MTX_CHUNK_BYTES_
+                                         ? LSMtx_next_line_(cursor + MTX_CHUNK_BYTES_, end)
+                                         : end;
+            chunks[n_used].begin = cursor;
+            chunks[n_used].end = stop;
+            chunks[n_used].n = 0;
+            chunks[n_used].n_lines = 0;
+            cursor = stop;
+        }
+        LSThreads_run(n_threads, n_used, LSMtx_parse_task_, &rd);
+        for (size_t k = 0; ok && k < n_used; k++) {
+            ok = !chunks[k].failed && LSMtx_append_(&i_0, &i_1, &v, &n, &cap, chunks + k);
+            n_lines += chunks[k].n_lines;
+        }
+        if (progress != NULL) {
+            progress(ctx, (size_t)(cursor - body), (size_t)(end - body));
+        }
+    }
+    if (chunks != NULL) {
+        for (size_t k = 0; k < n_chunks; k++) {
+            free(chunks[k].i_0);
+            free(chunks[k].i_1);
+            free(chunks[k].v);
+        }
+    }
+    free(chunks);
+    LSFile_unmap((void *)map, len);
+    LSMat_t *mat = NULL;
+    if (ok && n_lines == header.nnz) {
+        mat = LSMat_new(header.shape[LSMAT_AXIS_0], header.shape[LSMAT_AXIS_1]);
+    }
+    // Entries may come in any order; the builder sorts them and sums duplicates.
+    if (mat != NULL && LSMat_build(mat, i_0, i_1, v, n, LSMAT_DUP_SUM) != LSMAT_OK) {
+        LSMat_free(mat);
+        mat = NULL;
+    }
+    free(i_0);
+    free(i_1);
+    free(v);
+    if (mat != NULL && stats != NULL) {
+        stats->bytes = len;
+        stats->entries = n_lines;
+    }
+    return mat;
+}
+
+typedef struct LSMtxBlock_ {
+    size_t row_begin;
+    size_t row_end;
+    char *buf;
+    size_t len;
+} LSMtxBlock_t;
+
+typedef struct LSMtxWrite_ {
+    const LSMat_t *mat;
+    LSMtxBlock_t *blocks;
+} LSMtxWrite_t;
+
+static char *LSMtx_format_u64_(char *p, uint64_t x) {
+    char tmp[20];
+    size_t n = 0;
+    do {
+        tmp[n++] = (char)('0' + x % 10);
+        x /= 10;
+    } while (x > 0);
+    while (n > 0) {
+        *p++ = tmp[--n];
+    }
+    return p;
+}
+
+// Shortest of %.15g and %.17g that reads back as the same value.
+static char *LSMtx_format_f64_(char *p, double v) {
+    int n = snprintf(p, 32, "%.15g", v);
+    if (strtod(p, NULL) != v) {
+        n = snprintf(p, 32, "%.17g", v);
+    }
+    return p + n;
+}
+
+static void LSMtx_format_task_(void *ctx, size_t task) {
+    const LSMtxWrite_t *const wr = ctx;
+    LSMtxBlock_t *const b = wr->blocks + task;
+    char *p = b->buf;
+    for (size_t i = b->row_begin; i < b->row_end; i++) {
+        LSMatIter_t it;
+        LSMatIter_init(&it, wr->mat, LSMAT_AXIS_0, i);
+        size_t j = 0;
+        double v = 0.;
+        while (LSMatIter_next(&it, &j, &v)) {
+            p = LSMtx_format_u64_(p, i + 1);
+            *p++ = ' ';
+            p = LSMtx_format_u64_(p, j + 1);
+            *p++ = ' ';
+            p = LSMtx_format_f64_(p, v);
+            *p++ = '\n';
+        }
+    }
+    b->len = (size_t)(p - b->buf);
+}
+
+/*
+ * Rows are formatted in blocks of about MTX_BLOCK_ENTRIES_ entries, a wave
+ * of blocks at a time, and written out in order.
+ */
+lsmat_errno_t LSMat_write_mtx(const LSMat_t *restrict mat, const char *restrict path,
+                              lsmtx_progress_t progress, void *ctx,
+                              LSMatMtxStats_t *restrict stats) {
+    if (mat == NULL || path == NULL) {
+        return LSMAT_E_GEN;
+    }
+    size_t nnz = 0;
+    for (size_t i = 0; i < mat->shape[LSMAT_AXIS_0]; i++) {
+        nnz += mat->heads[LSMAT_AXIS_0][i].len;
+    }
+    // As with CSR files, the target may be mapped; replace it whole.
+    char *tmp = NULL;
+    FILE *const f = LSFile_open_replacement(path, &tmp);
+    if (f == NULL) {
+        return LSMAT_E_GEN;
+    }
+    const size_t n_threads = LSArith_threads();
+    const size_t n_blocks = n_threads * MTX_BLOCKS_PER_THREAD_;
+    LSMtxBlock_t *const blocks = calloc(n_blocks, sizeof(LSMtxBlock_t));
+    LSMtxWrite_t wr = {.mat = mat, .blocks = blocks};
+    size_t bytes = 0;
+    bool ok = blocks != NULL;
+    if (ok) {
+        const int n = fprintf(f, "%%%%MatrixMarket matrix coordinate real general\n%zu %zu %zu\n",
+                              mat->shape[LSMAT_AXIS_0], mat->shape[LSMAT_AXIS_1], nnz);
+        ok = n > 0;
+        bytes += ok ? (size_t)n : 0;
+    }
+    size_t row = 0;
+    size_t done = 0;
+    while (ok && row < mat->shape[LSMAT_AXIS_0]) {
+        size_t n_used = 0;
+        for (; ok && n_used < n_blocks && row < mat->shape[LSMAT_AXIS_0]; n_used++) {
+            LSMtxBlock_t *const b = blocks + n_used;
+            size_t n_entries = 0;
+            b->row_begin = row;
+            // A block holds at least one row, however long.
+            do {
+                n_entries += mat->heads[LSMAT_AXIS_0][row++].len;
+            } while (row < mat->shape[LSMAT_AXIS_0] && n_entries < MTX_BLOCK_ENTRIES_ &&
+                     n_entries + mat->heads[LSMAT_AXIS_0][row].len <= MTX_BLOCK_ENTRIES_);
+            b->row_end = row;
+            free(b->buf);
+            b->buf = malloc(n_entries * MTX_MAX_LINE_ + 1);
+            ok = b->buf != NULL;
+            done += n_entries;
+        }
+        if (!ok) {
+            break;
+        }
+        LSThreads_run(n_threads, n_used, LSMtx_format_task_, &wr);
+        for (size_t k = 0; ok && k < n_used; k++) {
+            ok = fwrite(blocks[k].buf, 1, blocks[k].len, f) == blocks[k].len;
+            bytes += blocks[k].len;
+        }
+        if (progress != NULL) {
+            progress(ctx, done, nnz);
+        }
+    }
+    if (blocks != NULL) {
+        for (size_t k = 0; k < n_blocks; k++) {
+            free(blocks[k].buf);
+        }
+    }
+    free(blocks);
+    if (!LSFile_commit_replacement(f, tmp, path, ok)) {
+        ok = false;
+    }
+    if (ok && stats != NULL) {
+        stats->bytes = bytes;
+        stats->entries = nnz;
+    }
+    return ok ? LSMAT_OK : LSMAT_E_GEN;
+}
@@ -0,0 +1,57 @@
+#ifndef LSPROBE_H_INCLUDED_
+#define LSPROBE_H_INCLUDED_
+
+#include "lsmat/lsprof.h"
+
+#ifdef LSMAT_PROF
+
+#if !defined(__GNUC__) && !defined(__clang__)
+#error "LSMAT_PROF needs the cleanup attribute of GCC or Clang"
+#endif
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * One per instrumented function, linked into a global list on the first
+ * call that finishes.
+ */
+typedef struct LSProfProbe_ {
+    const char *name;
+    struct LSProfProbe_ *next;
+    atomic_bool linked;
+    atomic_uint_least64_t calls;
+    atomic_uint_least64_t total_ns;
+    atomic_uint_least64_t max_ns;
+    atomic_uint_least64_t hist[LSPROF_BUCKETS];
+} LSProfProbe_t;
+
+typedef struct LSProfScope_ {
+    LSProfProbe_t *probe;
+    uint64_t t0;
+} LSProfScope_t;
+
+extern atomic_uint_least64_t lsprof_counters_[LSPROF_COUNTER_COUNT_];
+
+uint64_t LSProf_now_(void);
+void LSProf_leave_(LSProfScope_t *scope);
+
+#define LSPROF_ADD_(counter_, n_)                                                                  \
+    atomic_fetch_add_explicit(lsprof_counters_ + (counter_), (n_), memory_order_relaxed)
+
+// Times the enclosing function up to whichever return leaves it.
+#define LSPROF_FN_()                                                                               \
+    static LSProfProbe_t lsprof_probe_ = {.name = __func__};                                       \
+    __attribute__((cleanup(LSProf_leave_))) LSProfScope_t lsprof_scope_ = {                        \
+        .probe = &lsprof_probe_,                                                                   \
+        .t0 = LSProf_now_(),                                                                       \
+    }
+
+#else
+
+#define LSPROF_ADD_(counter_, n_) ((void)(n_))
+#define LSPROF_FN_() ((void)0)
+
+#endif
+
+#endif /* LSPROBE_H_INCLUDED_ */
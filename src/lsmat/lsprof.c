@@ -0,0 +1,125 @@
+#include "lsmat/lsprof.h"
+#include "lsprobe.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const char *const counter_names_[LSPROF_COUNTER_COUNT_] = {
+    [LSPROF_CELLS_TRAVERSED] = "cells_traversed",
+    [LSPROF_CELL_ALLOCS] = "cell_allocs",
+    [LSPROF_SLAB_ALLOCS] = "slab_allocs",
+    [LSPROF_INSERTS] = "inserts",
+    [LSPROF_REMOVALS] = "removals",
+    [LSPROF_MERGE_STEPS] = "merge_steps",
+};
+
+const char *LSProf_counter_name(lsprof_counter_t counter) {
+    return counter < LSPROF_COUNTER_COUNT_ ? counter_names_[counter] : NULL;
+}
+
+uint64_t LSProf_bucket_floor(size_t bucket) {
+    return bucket == 0 ? 0 : (uint64_t)1 << bucket;
+}
+
+#ifdef LSMAT_PROF
+
+atomic_uint_least64_t lsprof_counters_[LSPROF_COUNTER_COUNT_];
+
+static _Atomic(LSProfProbe_t *) probes_ = NULL;
+
+uint64_t LSProf_now_(void) {
+    struct timespec t;
+    timespec_get(&t, TIME_UTC);
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+static size_t LSProf_bucket_of_(uint64_t ns) {
+    // Bucket b holds [2^b, 2^(b + 1)); the first one also takes 0.
+    const size_t b = ns < 2 ? 0 : 63 - (size_t)__builtin_clzll(ns);
+    return b < LSPROF_BUCKETS ? b : LSPROF_BUCKETS - 1;
+}
+
+void LSProf_leave_(LSProfScope_t *scope) {
+    LSProfProbe_t *const probe = scope->probe;
+    const uint64_t ns = LSProf_now_() - scope->t0;
+    atomic_fetch_add_explicit(&probe->calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&probe->total_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(probe->hist + LSProf_bucket_of_(ns), 1, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&probe->max_ns, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&probe->max_ns, &max, ns,
+                                                              memory_order_relaxed,
+                                                              memory_order_relaxed)) {
+    }
+    if (!atomic_load_explicit(&probe->linked, memory_order_relaxed) &&
+        !atomic_exchange_explicit(&probe->linked, true, memory_order_relaxed)) {
+        probe->next = atomic_load_explicit(&probes_, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&probes_, &probe->next, probe,
+                                                      memory_order_release, memory_order_relaxed)) {
+        }
+    }
+}
+
+bool LSProf_enabled(void) {
+    return true;
+}
+
+uint64_t LSProf_counter(lsprof_counter_t counter) {
+    if (counter >= LSPROF_COUNTER_COUNT_) {
+        return 0;
+    }
+    return atomic_load_explicit(lsprof_counters_ + counter, memory_order_relaxed);
+}
+
+void LSProf_each_fn(lsprof_visit_t visit, void *ctx) {
+    const LSProfProbe_t *p = atomic_load_explicit(&probes_, memory_order_acquire);
+    for (; p != NULL; p = p->next) {
+        LSProfFn_t fn = {
+            .name = p->name,
+            .calls = atomic_load_explicit(&p->calls, memory_order_relaxed),
+            .total_ns = atomic_load_explicit(&p->total_ns, memory_order_relaxed),
+            .max_ns = atomic_load_explicit(&p->max_ns, memory_order_relaxed),
+        };
+        for (size_t b = 0; b < LSPROF_BUCKETS; b++) {
+            fn.hist[b] = atomic_load_explicit(p->hist + b, memory_order_relaxed);
+        }
+        visit(ctx, &fn);
+    }
+}
+
+void LSProf_reset(void) {
+    for (size_t i = 0; i < LSPROF_COUNTER_COUNT_; i++) {
+        atomic_store_explicit(lsprof_counters_ + i, 0, memory_order_relaxed);
+    }
+    // Probes stay linked; only their numbers start over.
+    LSProfProbe_t *p = atomic_load_explicit(&probes_, memory_order_acquire);
+    for (; p != NULL; p = p->next) {
+        atomic_store_explicit(&p->calls, 0, memory_order_relaxed);
+        atomic_store_explicit(&p->total_ns, 0, memory_order_relaxed);
+        atomic_store_explicit(&p->max_ns, 0, memory_order_relaxed);
+        for (size_t b = 0; b < LSPROF_BUCKETS; b++) {
+            atomic_store_explicit(p->hist + b, 0, memory_order_relaxed);
+        }
+    }
+}
+
+#else
+
+bool LSProf_enabled(void) {
+    return false;
+}
+
+uint64_t LSProf_counter(lsprof_counter_t counter) {
+    (void)counter;
+    return 0;
+}
+
+void LSProf_each_fn(lsprof_visit_t visit, void *ctx) {
+    (void)visit;
+    (void)ctx;
+}
+
+void LSProf_reset(void) {
+}
+
+#endif
@@ -0,0 +1,257 @@
+#include "lsmat/lsrand.h"
+#include "lsmat/lsarith.h"
+#include "lsmat/lsmat.h"
+#include "lsprobe.h"
+#include "lsthreads.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define RAND_GOLDEN_ 0x9e3779b97f4a7c15ull
+
+/*
+ * Rows are split among the writers by expected length; each row draws from
+ * its own stream, so the split has no effect on the result.
+ */
+typedef struct LSRandFill_ {
+    LSMat_t *mat;
+    uint64_t seed;
+    lsrand_pattern_t pattern;
+    double density;
+    double scale;
+    size_t half;
+    size_t n_chunks;
+    size_t *row_split;
+    LSMatWriter_t *writers;
+    atomic_bool failed;
+} LSRandFill_t;
+
+// The splitmix64 finalizer; a bijection, so distinct counters never collide.
+static uint64_t LSRand_mix_(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+void LSRand_init(LSRand_t *restrict rng, uint64_t seed, uint64_t stream) {
+    rng->key = LSRand_mix_(seed ^ LSRand_mix_(stream + RAND_GOLDEN_));
+    rng->counter = 0;
+}
+
+uint64_t LSRand_at(const LSRand_t *restrict rng, uint64_t counter) {
+    return LSRand_mix_(rng->key + (counter + 1) * RAND_GOLDEN_);
+}
+
+uint64_t LSRand_next(LSRand_t *restrict rng) {
+    return LSRand_at(rng, rng->counter++);
+}
+
+// Uniform on (0, 1); neither end is ever hit, so logs and values stay finite and non-zero.
+double LSRand_unit(LSRand_t *restrict rng) {
+    return ((double)(LSRand_next(rng) >> 11) + 0.5) / (double)((uint64_t)1 << 53);
+}
+
+static void LSRandFill_cols_(const LSRandFill_t *restrict fill, size_t i, size_t *restrict lo,
+                             size_t *restrict hi) {
+    const size_t n_cols = fill->mat->shape[LSMAT_AXIS_1];
+    if (fill->pattern != LSRAND_BANDED) {
+        *lo = 0;
+        *hi = n_cols;
+        return;
+    }
+    *lo = i > fill->half ? i - fill->half : 0;
+    *hi = i < n_cols - fill->half ? i + fill->half + 1 : n_cols;
+    *lo = *lo < *hi ? *lo : *hi;
+}
+
+static double LSRandFill_p_(const LSRandFill_t *restrict fill, size_t i) {
+    switch (fill->pattern) {
+    case LSRAND_BANDED:
+        return 1.;
+    case LSRAND_POWERLAW: {
+        const double p = fill->scale / (double)(i + 1);
+        return p < 1. ? p : 1.;
+    }
+    default:
+        return fill->density;
+    }
+}
+
+static bool LSRandFill_row_(const LSRandFill_t *restrict fill, LSMatWriter_t *restrict w,
+                            size_t i) {
+    LSRand_t rng;
+    LSRand_init(&rng, fill->seed, i);
+    size_t lo = 0;
+    size_t hi = 0;
+    LSRandFill_cols_(fill, i, &lo, &hi);
+    const double p = LSRandFill_p_(fill, i);
+    if (p >= 1.) {
+        for (size_t j = lo; j < hi; j++) {
+            if (LSMatWriter_put(w, j, LSRand_unit(&rng)) != LSMAT_OK) {
+                return false;
+            }
+        }
+    } else if (p > 0.) {
+        // Gaps between kept cells are geometric; skipping them keeps the row
+        // sorted and costs O(kept) rather than O(columns).
+        const double log_q = log1p(-p);
+        size_t j = lo;
+        for (;;) {
+            const double gap = floor(log(LSRand_unit(&rng)) / log_q);
+            if (j >= hi || gap >= (double)(hi - j)) {
+                break;
+            }
+            j += (size_t)gap;
+            if (LSMatWriter_put(w, j, LSRand_unit(&rng)) != LSMAT_OK) {
+                return false;
+            }
+            j++;
+        }
+    }
+    return LSMatWriter_end_row(w, i) == LSMAT_OK;
+}
+
+static void LSRandFill_rows_task_(void *ctx, size_t task) {
+    LSRandFill_t *const fill = ctx;
+    LSMatWriter_t *const w = fill->writers + task;
+    for (size_t i = fill->row_split[task]; i < fill->row_split[task + 1]; i++) {
+        if (!LSRandFill_row_(fill, w, i)) {
+            atomic_store(&fill->failed, true);
+            break;
+        }
+    }
+}
+
+static void LSRandFill_stitch_task_(void *ctx, size_t task) {
+    LSRandFill_t *const fill = ctx;
+    const size_t n_cols = fill->mat->shape[LSMAT_AXIS_1];
+    const size_t begin = n_cols * task / fill->n_chunks;
+    const size_t end = n_cols * (task + 1) / fill->n_chunks;
+    LSMat_stitch(fill->mat, fill->writers, fill->n_chunks, begin, end);
+}
+
+static double LSRandFill_cost_(const LSRandFill_t *restrict fill, size_t i) {
+    size_t lo = 0;
+    size_t hi = 0;
+    LSRandFill_cols_(fill, i, &lo, &hi);
+    return LSRandFill_p_(fill, i) * (double)(hi - lo) + 1.;
+}
+
+// Split the rows into chunks of about the same expected number of entries.
+static void LSRandFill_split_(LSRandFill_t *restrict fill) {
+    const size_t n_rows = fill->mat->shape[LSMAT_AXIS_0];
+    double total = 0.;
+    for (size_t i = 0; i < n_rows; i++) {
+        total += LSRandFill_cost_(fill, i);
+    }
+    double acc = 0.;
+    size_t chunk = 1;
+    fill->row_split[0] = 0;
+    for (size_t i = 0; i < n_rows && chunk < fill->n_chunks; i++) {
+        acc += LSRandFill_cost_(fill, i);
+        while (chunk < fill->n_chunks && acc * (double)fill->n_chunks >= total * (double)chunk) {
+            fill->row_split[chunk++] = i + 1;
+        }
+    }
+    while (chunk <= fill->n_chunks) {
+        fill->row_split[chunk++] = n_rows;
+    }
+}
+
+// H(m) = 1 + 1/2 + ... + 1/m; past a few dozen terms the asymptotic series is exact to rounding.
+static double LSRandFill_harmonic_(double m) {
+    if (m < 64.) {
+        double h = 0.;
+        for (double k = 1.; k <= m; k += 1.) {
+            h += 1. / k;
+        }
+        return h;
+    }
+    return log(m) + 0.57721566490153286 + 1. / (2. * m) - 1. / (12. * m * m);
+}
+
+/*
+ * Row i keeps each cell with probability min(1, scale / (i + 1)). The rows
+ * that hit the cap would lose their share, so the scale is searched for
+ * rather than taken from the harmonic sum.
+ */
+static double LSRandFill_powerlaw_scale_(size_t n_rows, double density) {
+    const double n = (double)n_rows;
+    const double target = density * n;
+    const double h_n = LSRandFill_harmonic_(n);
+    double lo = 0.;
+    double hi = n;
+    for (size_t round = 0; round < 64; round++) {
+        const double mid = (lo + hi) / 2.;
+        const double capped = floor(mid) < n ? floor(mid) : n;
+        const double sum = capped + mid * (h_n - LSRandFill_harmonic_(capped));
+        *(sum < target ? &lo : &hi) = mid;
+    }
+    return hi;
+}
+
+lsmat_errno_t LSMat_fill_random(LSMat_t *restrict mat, double density, uint64_t seed,
+                                lsrand_pattern_t pattern) {
+    LSPROF_FN_();
+    if (mat == NULL || !(density >= 0. && density <= 1.) || pattern >= LSRAND_PATTERN_COUNT_) {
+        return LSMAT_E_GEN;
+    }
+    const size_t n_rows = mat->shape[LSMAT_AXIS_0];
+    const size_t n_cols = mat->shape[LSMAT_AXIS_1];
+    LSRandFill_t fill = {
+        .mat = mat,
+        .seed = seed,
+        .pattern = pattern,
+        .density = density,
+        .n_chunks = LSArith_threads(),
+    };
+    if (pattern == LSRAND_BANDED) {
+        // A band of 2 * half + 1 columns covers about density of each row.
+        const double half = (density * (double)n_cols - 1.) / 2.;
+        fill.half = half > 0. ? (size_t)(half + 0.5) : 0;
+        fill.half = fill.half < n_cols ? fill.half : n_cols;
+    } else if (pattern == LSRAND_POWERLAW) {
+        fill.scale = LSRandFill_powerlaw_scale_(n_rows, density);
+    }
+    atomic_init(&fill.failed, false);
+    fill.writers = calloc(fill.n_chunks, sizeof(LSMatWriter_t));
+    fill.row_split = malloc((fill.n_chunks + 1) * sizeof(size_t));
+    if (fill.writers == NULL || fill.row_split == NULL) {
+        free(fill.writers);
+        free(fill.row_split);
+        return LSMAT_E_GEN;
+    }
+    size_t n_writers = 0;
+    while (n_writers < fill.n_chunks &&
+           LSMatWriter_init(fill.writers + n_writers, mat) == LSMAT_OK) {
+        n_writers++;
+    }
+    if (n_writers < fill.n_chunks) {
+        for (size_t k = 0; k < n_writers; k++) {
+            LSMatWriter_destroy(fill.writers + k);
+        }
+        free(fill.writers);
+        free(fill.row_split);
+        return LSMAT_E_GEN;
+    }
+    LSRandFill_split_(&fill);
+    LSMat_zero(mat);
+    LSThreads_run(fill.n_chunks, fill.n_chunks, LSRandFill_rows_task_, &fill);
+    LSThreads_run(fill.n_chunks, fill.n_chunks, LSRandFill_stitch_task_, &fill);
+    // The cells belong to the writers until they are adopted.
+    if (LSMat_adopt(mat, fill.writers, fill.n_chunks) != LSMAT_OK) {
+        atomic_store(&fill.failed, true);
+    }
+    free(fill.writers);
+    free(fill.row_split);
+    if (atomic_load(&fill.failed)) {
+        LSMat_zero(mat);
+        return LSMAT_E_GEN;
+    }
+    return LSMAT_OK;
+}
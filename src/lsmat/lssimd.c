@@ -0,0 +1,222 @@
+#include "lssimd.h"
+#include <stddef.h>
+#include <threads.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LSSIMD_X86_
+#include <immintrin.h>
+#endif
+
+typedef double (*lssimd_dot_t)(const double *restrict, const double *restrict, size_t);
+typedef double (*lssimd_gather_dot_t)(const double *restrict, const size_t *restrict,
+                                      const double *restrict, size_t);
+typedef void (*lssimd_spmm_row_t)(const double *restrict, const size_t *restrict, size_t,
+                                  const double *restrict, size_t, double *restrict);
+
+static double LSSimd_dot_scalar_(const double *restrict a, const double *restrict x, size_t n) {
+    double s0 = 0.;
+    double s1 = 0.;
+    size_t k = 0;
+    for (; k + 2 <= n; k += 2) {
+        s0 += a[k] * x[k];
+        s1 += a[k + 1] * x[k + 1];
+    }
+    if (k < n) {
+        s0 += a[k] * x[k];
+    }
+    return s0 + s1;
+}
+
+static double LSSimd_gather_dot_scalar_(const double *restrict v, const size_t *restrict idx,
+                                        const double *restrict x, size_t n) {
+    double s = 0.;
+    for (size_t k = 0; k < n; k++) {
+        s += v[k] * x[idx[k]];
+    }
+    return s;
+}
+
+static void LSSimd_spmm_row_scalar_(const double *restrict v, const size_t *restrict idx,
+                                    size_t n, const double *restrict x, size_t n_vecs,
+                                    double *restrict y) {
+    for (size_t k = 0; k < n; k++) {
+        const double *const xk = x + idx[k] * n_vecs;
+        for (size_t c = 0; c < n_vecs; c++) {
+            y[c] += v[k] * xk[c];
+        }
+    }
+}
+
+#ifdef LSSIMD_X86_
+__attribute__((target("avx2,fma"))) static double LSSimd_hsum256_(__m256d s) {
+    const __m128d lo = _mm256_castpd256_pd128(s);
+    const __m128d hi = _mm256_extractf128_pd(s, 1);
+    const __m128d p = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(p, _mm_unpackhi_pd(p, p)));
+}
+
+__attribute__((target("avx2,fma"))) static double
+LSSimd_dot_avx2_(const double *restrict a, const double *restrict x, size_t n) {
+    __m256d s0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd();
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + k), _mm256_loadu_pd(x + k), s0);
+        s1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + k + 4), _mm256_loadu_pd(x + k + 4), s1);
+    }
+    double s = LSSimd_hsum256_(_mm256_add_pd(s0, s1));
+    for (; k < n; k++) {
+        s += a[k] * x[k];
+    }
+    return s;
+}
+
+__attribute__((target("avx2,fma"))) static double
+LSSimd_gather_dot_avx2_(const double *restrict v, const size_t *restrict idx,
+                        const double *restrict x, size_t n) {
+    __m256d s = _mm256_setzero_pd();
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        const __m256i j = _mm256_loadu_si256((const __m256i *)(idx + k));
+        s = _mm256_fmadd_pd(_mm256_loadu_pd(v + k), _mm256_i64gather_pd(x, j, 8), s);
+    }
+    double r = LSSimd_hsum256_(s);
+    for (; k < n; k++) {
+        r += v[k] * x[idx[k]];
+    }
+    return r;
+}
+
+/*
+ * The output row is walked in register-sized blocks, each of which stays in
+ * registers over all the entries of the sparse row.
+ */
+__attribute__((target("avx2,fma"))) static void
+LSSimd_spmm_row_avx2_(const double *restrict v, const size_t *restrict idx, size_t n,
+                      const double *restrict x, size_t n_vecs, double *restrict y) {
+    size_t c = 0;
+    for (; c + 8 <= n_vecs; c += 8) {
+        __m256d acc0 = _mm256_loadu_pd(y + c);
+        __m256d acc1 = _mm256_loadu_pd(y + c + 4);
+        for (size_t k = 0; k < n; k++) {
+            const __m256d vk = _mm256_set1_pd(v[k]);
+            const double *const xk = x + idx[k] * n_vecs + c;
+            acc0 = _mm256_fmadd_pd(vk, _mm256_loadu_pd(xk), acc0);
+            acc1 = _mm256_fmadd_pd(vk, _mm256_loadu_pd(xk + 4), acc1);
+        }
+        _mm256_storeu_pd(y + c, acc0);
+        _mm256_storeu_pd(y + c + 4, acc1);
+    }
+    for (; c + 4 <= n_vecs; c += 4) {
+        __m256d acc = _mm256_loadu_pd(y + c);
+        for (size_t k = 0; k < n; k++) {
+            acc = _mm256_fmadd_pd(_mm256_set1_pd(v[k]), _mm256_loadu_pd(x + idx[k] * n_vecs + c),
+                                  acc);
+        }
+        _mm256_storeu_pd(y + c, acc);
+    }
+    for (; c < n_vecs; c++) {
+        double acc = y[c];
+        for (size_t k = 0; k < n; k++) {
+            acc += v[k] * x[idx[k] * n_vecs + c];
+        }
+        y[c] = acc;
+    }
+}
+
+__attribute__((target("avx512f"))) static double
+LSSimd_dot_avx512_(const double *restrict a, const double *restrict x, size_t n) {
+    __m512d s0 = _mm512_setzero_pd();
+    __m512d s1 = _mm512_setzero_pd();
+    size_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        s0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + k), _mm512_loadu_pd(x + k), s0);
+        s1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + k + 8), _mm512_loadu_pd(x + k + 8), s1);
+    }
+    if (n - k >= 8) {
+        s0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + k), _mm512_loadu_pd(x + k), s0);
+        k += 8;
+    }
+    // The tail is loaded under a mask rather than finished in scalar code.
+    const __mmask8 m = (__mmask8)((1u << (n - k)) - 1);
+    s1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m, a + k), _mm512_maskz_loadu_pd(m, x + k), s1);
+    return _mm512_reduce_add_pd(_mm512_add_pd(s0, s1));
+}
+
+__attribute__((target("avx512f"))) static double
+LSSimd_gather_dot_avx512_(const double *restrict v, const size_t *restrict idx,
+                          const double *restrict x, size_t n) {
+    __m512d s = _mm512_setzero_pd();
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        const __m512i j = _mm512_loadu_si512(idx + k);
+        s = _mm512_fmadd_pd(_mm512_loadu_pd(v + k), _mm512_i64gather_pd(j, x, 8), s);
+    }
+    if (k < n) {
+        const __mmask8 m = (__mmask8)((1u << (n - k)) - 1);
+        const __m512i j = _mm512_maskz_loadu_epi64(m, idx + k);
+        const __m512d g = _mm512_mask_i64gather_pd(_mm512_setzero_pd(), m, j, x, 8);
+        s = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m, v + k), g, s);
+    }
+    return _mm512_reduce_add_pd(s);
+}
+
+__attribute__((target("avx512f"))) static void
+LSSimd_spmm_row_avx512_(const double *restrict v, const size_t *restrict idx, size_t n,
+                        const double *restrict x, size_t n_vecs, double *restrict y) {
+    for (size_t c = 0; c < n_vecs; c += 8) {
+        const __mmask8 m = n_vecs - c >= 8 ? 0xFF : (__mmask8)((1u << (n_vecs - c)) - 1);
+        __m512d acc = _mm512_maskz_loadu_pd(m, y + c);
+        for (size_t k = 0; k < n; k++) {
+            acc = _mm512_fmadd_pd(_mm512_set1_pd(v[k]),
+                                  _mm512_maskz_loadu_pd(m, x + idx[k] * n_vecs + c), acc);
+        }
+        _mm512_mask_storeu_pd(y + c, m, acc);
+    }
+}
+#endif
+
+static lssimd_dot_t dot_ = LSSimd_dot_scalar_;
+static lssimd_gather_dot_t gather_dot_ = LSSimd_gather_dot_scalar_;
+static lssimd_spmm_row_t spmm_row_ = LSSimd_spmm_row_scalar_;
+static const char *isa_ = "scalar";
+static once_flag select_once_ = ONCE_FLAG_INIT;
+
+static void LSSimd_select_(void) {
+#ifdef LSSIMD_X86_
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        dot_ = LSSimd_dot_avx512_;
+        gather_dot_ = LSSimd_gather_dot_avx512_;
+        spmm_row_ = LSSimd_spmm_row_avx512_;
+        isa_ = "avx512f";
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        dot_ = LSSimd_dot_avx2_;
+        gather_dot_ = LSSimd_gather_dot_avx2_;
+        spmm_row_ = LSSimd_spmm_row_avx2_;
+        isa_ = "avx2";
+    }
+#endif
+}
+
+double LSSimd_dot(const double *restrict a, const double *restrict x, size_t n) {
+    call_once(&select_once_, LSSimd_select_);
+    return dot_(a, x, n);
+}
+
+double LSSimd_gather_dot(const double *restrict v, const size_t *restrict idx,
+                         const double *restrict x, size_t n) {
+    call_once(&select_once_, LSSimd_select_);
+    return gather_dot_(v, idx, x, n);
+}
+
+void LSSimd_spmm_row(const double *restrict v, const size_t *restrict idx, size_t n,
+                     const double *restrict x, size_t n_vecs, double *restrict y) {
+    call_once(&select_once_, LSSimd_select_);
+    spmm_row_(v, idx, n, x, n_vecs, y);
+}
+
+const char *LSSimd_isa(void) {
+    call_once(&select_once_, LSSimd_select_);
+    return isa_;
+}
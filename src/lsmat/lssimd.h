@@ -0,0 +1,13 @@
+#ifndef LSSIMD_H_INCLUDED_
+#define LSSIMD_H_INCLUDED_
+
+#include <stddef.h>
+
+double LSSimd_dot(const double *restrict a, const double *restrict x, size_t n);
+double LSSimd_gather_dot(const double *restrict v, const size_t *restrict idx,
+                         const double *restrict x, size_t n);
+void LSSimd_spmm_row(const double *restrict v, const size_t *restrict idx, size_t n,
+                     const double *restrict x, size_t n_vecs, double *restrict y);
+const char *LSSimd_isa(void);
+
+#endif /* LSSIMD_H_INCLUDED_ */
@@ -0,0 +1,142 @@
+#include "lsmat/lsstats.h"
+#include "lsmat/lsarith.h"
+#include "lsmat/lsmat.h"
+#include "lsthreads.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STATS_TASKS_PER_THREAD_ 4u
+
+/*
+ * Tasks walk disjoint ranges of rows and columns and fold their counts in
+ * here once each, so the walk itself stays free of shared writes.
+ */
+typedef struct LSMatStatsAcc_ {
+    const LSMat_t *mat;
+    size_t n_tasks;
+    atomic_size_t nnz;
+    atomic_size_t bytes_index;
+    atomic_size_t max_len[LSMAT_AXIS_COUNT_];
+    atomic_size_t hist[LSMAT_AXIS_COUNT_][LSMAT_STATS_BINS];
+} LSMatStatsAcc_t;
+
+// Bin 0 holds empty lines, bin b > 0 lengths in [2^(b-1), 2^b); the last bin is open.
+static size_t LSMatStats_bin_of_(size_t len) {
+    size_t bin = 0;
+    while (len > 0 && bin < LSMAT_STATS_BINS - 1) {
+        len >>= 1;
+        bin++;
+    }
+    return bin;
+}
+
+size_t LSMatStats_bin_floor(size_t bin) {
+    return bin == 0 ? 0 : (size_t)1 << (bin - 1);
+}
+
+static void LSMatStats_fold_max_(atomic_size_t *restrict max, size_t len) {
+    size_t cur = atomic_load_explicit(max, memory_order_relaxed);
+    while (len > cur && !atomic_compare_exchange_weak(max, &cur, len)) {
+        ;
+    }
+}
+
+static size_t LSMatStats_col_len_(const LSMat_t *restrict mat, size_t j) {
+    // Dense rows are not linked into the columns.
+    size_t len = mat->heads[LSMAT_AXIS_1][j].len;
+    for (size_t i = LSMat_next_dense_row(mat, 0); i < mat->shape[LSMAT_AXIS_0];
+         i = LSMat_next_dense_row(mat, i + 1)) {
+        len += mat->heads[LSMAT_AXIS_0][i].dense[j] != 0.;
+    }
+    return len;
+}
+
+static void LSMatStats_task_(void *ctx, size_t task) {
+    LSMatStatsAcc_t *const acc = ctx;
+    const LSMat_t *const mat = acc->mat;
+    size_t hist[LSMAT_STATS_BINS];
+    size_t bytes_index = 0;
+    for (lsmat_axis_t axis = LSMAT_AXIS_0; axis < LSMAT_AXIS_COUNT_; axis++) {
+        const size_t n = mat->shape[axis];
+        const size_t begin = n * task / acc->n_tasks;
+        const size_t end = n * (task + 1) / acc->n_tasks;
+        size_t max_len = 0;
+        size_t sum = 0;
+        memset(hist, 0, sizeof(hist));
+        for (size_t i = begin; i < end; i++) {
+            const LSMatHead_t *const head = mat->heads[axis] + i;
+            const size_t len = axis == LSMAT_AXIS_0 ? head->len : LSMatStats_col_len_(mat, i);
+            hist[LSMatStats_bin_of_(len)]++;
+            max_len = len > max_len ? len : max_len;
+            sum += len;
+            bytes_index += LSMatHead_index_bytes(head);
+        }
+        for (size_t b = 0; b < LSMAT_STATS_BINS; b++) {
+            if (hist[b] > 0) {
+                atomic_fetch_add_explicit(&acc->hist[axis][b], hist[b], memory_order_relaxed);
+            }
+        }
+        LSMatStats_fold_max_(&acc->max_len[axis], max_len);
+        if (axis == LSMAT_AXIS_0) {
+            atomic_fetch_add_explicit(&acc->nnz, sum, memory_order_relaxed);
+        }
+    }
+    atomic_fetch_add_explicit(&acc->bytes_index, bytes_index, memory_order_relaxed);
+}
+
+/*
+ * Snapshot of the structure and memory of mat. Reads only, so any number of
+ * threads may take stats of the same matrix while nobody writes to it.
+ */
+lsmat_errno_t LSMat_stats(const LSMat_t *restrict mat, LSMatStats_t *restrict out) {
+    if (mat == NULL || out == NULL) {
+        return LSMAT_E_GEN;
+    }
+    LSMatStatsAcc_t acc;
+    memset(&acc, 0, sizeof(acc));
+    acc.mat = mat;
+    const size_t n_threads = LSArith_threads();
+    acc.n_tasks = n_threads * STATS_TASKS_PER_THREAD_;
+    LSThreads_run(n_threads, acc.n_tasks, LSMatStats_task_, &acc);
+
+    memset(out, 0, sizeof(LSMatStats_t));
+    memcpy(out->shape, mat->shape, sizeof(out->shape));
+    out->nnz = atomic_load(&acc.nnz);
+    out->n_dense_rows = mat->n_dense_rows;
+    for (lsmat_axis_t axis = LSMAT_AXIS_0; axis < LSMAT_AXIS_COUNT_; axis++) {
+        out->max_len[axis] = atomic_load(&acc.max_len[axis]);
+        out->mean_len[axis] =
+            mat->shape[axis] > 0 ? (double)out->nnz / (double)mat->shape[axis] : 0.;
+        for (size_t b = 0; b < LSMAT_STATS_BINS; b++) {
+            out->hist[axis][b] = atomic_load(&acc.hist[axis][b]);
+        }
+    }
+    out->bytes_struct = sizeof(LSMat_t) + mat->n_dense_words * sizeof(uint64_t);
+    out->bytes_heads =
+        (mat->shape[LSMAT_AXIS_0] + mat->shape[LSMAT_AXIS_1]) * sizeof(LSMatHead_t);
+    out->bytes_dense = mat->n_dense_rows * mat->shape[LSMAT_AXIS_1] * sizeof(double);
+    out->bytes_index = atomic_load(&acc.bytes_index);
+    // Slack is everything the arena holds that no list uses: recycled cells,
+    // the unused tail of the slabs and the slab headers.
+    size_t cap = 0;
+    size_t used = 0;
+    size_t n_slabs = 0;
+    for (const LSMatSlab_t *p = mat->arena.slabs; p != NULL; p = p->next) {
+        cap += p->cap;
+        used += p->used;
+        n_slabs++;
+    }
+    const size_t n_free = atomic_load_explicit(&mat->arena.n_free, memory_order_relaxed);
+    used = used > n_free ? used - n_free : 0;
+    out->bytes_cells = used * sizeof(LSMatCell_t);
+    out->bytes_slack = (cap - used) * sizeof(LSMatCell_t) + n_slabs * sizeof(LSMatSlab_t);
+    return LSMAT_OK;
+}
+
+size_t LSMatStats_bytes(const LSMatStats_t *restrict stats) {
+    return stats->bytes_struct + stats->bytes_heads + stats->bytes_cells + stats->bytes_slack +
+           stats->bytes_dense + stats->bytes_index;
+}
@@ -0,0 +1,134 @@
+#include "lsthreads.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+
+/*
+ * A single process-wide pool of workers. The calling thread takes part in
+ * every run, so a run on n threads keeps n - 1 workers around.
+ */
+typedef struct LSThreadPool_ {
+    mtx_t run_lock;
+    mtx_t lock;
+    cnd_t wake;
+    cnd_t done;
+    thrd_t *workers;
+    size_t n_workers;
+    size_t n_active;
+    uint64_t gen;
+    bool stopping;
+    lsthreads_task_t task;
+    void *ctx;
+    size_t n_tasks;
+    atomic_size_t next_task;
+} LSThreadPool_t;
+
+static LSThreadPool_t pool_;
+static once_flag pool_once_ = ONCE_FLAG_INIT;
+
+static void LSThreads_init_(void) {
+    mtx_init(&pool_.run_lock, mtx_plain);
+    mtx_init(&pool_.lock, mtx_plain);
+    cnd_init(&pool_.wake);
+    cnd_init(&pool_.done);
+}
+
+static void LSThreads_drain_(void) {
+    size_t t;
+    while ((t = atomic_fetch_add(&pool_.next_task, 1)) < pool_.n_tasks) {
+        pool_.task(pool_.ctx, t);
+    }
+}
+
+static int LSThreads_worker_(void *arg) {
+    (void)arg;
+    uint64_t seen = 0;
+    mtx_lock(&pool_.lock);
+    for (;;) {
+        while (!pool_.stopping && pool_.gen == seen) {
+            cnd_wait(&pool_.wake, &pool_.lock);
+        }
+        if (pool_.stopping) {
+            break;
+        }
+        seen = pool_.gen;
+        mtx_unlock(&pool_.lock);
+        LSThreads_drain_();
+        mtx_lock(&pool_.lock);
+        if (--pool_.n_active == 0) {
+            cnd_signal(&pool_.done);
+        }
+    }
+    mtx_unlock(&pool_.lock);
+    return 0;
+}
+
+static void LSThreads_stop_locked_(void) {
+    mtx_lock(&pool_.lock);
+    pool_.stopping = true;
+    cnd_broadcast(&pool_.wake);
+    mtx_unlock(&pool_.lock);
+    for (size_t i = 0; i < pool_.n_workers; i++) {
+        thrd_join(pool_.workers[i], NULL);
+    }
+    free(pool_.workers);
+    pool_.workers = NULL;
+    pool_.n_workers = 0;
+    pool_.stopping = false;
+}
+
+static void LSThreads_resize_locked_(size_t n_workers) {
+    if (pool_.n_workers == n_workers) {
+        return;
+    }
+    LSThreads_stop_locked_();
+    pool_.workers = malloc(n_workers * sizeof(thrd_t));
+    if (pool_.workers == NULL) {
+        return;
+    }
+    // Workers start out having seen the current generation.
+    pool_.gen = 0;
+    while (pool_.n_workers < n_workers &&
+           thrd_create(pool_.workers + pool_.n_workers, LSThreads_worker_, NULL) == thrd_success) {
+        pool_.n_workers++;
+    }
+}
+
+void LSThreads_run(size_t n_threads, size_t n_tasks, lsthreads_task_t task, void *ctx) {
+    if (n_threads <= 1 || n_tasks <= 1) {
+        for (size_t t = 0; t < n_tasks; t++) {
+            task(ctx, t);
+        }
+        return;
+    }
+    call_once(&pool_once_, LSThreads_init_);
+    mtx_lock(&pool_.run_lock);
+    LSThreads_resize_locked_(n_threads - 1);
+    mtx_lock(&pool_.lock);
+    pool_.task = task;
+    pool_.ctx = ctx;
+    pool_.n_tasks = n_tasks;
+    atomic_store(&pool_.next_task, 0);
+    pool_.n_active = pool_.n_workers;
+    pool_.gen++;
+    cnd_broadcast(&pool_.wake);
+    mtx_unlock(&pool_.lock);
+    // Whatever the workers do not pick up runs here, so a pool that failed
+    // to spawn degrades to a serial run.
+    LSThreads_drain_();
+    mtx_lock(&pool_.lock);
+    while (pool_.n_active > 0) {
+        cnd_wait(&pool_.done, &pool_.lock);
+    }
+    mtx_unlock(&pool_.lock);
+    mtx_unlock(&pool_.run_lock);
+}
+
+void LSThreads_shutdown(void) {
+    call_once(&pool_once_, LSThreads_init_);
+    mtx_lock(&pool_.run_lock);
+    LSThreads_stop_locked_();
+    mtx_unlock(&pool_.run_lock);
+}
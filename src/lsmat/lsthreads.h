@@ -0,0 +1,12 @@
+#ifndef LSTHREADS_H_INCLUDED_
+#define LSTHREADS_H_INCLUDED_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef void (*lsthreads_task_t)(void *ctx, size_t task);
+
+void LSThreads_run(size_t n_threads, size_t n_tasks, lsthreads_task_t task, void *ctx);
+void LSThreads_shutdown(void);
+
+#endif /* LSTHREADS_H_INCLUDED_ */
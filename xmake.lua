@@ -1,31 +1,63 @@
-add_rules("mode.debug", "mode.release")
-
-set_languages("c17")
-set_warnings("all", "extra", "pedantic")
-
-if is_mode("debug") then
-    set_optimize("none")
-    set_symbols("debug", "hidden")
-else
-    set_optimize("fastest")
-    set_symbols("hidden")
-    set_strip("all")
-end
-set_policy("build.sanitizer.address", true)
-set_policy("build.sanitizer.undefined", true)
-
-add_includedirs("include")
-
-add_requires("readline ~8")
-
-target("lsmat")
-    set_kind("static")
-    add_files("src/lsmat/*.c")
-target_end()
-
-target("lsmat_cli")
-    set_kind("binary")
-    add_files("src/cli/*.c")
-    add_deps("lsmat")
-    add_packages("readline")
-target_end()
+add_rules("mode.debug", "mode.release")
+
+set_languages("c17")
+set_warnings("all", "extra", "pedantic")
+
+if is_mode("debug") then
+    set_optimize("none")
+    set_symbols("debug", "hidden")
+else
+    set_optimize("fastest")
+    set_symbols("hidden")
+    set_strip("all")
+end
+set_policy("build.sanitizer.address", true)
+set_policy("build.sanitizer.undefined", true)
+
+add_includedirs("include")
+
+option("compact_index")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Store cell indices as 32-bit integers")
+    add_defines("LSMAT_COMPACT_INDEX")
+option_end()
+
+option("singly_linked")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Drop backward links from matrix cells")
+    add_defines("LSMAT_SINGLY_LINKED")
+option_end()
+
+option("prof")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Count hot-path events and time library calls")
+    add_defines("LSMAT_PROF")
+option_end()
+
+add_options("compact_index", "singly_linked", "prof")
+
+add_requires("readline ~8")
+
+target("lsmat")
+    set_kind("static")
+    add_files("src/lsmat/*.c")
+    if not is_plat("windows") then
+        add_syslinks("pthread", "m", {public = true})
+    end
+target_end()
+
+target("lsmat_cli")
+    set_kind("binary")
+    add_files("src/cli/*.c")
+    add_deps("lsmat")
+    add_packages("readline")
+target_end()
+
+target("lsmat_bench")
+    set_kind("binary")
+    add_files("src/bench/*.c")
+    add_deps("lsmat")
+target_end()